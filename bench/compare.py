@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""compares two bench.json files written by axenc-compiler-bench and fails when a stage got slower."""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data, {program["name"]: program for program in data["programs"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="percent a stage may slow down before it counts as a regression (default: 5)")
+    parser.add_argument("--min-seconds", type=float, default=0.001,
+                        help="stages faster than this in the baseline are only printed, their timings are noise "
+                             "(default: 0.001)")
+    args = parser.parse_args()
+
+    baseline_data, baseline = load(args.baseline)
+    current_data, current = load(args.current)
+
+    # timings of different inputs say nothing about each other
+    if baseline_data["scale"] != current_data["scale"]:
+        sys.exit(f"scales differ: {baseline_data['scale']} and {current_data['scale']}")
+
+    regressions = []
+    for name, program in current.items():
+        if name not in baseline:
+            print(f"{name}: not in the baseline")
+            continue
+
+        print(f"{name}:")
+        for stage, result in program["stages"].items():
+            before = baseline[name]["stages"].get(stage)
+            if before is None:
+                continue
+
+            # a stage of a tiny program can round to no time at all, which has no percentage to compare
+            if before["seconds"] < args.min_seconds:
+                print(f"  {stage:<9} {before['seconds']:10.4f}s -> {result['seconds']:10.4f}s   too short to compare")
+                continue
+
+            delta = (result["seconds"] - before["seconds"]) / before["seconds"] * 100
+            marker = ""
+            if delta > args.threshold:
+                marker = "  <- regression"
+                regressions.append(f"{name}/{stage}")
+
+            print(f"  {stage:<9} {before['seconds']:10.4f}s -> {result['seconds']:10.4f}s {delta:+7.1f}%{marker}")
+
+    if regressions:
+        print(f"\n{len(regressions)} stage(s) slower by more than {args.threshold}%: {', '.join(regressions)}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "driver.hpp"
+#include "generator.hpp"
+#include "lexer.hpp"
+#include "nodes/context.hpp"
+#include "parser.hpp"
+
+using namespace axen;
+
+namespace {
+
+// the stages of a compilation, each one timed on its own
+enum Stage { Lex, Parse, Codegen, Optimize, Emit, StageCount };
+
+constexpr const char *stageNames[StageCount] = {"lex", "parse", "codegen", "optimize", "emit"};
+
+struct Result {
+  std::string name;
+  size_t bytes = 0;
+  size_t functions = 0;
+
+  // the fastest iteration of each stage, the minimum is the least noisy estimate on a shared machine
+  double seconds[StageCount];
+};
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/// writes the files of program into dir and returns the path of its root.
+std::string writeProgram(const bench::GeneratedProgram &program, const std::filesystem::path &dir) {
+  std::filesystem::create_directories(dir);
+  for (const auto &file : program.files)
+    std::ofstream(dir / file.name, std::ios::binary) << file.source;
+  return (dir / program.files.front().name).string();
+}
+
+Result runProgram(const bench::GeneratedProgram &program, const std::filesystem::path &dir, unsigned iterations,
+                  driver::OptLevel level) {
+  Result result;
+  result.name = program.name;
+  std::fill(std::begin(result.seconds), std::end(result.seconds), std::numeric_limits<double>::infinity());
+
+  for (const auto &file : program.files)
+    result.bytes += file.source.size();
+
+  std::string rootPath = writeProgram(program, dir);
+  std::string objectPath = (dir / "bench.o").string();
+
+  driver::TargetSelection selection;
+  auto targetMachine = driver::createTargetMachine(selection, level);
+  llvm::DefaultThreadPool importPool(llvm::hardware_concurrency());
+
+  for (unsigned i = 0; i < iterations; i++) {
+    // the lexer on its own, over every file of the program
+    auto start = Clock::now();
+    for (const auto &file : program.files) {
+      SymbolTable symbols;
+      lexer::Lexer lexer(file.source, symbols);
+      while (lexer.consume().type != lexer::TokenType::EndOfFile) {
+      }
+    }
+    result.seconds[Lex] = std::min(result.seconds[Lex], secondsSince(start));
+
+    // parsing lexes again, imports are read from disk like they are in a real compilation
+    SymbolTable symbols;
+    auto source = llvm::MemoryBuffer::getFile(rootPath);
+    if (!source) {
+      std::fprintf(stderr, "could not read '%s'\n", rootPath.c_str());
+      std::exit(1);
+    }
+
+    start = Clock::now();
+    auto parser = std::make_unique<parser::Parser>(std::move(*source), symbols, rootPath);
+    parser->setImportPool(&importPool);
+    parser->parse();
+    result.seconds[Parse] = std::min(result.seconds[Parse], secondsSince(start));
+
+    ast::CodegenContext ctx(rootPath, symbols);
+    ctx.module->setTargetTriple(targetMachine->getTargetTriple());
+    ctx.module->setDataLayout(targetMachine->createDataLayout());
+
+    start = Clock::now();
+    for (const auto &structure : *parser->getStructs())
+      structure->codeGen(ctx);
+    for (const auto &function : *parser->getFunctions())
+      function->declare(ctx);
+    for (const auto &function : *parser->getFunctions())
+      function->codeGen(ctx);
+    ast::FunctionNode::inferAttributes(ctx);
+    result.seconds[Codegen] = std::min(result.seconds[Codegen], secondsSince(start));
+
+    // a broken generator would only measure how fast errors are found
+    if (llvm::verifyModule(*ctx.module, &llvm::errs())) {
+      std::fprintf(stderr, "'%s' does not verify\n", program.name.c_str());
+      std::exit(1);
+    }
+
+    result.functions = 0;
+    for (const auto &function : *ctx.module)
+      result.functions += !function.isDeclaration();
+
+    start = Clock::now();
+    driver::optimizeModule(*ctx.module, targetMachine.get(), level);
+    result.seconds[Optimize] = std::min(result.seconds[Optimize], secondsSince(start));
+
+    start = Clock::now();
+    driver::emitObjectFile(*ctx.module, *targetMachine, objectPath);
+    result.seconds[Emit] = std::min(result.seconds[Emit], secondsSince(start));
+  }
+
+  return result;
+}
+
+void printResult(const Result &result) {
+  std::printf("%s: %.2f MB, %zu functions\n", result.name.c_str(), result.bytes / 1e6, result.functions);
+  for (int stage = 0; stage < StageCount; stage++) {
+    double seconds = result.seconds[stage];
+    std::printf("  %-9s %10.4fs %10.1f MB/s %12.0f functions/s\n", stageNames[stage], seconds,
+                result.bytes / seconds / 1e6, result.functions / seconds);
+  }
+}
+
+void writeJson(const std::vector<Result> &results, const std::string &path, unsigned scale, unsigned iterations) {
+  std::error_code EC;
+  llvm::raw_fd_ostream os(path, EC, llvm::sys::fs::OF_Text);
+  if (EC) {
+    std::fprintf(stderr, "could not write '%s': %s\n", path.c_str(), EC.message().c_str());
+    std::exit(1);
+  }
+
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attribute("scale", static_cast<int64_t>(scale));
+    json.attribute("iterations", static_cast<int64_t>(iterations));
+    json.attributeArray("programs", [&] {
+      for (const auto &result : results) {
+        json.object([&] {
+          json.attribute("name", result.name);
+          json.attribute("bytes", static_cast<int64_t>(result.bytes));
+          json.attribute("functions", static_cast<int64_t>(result.functions));
+          json.attributeObject("stages", [&] {
+            for (int stage = 0; stage < StageCount; stage++) {
+              double seconds = result.seconds[stage];
+              json.attributeObject(stageNames[stage], [&] {
+                json.attribute("seconds", seconds);
+                json.attribute("mb_per_s", result.bytes / seconds / 1e6);
+                json.attribute("functions_per_s", result.functions / seconds);
+              });
+            }
+          });
+        });
+      }
+    });
+  });
+  os << "\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  unsigned iterations = 5;
+  unsigned scale = 1;
+  std::string only;
+  std::string jsonPath;
+  std::string writeDir;
+  driver::OptLevel level = driver::OptLevel::O2;
+
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+      scale = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(argv[i], "--program") == 0 && i + 1 < argc) {
+      only = argv[++i];
+    } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else if (std::strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+      writeDir = argv[++i];
+    } else if (!driver::parseOptLevel(argv[i], level)) {
+      std::fprintf(stderr, "usage: %s [-n iterations] [--scale n] [--program name] [--json file] [--write dir] [-O<n>]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<bench::GeneratedProgram> programs = bench::generateAll(scale);
+
+  // only dump the sources, for profiling axenc itself on them
+  if (!writeDir.empty()) {
+    for (const auto &program : programs)
+      std::printf("%s\n", writeProgram(program, std::filesystem::path(writeDir) / program.name).c_str());
+    return 0;
+  }
+
+  auto workDir = std::filesystem::temp_directory_path() / ("axenc-bench-" + std::to_string(::getpid()));
+
+  std::vector<Result> results;
+  for (const auto &program : programs) {
+    if (!only.empty() && program.name != only)
+      continue;
+
+    results.push_back(runProgram(program, workDir / program.name, iterations, level));
+    printResult(results.back());
+  }
+
+  std::filesystem::remove_all(workDir);
+
+  if (results.empty()) {
+    std::fprintf(stderr, "no program named '%s'\n", only.c_str());
+    return 1;
+  }
+
+  if (!jsonPath.empty())
+    writeJson(results, jsonPath, scale, iterations);
+
+  return 0;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// deterministic generators of large synthetic axen programs. the output only depends on the scale, so runs of the
+// benchmark on different builds compile byte for byte the same sources.
+namespace axen::bench {
+
+/// one generated file, imports name their files relative to the directory the program is written to.
+struct GeneratedFile {
+  std::string name;
+  std::string source;
+};
+
+/// a generated program, the first file is the root.
+struct GeneratedProgram {
+  std::string name;
+  std::vector<GeneratedFile> files;
+};
+
+// a fixed lcg instead of <random>, whose distributions are allowed to differ between standard libraries
+class Sequence {
+public:
+  explicit Sequence(uint64_t seed) : state_(seed) {}
+
+  uint32_t next(uint32_t bound) {
+    state_ = state_ * 6364136223846793005ull + 1442695040888963407ull;
+    return static_cast<uint32_t>(state_ >> 33) % bound;
+  }
+
+private:
+  uint64_t state_;
+};
+
+/// a class with thousands of members of mixed types, and methods that touch all of them.
+inline GeneratedProgram generateWideClass(unsigned scale) {
+  static constexpr const char *types[] = {"int", "long", "short", "char", "double", "float"};
+  unsigned members = 4000 * scale;
+  Sequence sequence(1);
+
+  std::string source = "class Wide {\n";
+  for (unsigned i = 0; i < members; i++)
+    source += std::string("  ") + types[sequence.next(6)] + " m" + std::to_string(i) + ";\n";
+
+  // one method per block of members keeps every expression of a reasonable length
+  unsigned methods = members / 50;
+  for (unsigned method = 0; method < methods; method++) {
+    source += "\n  double sum" + std::to_string(method) + "() {\n    return m" + std::to_string(method * 50);
+    for (unsigned i = method * 50 + 1; i < (method + 1) * 50; i++)
+      source += " + m" + std::to_string(i);
+    source += ";\n  }\n";
+
+    source += "\n  void set" + std::to_string(method) + "(int value) {\n";
+    for (unsigned i = method * 50; i < (method + 1) * 50; i++)
+      source += "    m" + std::to_string(i) + " = value;\n";
+    source += "  }\n";
+  }
+  source += "}\n\nint main() {\n  Wide w;\n  w.set0(1);\n  return 0;\n}\n";
+
+  return {"wide-class", {{"wide.ax", std::move(source)}}};
+}
+
+/// a chain of files where every file imports the next one and calls into it.
+inline GeneratedProgram generateImportChain(unsigned scale) {
+  unsigned depth = 200 * scale;
+  unsigned functions = 10;
+
+  GeneratedProgram program{"import-chain", {}};
+  for (unsigned file = 0; file < depth; file++) {
+    std::string source;
+    bool last = file + 1 == depth;
+    if (!last)
+      source += "import \"chain" + std::to_string(file + 1) + ".ax\";\n\n";
+
+    for (unsigned function = 0; function < functions; function++) {
+      std::string name = "chain" + std::to_string(file) + "f" + std::to_string(function);
+      source += "int " + name + "(int x) {\n  int y = x * " + std::to_string(function + 2) + ";\n";
+      if (last)
+        source += "  return y + " + std::to_string(function) + ";\n}\n\n";
+      else
+        source += "  return chain" + std::to_string(file + 1) + "f" + std::to_string(function) + "(y) - x;\n}\n\n";
+    }
+
+    if (file == 0)
+      source += "int main() {\n  return chain0f0(1);\n}\n";
+
+    program.files.push_back({"chain" + std::to_string(file) + ".ax", std::move(source)});
+  }
+
+  return program;
+}
+
+/// a single function with tens of thousands of statements, loops and branches included.
+inline GeneratedProgram generateHugeFunction(unsigned scale) {
+  unsigned variables = 64;
+  unsigned statements = 20000 * scale;
+  Sequence sequence(2);
+
+  std::string source = "int huge(int seed) {\n";
+  for (unsigned i = 0; i < variables; i++)
+    source += "  int v" + std::to_string(i) + " = seed + " + std::to_string(i) + ";\n";
+
+  for (unsigned i = 0; i < statements; i++) {
+    std::string target = "v" + std::to_string(sequence.next(variables));
+    std::string lhs = "v" + std::to_string(sequence.next(variables));
+    std::string rhs = "v" + std::to_string(sequence.next(variables));
+
+    switch (sequence.next(8)) {
+    case 0:
+      source += "  while (" + lhs + " > " + rhs + ") {\n    " + lhs + " = " + lhs + " - 1;\n  }\n";
+      break;
+    case 1:
+      source += "  if (" + lhs + " < " + rhs + ") {\n    " + target + " = " + rhs + ";\n    " + lhs + " = " + lhs +
+                " + 1;\n  }\n";
+      break;
+    default:
+      source += "  " + target + " = " + lhs + " * " + std::to_string(sequence.next(7) + 1) + " + " + rhs + ";\n";
+    }
+  }
+
+  source += "  return v0;\n}\n\nint main() {\n  return huge(3);\n}\n";
+  return {"huge-function", {{"huge.ax", std::move(source)}}};
+}
+
+/// many functions that each return one long arithmetic expression over their parameters.
+inline GeneratedProgram generateLongExpressions(unsigned scale) {
+  static constexpr const char *operators[] = {" + ", " - ", " * "};
+  static constexpr const char *operands[] = {"a", "b", "c", "d"};
+  unsigned functions = 200 * scale;
+  unsigned terms = 500;
+  Sequence sequence(3);
+
+  std::string source;
+  for (unsigned function = 0; function < functions; function++) {
+    source += "long expr" + std::to_string(function) + "(long a, long b, long c, long d) {\n  return a";
+    for (unsigned term = 1; term < terms; term++) {
+      source += operators[sequence.next(3)];
+      // some literals, but never two in a row so nothing folds away in the parser
+      if (term % 2 == 0 && sequence.next(2) == 0)
+        source += std::to_string(sequence.next(100) + 1);
+      else
+        source += operands[sequence.next(4)];
+    }
+    source += ";\n}\n\n";
+  }
+
+  source += "int main() {\n  return 0;\n}\n";
+  return {"long-expressions", {{"expressions.ax", std::move(source)}}};
+}
+
+/// functions passing string literals around, a quarter of them repeated so the string pool has work to do.
+inline GeneratedProgram generateStrings(unsigned scale) {
+  unsigned functions = 2000 * scale;
+  unsigned literals = 8;
+  Sequence sequence(4);
+
+  std::string source = "int puts(ptr char s);\n\n";
+  for (unsigned function = 0; function < functions; function++) {
+    source += "void say" + std::to_string(function) + "() {\n";
+    for (unsigned literal = 0; literal < literals; literal++) {
+      if (sequence.next(4) == 0)
+        source += "  puts(\"shared message " + std::to_string(sequence.next(16)) + "\");\n";
+      else
+        source += "  puts(\"message " + std::to_string(function) + "." + std::to_string(literal) +
+                  " with \\\"escapes\\\"\\tand some padding to make it longer\\n\");\n";
+    }
+    source += "}\n\n";
+  }
+
+  source += "int main() {\n  say0();\n  return 0;\n}\n";
+  return {"strings", {{"strings.ax", std::move(source)}}};
+}
+
+inline std::vector<GeneratedProgram> generateAll(unsigned scale) {
+  return {generateWideClass(scale), generateImportChain(scale), generateHugeFunction(scale),
+          generateLongExpressions(scale), generateStrings(scale)};
+}
+
+} // namespace axen::bench
@@ -0,0 +1,85 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "lexer.hpp"
+
+using namespace axen;
+
+/// builds a synthetic source of roughly size bytes out of typical declarations, comments and expressions.
+static std::string generateSource(size_t size) {
+  static constexpr const char *chunk = "// computes the sum of the first n elements\n"
+                                       "int sumArray(int* values, int count) {\n"
+                                       "  int total = 0;\n"
+                                       "  int index = 0;\n"
+                                       "  /* walks the array front to back */\n"
+                                       "  while (index < count) {\n"
+                                       "    total = total + values[index];\n"
+                                       "    index = index + 1;\n"
+                                       "  }\n"
+                                       "  return total;\n"
+                                       "}\n\n"
+                                       "class Vector3 {\n"
+                                       "  float x;\n"
+                                       "  float y;\n"
+                                       "  float z;\n\n"
+                                       "  float dot(Vector3* other) {\n"
+                                       "    return x * other.x + y * other.y + z * other.z;\n"
+                                       "  }\n"
+                                       "}\n\n"
+                                       "int mask = 0xff00ff;\n"
+                                       "str greeting = \"hello, \\\"world\\\"\\n\";\n\n";
+
+  std::string source;
+  source.reserve(size + std::strlen(chunk));
+  while (source.size() < size)
+    source += chunk;
+  return source;
+}
+
+int main(int argc, char **argv) {
+  std::string source;
+  unsigned iterations = 20;
+
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      source = generateSource(std::strtoull(argv[++i], nullptr, 10));
+    } else {
+      std::ifstream in(argv[i], std::ios::binary);
+      if (!in) {
+        std::fprintf(stderr, "could not open '%s'\n", argv[i]);
+        return 1;
+      }
+      std::ostringstream ss;
+      ss << in.rdbuf();
+      source = ss.str();
+    }
+  }
+
+  if (source.empty())
+    source = generateSource(16 << 20);
+
+  size_t tokens = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned i = 0; i < iterations; i++) {
+    // a fresh table per iteration so every run pays for interning like a real compilation does
+    SymbolTable symbols;
+    lexer::Lexer lexer(source, symbols);
+    while (lexer.consume().type != lexer::TokenType::EndOfFile)
+      tokens++;
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  double bytes = static_cast<double>(source.size()) * iterations;
+
+  std::printf("lexed %zu bytes x %u in %.3fs\n", source.size(), iterations, elapsed.count());
+  std::printf("%.1f MB/s, %.1f Mtokens/s\n", bytes / elapsed.count() / 1e6, tokens / elapsed.count() / 1e6);
+  return 0;
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CodeGen.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/Timer.h>
+#include <llvm/Target/TargetMachine.h>
+
+namespace axen::ast {
+struct Instrumentation;
+} // namespace axen::ast
+
+namespace axen::driver {
+
+enum class OptLevel {
+  O0,
+  O1,
+  O2,
+  O3,
+  Os,
+  Oz,
+};
+
+/// parses an '-O<n>' argument. returns false if the argument is not a valid optimization level.
+bool parseOptLevel(const std::string &arg, OptLevel &level);
+
+enum class EmitKind {
+  Object,
+  Assembly,
+  Bitcode,
+  IR,
+};
+
+/// parses the value of '--emit=<obj|asm|bc|ll>'. returns false if it names no output kind.
+bool parseEmitKind(const std::string &value, EmitKind &kind);
+
+enum class LTOMode {
+  None,
+  Thin,
+  Full,
+};
+
+/// parses the value of '-flto=<thin|full>'. returns false if it names no lto mode.
+bool parseLTOMode(const std::string &value, LTOMode &mode);
+
+/// returns the backend optimization level matching the ir optimization level.
+llvm::CodeGenOptLevel toCodeGenOptLevel(OptLevel level);
+
+struct TargetSelection {
+  // empty triple means the default target triple of the host
+  std::string triple;
+
+  // 'native' selects the host cpu along with all of its features
+  std::string cpu = "generic";
+
+  // comma separated list of '+feature' or '-feature' entries
+  std::string features;
+};
+
+/// resolves 'native' and the default triple in selection, then creates a matching target machine. only the backend
+/// of the selected target is initialized.
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(TargetSelection &selection, OptLevel level);
+
+/// creates a target machine now and hands it to the next createTargetMachine call for the same selection and level.
+/// the compile server keeps one, so every compilation forked from it starts with a warm target machine.
+void keepTargetMachine(const TargetSelection &selection, OptLevel level);
+
+/// profile guided optimization. an instrumented program writes raw profiles, llvm-profdata merges them into the
+/// indexed profile that is read back. profiles match functions by name, so they stay valid as long as the functions
+/// keep theirs.
+struct ProfileOptions {
+  // '-fprofile-generate[=dir]', where the instrumented program writes its raw profile. empty when not instrumenting
+  std::string generatePath;
+
+  // '-fprofile-use=<file>', the indexed profile block layout, inlining and hot and cold placement are based on
+  std::string usePath;
+};
+
+/// returns the raw profile path an instrumented program writes to dir, '%m' keeps the profiles of different
+/// programs apart.
+std::string getProfileGeneratePath(const std::string &dir);
+
+/// runs the default new pass manager pipeline for the given level over the module. with lto only the pre-link
+/// pipeline runs, the rest of the optimization happens in the linker once every module is known. the pipeline
+/// instruments the module or applies a profile to it as profile selects.
+void optimizeModule(llvm::Module &module, llvm::TargetMachine *targetMachine, OptLevel level,
+                    LTOMode lto = LTOMode::None, const ProfileOptions &profile = {});
+
+/// simplifies functions one at a time as they are generated (sroa, early cse, simplifycfg and instcombine), so a
+/// streamed module holds the promoted form of every body instead of its allocas. the module pipeline still runs over
+/// the whole module afterwards.
+class FunctionOptimizer {
+public:
+  explicit FunctionOptimizer(llvm::TargetMachine *targetMachine);
+  ~FunctionOptimizer();
+
+  FunctionOptimizer(const FunctionOptimizer &) = delete;
+  FunctionOptimizer &operator=(const FunctionOptimizer &) = delete;
+
+  void run(llvm::Function &function);
+
+private:
+  struct Pipeline;
+  std::unique_ptr<Pipeline> pipeline_;
+};
+
+/// emits the module as a native object or assembly file at path.
+void emitObjectFile(llvm::Module &module, llvm::TargetMachine &targetMachine, const std::string &path,
+                    llvm::CodeGenFileType fileType = llvm::CodeGenFileType::ObjectFile);
+
+/// writes the module as bitcode at path. lto bitcode carries the module summary lld, gold and ld64 need to link it
+/// with bitcode from other languages, thin lto bitcode is written the way clang writes it for '-flto=thin'.
+void emitBitcodeFile(llvm::Module &module, const std::string &path, LTOMode lto);
+
+/// writes the module as textual ir at path.
+void emitIRFile(llvm::Module &module, const std::string &path);
+
+/// jit compiles the module for the host, runs its main with args and returns the exit code of main. a lazy jit only
+/// compiles functions once they are first called.
+int runModule(llvm::Module &module, const TargetSelection &selection, OptLevel level, bool lazy,
+              const std::vector<std::string> &args);
+
+/// returns the output path of partition index when an object is split into multiple partitions.
+std::string getPartitionPath(const std::string &outputFile, unsigned index);
+
+/// returns the suffix flushPartition gives the locals it promotes. it is derived from the canonical path and the
+/// contents of srcFile, so two sources of the same name never get the same one and rebuilds stay reproducible.
+std::string getPartitionSuffix(const std::string &srcFile);
+
+/// moves every function the module defines so far into a partition of its own, which is optimized and written to
+/// path as an object, and leaves declarations of them behind. locals become hidden globals named with suffix, so the
+/// partitions written later still link against them. constants are copied instead.
+void flushPartition(llvm::Module &module, llvm::TargetMachine &targetMachine, OptLevel level,
+                    const std::string &suffix, const std::string &path);
+
+/// splits the module into jobs partitions, then optimizes and emits each partition on a thread of pool with its own
+/// context and target machine. returns the paths of the written object files.
+std::vector<std::string> emitParallel(llvm::Module &module, const TargetSelection &selection, OptLevel level,
+                                      const ProfileOptions &profile, unsigned jobs, const std::string &outputFile,
+                                      llvm::ThreadPoolInterface &pool);
+
+enum class StatsFormat {
+  None,
+  Text,
+  Json,
+};
+
+/// parses the value of '--stats=<text|json>'. returns false if it names no format.
+bool parseStatsFormat(const std::string &value, StatsFormat &format);
+
+/// times the phases of a compilation and collects the counters --stats reports. every phase is an llvm timer printed
+/// by -ftime-report and a region of the chrome trace written by -ftime-trace. everything is reported once the
+/// statistics are destroyed, so early returns are still covered.
+class CompileStats {
+public:
+  class Phase {
+  public:
+    Phase(llvm::Timer &timer, llvm::StringRef name) : timer_(timer), trace_(name) {}
+
+  private:
+    llvm::TimeRegion timer_;
+    llvm::TimeTraceScope trace_;
+  };
+
+  /// an empty trace file leaves the time trace profiler off, an empty stats file reports to stderr.
+  CompileStats(bool timeReport, std::string traceFile, StatsFormat format, std::string statsFile);
+  ~CompileStats();
+
+  CompileStats(const CompileStats &) = delete;
+  CompileStats &operator=(const CompileStats &) = delete;
+
+  /// times the phase until the returned phase goes out of scope, a phase that runs again accumulates.
+  Phase phase(llvm::StringRef name);
+
+  /// counters are reported in the order they are first counted, counting one again adds to it so a batch of files
+  /// reports totals.
+  void count(llvm::StringRef name, uint64_t value);
+
+  /// counts the defined functions, declarations and instructions of module, suffix tells apart counts of the same
+  /// module at different points.
+  void countModule(const llvm::Module &module, llvm::StringRef suffix = "");
+
+  void addImportTimes(const std::vector<std::pair<std::string, double>> &importTimes) {
+    importTimes_.insert(importTimes_.end(), importTimes.begin(), importTimes.end());
+  }
+
+private:
+  void printText(llvm::raw_ostream &os);
+  void printJson(llvm::raw_ostream &os);
+
+  bool timeReport_;
+  std::string traceFile_;
+  StatsFormat format_;
+  std::string statsFile_;
+
+  // the timers are destroyed before their group
+  llvm::TimerGroup timerGroup_;
+  std::vector<std::unique_ptr<llvm::Timer>> timers_;
+  llvm::StringMap<llvm::Timer *> timersByName_;
+
+  std::vector<std::pair<std::string, uint64_t>> counters_;
+  std::vector<std::pair<std::string, double>> importTimes_;
+};
+
+/// serves compilations on a unix socket at socketPath until the server is killed. every request is compiled by a
+/// child forked from the server, with the arguments, working directory and standard streams of the client. children
+/// start out with the targets and interface files the server has loaded, and an error only ends the child. the socket
+/// is only accessible to the user running the server, and connections from other users are refused. a socket left at
+/// socketPath is replaced, anything else there is an error.
+void runServer(const std::string &socketPath, const std::function<int(int, char **)> &compile);
+
+/// compiles args on the server listening at socketPath. returns the exit code of the compilation, or nothing when no
+/// server is listening there.
+std::optional<int> compileOnServer(const std::string &socketPath, const std::vector<std::string> &args);
+
+/// hashes the root file and all of its transitive imports together with the compiler version and every option that
+/// affects the emitted objects. a profile that is used is hashed by its contents.
+std::string computeCacheKey(const std::string &srcFile, const TargetSelection &selection, OptLevel level,
+                            unsigned jobs, bool separateImports, bool streaming, bool fastMath,
+                            bool classArgsByReference, const ast::Instrumentation &instrumentation, EmitKind emit,
+                            LTOMode lto, const ProfileOptions &profile);
+
+/// copies cached objects for key into outputs, and the cached interface into interfaceFile unless it is empty. returns
+/// false on a cache miss.
+bool restoreFromCache(const std::string &cacheDir, const std::string &key, const std::vector<std::string> &outputs,
+                      const std::string &interfaceFile = "");
+
+/// stores the emitted outputs in the cache under key, along with the interface written to interfaceFile unless it is
+/// empty.
+void storeInCache(const std::string &cacheDir, const std::string &key, const std::vector<std::string> &outputs,
+                  const std::string &interfaceFile = "");
+
+} // namespace axen::driver
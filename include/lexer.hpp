@@ -1,8 +1,14 @@
 #pragma once
 
-#include <deque>
+#include <iterator>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "symbol.hpp"
 
 namespace axen::lexer {
 enum class TokenType {
@@ -51,14 +57,15 @@ enum class TokenType {
   EndOfFile,
 };
 
-inline const std::unordered_map<std::string, TokenType> keywordMap = {
+// the scanner builds its constexpr lookup tables from these lists
+inline constexpr std::pair<std::string_view, TokenType> keywordList[] = {
     {"return", TokenType::Return},   {"break", TokenType::Break},   {"continue", TokenType::Continue},
     {"if", TokenType::If},           {"else", TokenType::Else},     {"while", TokenType::While},
     {"ptr", TokenType::Ptr},         {"import", TokenType::Import}, {"class", TokenType::Class},
     {"typedef", TokenType::Typedef}, {"intdef", TokenType::Intdef},
 };
 
-inline const std::unordered_map<char, TokenType> symbolMap = {
+inline constexpr std::pair<char, TokenType> symbolList[] = {
     {'(', TokenType::LParen},    {')', TokenType::RParen},   {'{', TokenType::LBrace},   {'}', TokenType::RBrace},
     {'[', TokenType::LBracket},  {']', TokenType::RBracket}, {'.', TokenType::Period},   {',', TokenType::Comma},
     {'+', TokenType::Plus},      {'-', TokenType::Minus},    {'*', TokenType::Asterisk}, {'/', TokenType::Slash},
@@ -66,6 +73,11 @@ inline const std::unordered_map<char, TokenType> symbolMap = {
     {'&', TokenType::Ampersand}, {'$', TokenType::Dollar},   {'%', TokenType::Percent},
 };
 
+inline const std::unordered_map<std::string_view, TokenType> keywordMap(std::begin(keywordList),
+                                                                        std::end(keywordList));
+
+inline const std::unordered_map<char, TokenType> symbolMap(std::begin(symbolList), std::end(symbolList));
+
 inline const std::unordered_map<TokenType, std::string> tokenToKeyword = [] {
   std::unordered_map<TokenType, std::string> rev;
   for (const auto &[key, val] : keywordMap)
@@ -80,52 +92,91 @@ inline const std::unordered_map<TokenType, char> tokenToSymbol = [] {
   return rev;
 }();
 
+/// tokens point into the source buffer, the buffer must outlive every token lexed from it.
 struct Token {
   TokenType type;
-  std::string src;
+
+  // for string literals this is the raw text between the quotes, see unescape
+  std::string_view src;
+  int row;
+  int col;
+
+  // only set for identifiers
+  Symbol symbol = 0;
+};
+
+/// returns the contents of a string literal token with its escape sequences resolved.
+std::string unescape(std::string_view raw);
+
+/// a part of the source the lexer could not make a token of.
+struct LexError {
+  std::string message;
   int row;
   int col;
 };
 
 class Lexer {
 public:
-  explicit Lexer(std::string src);
+  /// identifiers are interned into symbols, which must outlive every token lexed from src.
+  Lexer(std::string_view src, SymbolTable &symbols);
 
-  [[nodiscard]] Token peek(unsigned int offset = 0);
+  /// the returned reference stays valid until the next call to peek or consume.
+  [[nodiscard]] const Token &peek(unsigned int offset = 0);
   [[nodiscard]] bool peekT(TokenType t, unsigned int offset = 0);
   Token consume();
 
+  // tokens are kept in one buffer, so a state is only a position in it and restoring it never lexes again
   struct LexerState {
-    size_t srcCursor;
-    std::deque<Token> lookAhead;
     size_t tokensCursor;
-    int row;
-    int col;
   };
 
-  LexerState saveState() const { return {srcCursor_, lookAhead_, tokensCursor_, row_, col_}; }
+  LexerState saveState() const { return {tokensCursor_}; }
+
+  void restoreState(const LexerState &state) { tokensCursor_ = state.tokensCursor; }
+
+  /// number of tokens lexed so far, the end of file token included.
+  size_t tokenCount() const { return tokens_.size(); }
+
+  /// lexes the rest of the source up front instead of on demand.
+  void lexAll();
+
+  /// lexes the rest of the source, then moves the symbols of every token over to symbols. files are lexed on other
+  /// threads against tables of their own, and moved over to the shared table one at a time in a fixed order.
+  void rebindSymbols(SymbolTable &symbols);
 
-  void restoreState(const LexerState &state) {
-    srcCursor_ = state.srcCursor;
-    lookAhead_ = state.lookAhead;
-    tokensCursor_ = state.tokensCursor;
-    row_ = state.row;
-    col_ = state.col;
-  }
+  /// the tokens end at the first error instead of exiting, files are lexed on threads that must not end the compiler.
+  /// the parser reports it once it gets to the file.
+  const std::optional<LexError> &error() const { return error_; }
 
 private:
   Token nextToken();
 
-  [[nodiscard]] char peekChar(unsigned int offset = 0) const;
-  char consumeChar();
+  /// records the error and moves the cursor to the end of the source, so the next token is the end of file.
+  Token fail(std::string message, int row, int col);
 
-  const std::string src_;
+  // scanning helpers, each one advances srcCursor_ past the run it matches
+  void skipWhitespace();
+  void skipLineComment();
+  void skipBlockComment();
+  void scanIdentifier();
+  void scanDigits(bool hex);
+
+  /// moves the cursor to end while keeping row_ and lineStart_ in sync with any newlines skipped over.
+  void advanceTo(size_t end);
+
+  const std::string_view src_;
   size_t srcCursor_ = 0;
 
-  std::deque<Token> lookAhead_;
+  SymbolTable *symbols_;
+
+  // filled on demand, tokens are never dropped so earlier positions can be restored
+  std::vector<Token> tokens_;
   size_t tokensCursor_ = 0;
 
+  // columns are derived from the offset of the current line so runs can be skipped without counting columns
   int row_ = 1;
-  int col_ = 1;
+  size_t lineStart_ = 0;
+
+  std::optional<LexError> error_;
 };
 } // namespace axen::lexer
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Type.h>
+#include <llvm/IR/Value.h>
+#include <llvm/Support/Alignment.h>
+
+namespace axen::ast {
+
+struct CodegenContext;
+class ExpressionNode;
+class TypeNode;
+
+/// how a parameter or the return value crosses a call under the c abi of the target. only classes are lowered,
+/// every other type is passed as its own llvm type.
+struct ABIArgInfo {
+  enum class Kind {
+    // passed as its own llvm type
+    Direct,
+
+    // the bytes of the class are passed in the coerced types, one register each. a class returned in two of them is
+    // returned as a literal struct of both
+    Coerce,
+
+    // passed as a pointer to a copy, byval when the copy is made by the backend. a class returned this way is written
+    // to an sret pointer the caller passes ahead of every argument
+    Indirect,
+
+    // passed as a pointer to the object of the caller, which the callee copies on entry
+    Reference,
+  };
+
+  Kind kind = Kind::Direct;
+
+  // the type of the parameter in axen, lowered
+  llvm::Type *type = nullptr;
+
+  // the registers a coerced class is passed in
+  llvm::SmallVector<llvm::Type *, 2> coerced;
+
+  bool byVal = false;
+
+  // signedness of the axen type, values converted to a direct parameter or return value follow it
+  bool isSigned = true;
+
+  // alignment of the pointer of an indirect or referenced class
+  uint64_t align = 1;
+
+  // the first llvm argument the parameter is passed in
+  unsigned argIndex = 0;
+};
+
+/// the lowered signature of a function.
+struct FunctionABI {
+  ABIArgInfo ret;
+  std::vector<ABIArgInfo> params;
+  llvm::FunctionType *type = nullptr;
+};
+
+/// classifies the return value and the parameters of a function for the target of the module, following the
+/// sysv x86-64, aapcs64 and win64 rules for class values and passing them in memory elsewhere. with
+/// ctx.classArgsByReference, classes a private function would take in memory are passed by reference instead.
+FunctionABI classifyFunction(CodegenContext &ctx, TypeNode *returnType, llvm::ArrayRef<TypeNode *> paramTypes,
+                             bool isPrivate);
+
+/// adds the sret, byval and alignment attributes the lowered signature relies on to function.
+void addABIAttributes(CodegenContext &ctx, const FunctionABI &abi, llvm::Function *function);
+
+/// returns the address of the class value of expr. variables are used in place and isTemporary is cleared, anything
+/// else is evaluated into a temporary.
+llvm::Value *emitClassAddress(CodegenContext &ctx, const ABIArgInfo &info, ExpressionNode *expr, bool &isTemporary);
+
+/// loads the coerced registers of the class at address, which is aligned to align.
+llvm::SmallVector<llvm::Value *, 2> loadCoerced(CodegenContext &ctx, const ABIArgInfo &info, llvm::Value *address,
+                                                llvm::Align align);
+
+/// stores the coerced registers of a class to dest, which holds the class.
+void storeCoerced(CodegenContext &ctx, const ABIArgInfo &info, llvm::ArrayRef<llvm::Value *> pieces, llvm::Value *dest,
+                  llvm::Align destAlign);
+
+/// copies the class at src to dest with a memcpy, large classes never become first class aggregates.
+void copyClass(CodegenContext &ctx, const ABIArgInfo &info, llvm::Value *dest, llvm::Align destAlign, llvm::Value *src,
+               llvm::Align srcAlign);
+
+} // namespace axen::ast
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+
+namespace axen::ast {
+
+/// owns every ast and type node of a compilation. nodes are bump allocated and the returned pointers stay valid until
+/// the arena is destroyed or reset, nothing is freed on its own. expressions, statements, functions and types keep
+/// their child lists and strings in the arena as well, so they are trivially destructible and teardown frees the slabs
+/// without visiting them. only classes, which grow as partial classes are merged, have destructors to run.
+class Arena {
+public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  ~Arena() { destroyNodes(); }
+
+  template <typename T, typename... Args> T *create(Args &&...args) {
+    T *node = new (allocator_.Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    nodeCount_++;
+
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      destructors_.emplace_back(node, [](void *ptr) { static_cast<T *>(ptr)->~T(); });
+
+    return node;
+  }
+
+  /// copies values into the arena, the copy lives as long as the nodes do.
+  template <typename T> llvm::ArrayRef<T> copyArray(const std::vector<T> &values) {
+    static_assert(std::is_trivially_destructible_v<T>, "arena arrays are never destroyed");
+    if (values.empty())
+      return {};
+
+    T *copy = allocator_.Allocate<T>(values.size());
+    std::uninitialized_copy(values.begin(), values.end(), copy);
+    return llvm::ArrayRef<T>(copy, values.size());
+  }
+
+  llvm::StringRef copyString(llvm::StringRef value) {
+    if (value.empty())
+      return {};
+
+    char *copy = allocator_.Allocate<char>(value.size());
+    std::uninitialized_copy(value.begin(), value.end(), copy);
+    return llvm::StringRef(copy, value.size());
+  }
+
+  size_t nodeCount() const { return nodeCount_; }
+
+  size_t bytesAllocated() const { return allocator_.getBytesAllocated(); }
+
+  /// destroys every node and keeps the first slab for the nodes created next.
+  void reset() {
+    destroyNodes();
+    destructors_.clear();
+    allocator_.Reset();
+    nodeCount_ = 0;
+  }
+
+private:
+  void destroyNodes() {
+    // destructors only release what the nodes own themselves (names, child lists), the nodes are freed with the slabs
+    for (auto it = destructors_.rbegin(); it != destructors_.rend(); ++it)
+      it->second(it->first);
+  }
+
+  llvm::BumpPtrAllocator allocator_;
+  size_t nodeCount_ = 0;
+  std::vector<std::pair<void *, void (*)(void *)>> destructors_;
+};
+
+} // namespace axen::ast
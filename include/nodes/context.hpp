@@ -1,46 +1,146 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
+#include <llvm/Support/Alignment.h>
 
 #include "error.hpp"
+#include "nodes/abi.hpp"
+#include "symbol.hpp"
 
 namespace axen::ast {
 
+class ClassNode;
+
+/// runtime hooks -finstrument adds to every function that is not noinstrument.
+struct Instrumentation {
+  // xray sleds, a few nops each until the xray runtime patches them into calls to its handlers
+  bool xray = false;
+
+  // functions with fewer machine instructions than this and no loops get no sleds
+  unsigned xrayThreshold = 200;
+
+  // calls to __cyg_profile_func_enter and __cyg_profile_func_exit, the hooks of gcc's -finstrument-functions
+  bool entryExit = false;
+
+  // a counter in the axen_calls section per function, incremented on every call
+  bool callCounts = false;
+};
+
 struct CodegenContext {
   llvm::LLVMContext llvmContext;
   llvm::IRBuilder<> builder;
   std::unique_ptr<llvm::Module> module;
 
+  // names in the ast are symbols of the parser's table
+  const SymbolTable &symbols;
+
   // each scope map element is a variable with its AllocaInst and allocated type
-  std::vector<std::map<std::string, llvm::AllocaInst *>> scopes;
-  std::map<std::string, std::pair<llvm::StructType *, std::vector<std::string>>> namedStructs;
+  std::vector<llvm::DenseMap<Symbol, llvm::AllocaInst *>> scopes;
+
+  // typedefs of a class share its declaration, so declarations map to struct types one to one
+  llvm::DenseMap<const ClassNode *, llvm::StructType *> namedStructs;
+
+  // byte alignment of class struct types, which align(N) may raise past what llvm derives for the struct
+  llvm::DenseMap<llvm::StructType *, uint64_t> structAlignments;
+
+  // string constants by content, every occurrence of a literal in the module shares one global
+  llvm::StringMap<llvm::GlobalVariable *> strings;
+
+  // prototypes of every function in the module by mangled name
+  llvm::DenseMap<Symbol, llvm::Function *> functions;
+
+  // how the parameters and return value of every function are passed, calls lower their arguments with it
+  llvm::DenseMap<llvm::Function *, FunctionABI> abis;
 
-  CodegenContext(const std::string &moduleName)
-      : builder(llvmContext), module(std::make_unique<llvm::Module>(moduleName, llvmContext)) {}
+  // classes a private function would take in memory are passed as a pointer to the object of the caller instead
+  bool classArgsByReference = false;
 
-  void declareStruct(std::string name, llvm::StructType *type, std::vector<std::string> names) {
-    namedStructs.emplace(name, std::make_pair(type, names));
+  Instrumentation instrumentation;
+
+  // written into every function so the optimizer sees the real isa
+  std::string targetCPU;
+  std::string targetFeatures;
+
+  CodegenContext(const std::string &moduleName, const SymbolTable &symbols)
+      : builder(llvmContext), module(std::make_unique<llvm::Module>(moduleName, llvmContext)), symbols(symbols) {}
+
+  void declareStruct(const ClassNode *decl, llvm::StructType *type) { namedStructs[decl] = type; }
+
+  /// returns the pooled constant holding value, created on first use. pooled strings are private unnamed_addr
+  /// constants, which the backend puts in mergeable sections so the linker also folds copies across objects.
+  llvm::GlobalVariable *getStringConstant(llvm::StringRef value) {
+    llvm::GlobalVariable *&global = strings[value];
+    if (!global)
+      global = builder.CreateGlobalString(value, ".str", 0, module.get());
+    return global;
   }
 
-  void pushScope() { scopes.push_back({}); }
+  void pushScope() { scopes.emplace_back(); }
 
   void popScope() {
     if (!scopes.empty())
       scopes.pop_back();
   }
 
-  void declareVariable(const std::string &name, llvm::AllocaInst *alloca) { scopes.back()[name] = alloca; }
+  /// creates an alloca at the top of the current function's entry block so mem2reg/sroa can promote it.
+  llvm::AllocaInst *createEntryAlloca(llvm::Type *type, const std::string &name) {
+    llvm::Function *function = builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock &entry = function->getEntryBlock();
+
+    // keep allocas grouped in declaration order ahead of all other entry instructions
+    auto insertPoint = entry.begin();
+    while (insertPoint != entry.end() && llvm::isa<llvm::AllocaInst>(*insertPoint))
+      ++insertPoint;
+
+    llvm::IRBuilder<> entryBuilder(&entry, insertPoint);
+    llvm::AllocaInst *alloca = entryBuilder.CreateAlloca(type, nullptr, name);
 
-  llvm::AllocaInst *lookupVariable(const std::string &name) {
+    uint64_t align = getAlignment(type);
+    if (align > alloca->getAlign().value())
+      alloca->setAlignment(llvm::Align(align));
+
+    return alloca;
+  }
+
+  /// alignment of type in bytes, honoring the layout attributes of classes.
+  uint64_t getAlignment(llvm::Type *type) {
+    while (auto *arrayType = llvm::dyn_cast<llvm::ArrayType>(type))
+      type = arrayType->getElementType();
+
+    if (auto *structType = llvm::dyn_cast<llvm::StructType>(type)) {
+      auto it = structAlignments.find(structType);
+      if (it != structAlignments.end())
+        return it->second;
+    }
+
+    return module->getDataLayout().getABITypeAlign(type).value();
+  }
+
+  /// alignment of a load or store of type through an lvalue known to be aligned to lvalueAlign. never more than the
+  /// abi alignment of type, so accesses outside packed classes keep their natural alignment.
+  llvm::Align getAccessAlignment(llvm::Type *type, llvm::MaybeAlign lvalueAlign) {
+    llvm::Align abiAlign = module->getDataLayout().getABITypeAlign(type);
+    return lvalueAlign ? std::min(abiAlign, *lvalueAlign) : abiAlign;
+  }
+
+  void declareVariable(Symbol name, llvm::AllocaInst *alloca) { scopes.back()[name] = alloca; }
+
+  llvm::AllocaInst *lookupVariable(Symbol name) {
     for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
       auto found = it->find(name);
       if (found != it->end()) {
@@ -53,8 +153,9 @@ struct CodegenContext {
   /// returns true if types are compatible, types may still need resizing.
   bool checkTypeCompatible(llvm::Type *t1, llvm::Type *t2) { return t1 == t2; }
 
-  /// converts value to target type if needed
-  llvm::Value *convertIfNeeded(llvm::Value *value, llvm::Type *targetType, bool isSigned) {
+  /// converts value to target type if needed. isSigned is the signedness of value, isTargetSigned the one of the
+  /// target type, which only floating point to integer conversions depend on.
+  llvm::Value *convertIfNeeded(llvm::Value *value, llvm::Type *targetType, bool isSigned, bool isTargetSigned = true) {
     if (!value || !targetType)
       return value;
 
@@ -63,21 +164,79 @@ struct CodegenContext {
     if (valueType == targetType)
       return value;
 
-    if (valueType->isIntegerTy() && targetType->isIntegerTy()) {
-      unsigned valueBits = valueType->getIntegerBitWidth();
-      unsigned targetBits = targetType->getIntegerBitWidth();
+    // a scalar in a vector context is converted to the element type and broadcast
+    if (auto *vectorType = llvm::dyn_cast<llvm::FixedVectorType>(targetType); vectorType && !valueType->isVectorTy()) {
+      llvm::Value *element = convertIfNeeded(value, vectorType->getElementType(), isSigned, isTargetSigned);
+      return builder.CreateVectorSplat(vectorType->getNumElements(), element, "splat");
+    }
+
+    // vectors convert lane by lane, but only between vectors of the same lane count
+    auto *valueVector = llvm::dyn_cast<llvm::FixedVectorType>(valueType);
+    auto *targetVector = llvm::dyn_cast<llvm::FixedVectorType>(targetType);
+    if ((valueVector || targetVector) &&
+        (!valueVector || !targetVector || valueVector->getNumElements() != targetVector->getNumElements()))
+      return value;
 
+    unsigned valueBits = valueType->getScalarSizeInBits();
+    unsigned targetBits = targetType->getScalarSizeInBits();
+
+    if (valueType->isIntOrIntVectorTy() && targetType->isIntOrIntVectorTy()) {
+      // an i1 is a truth value, it widens to 0 or 1 whatever the signedness of the comparison that produced it
       if (valueBits < targetBits) {
-        return isSigned ? builder.CreateSExt(value, targetType, "sext") : builder.CreateZExt(value, targetType, "zext");
+        return isSigned && valueBits > 1 ? builder.CreateSExt(value, targetType, "sext")
+                                         : builder.CreateZExt(value, targetType, "zext");
       } else if (valueBits > targetBits) {
         return builder.CreateTrunc(value, targetType, "trunc");
       }
     }
 
+    if (valueType->isFPOrFPVectorTy() && targetType->isFPOrFPVectorTy()) {
+      if (valueBits < targetBits)
+        return builder.CreateFPExt(value, targetType, "fpext");
+      return builder.CreateFPTrunc(value, targetType, "fptrunc");
+    }
+
+    if (valueType->isIntOrIntVectorTy() && targetType->isFPOrFPVectorTy()) {
+      return isSigned && valueBits > 1 ? builder.CreateSIToFP(value, targetType, "sitofp")
+                                       : builder.CreateUIToFP(value, targetType, "uitofp");
+    }
+
+    if (valueType->isFPOrFPVectorTy() && targetType->isIntOrIntVectorTy()) {
+      return isTargetSigned ? builder.CreateFPToSI(value, targetType, "fptosi")
+                            : builder.CreateFPToUI(value, targetType, "fptoui");
+    }
+
     return value;
   }
 
-  bool existsInCurrentScope(const std::string &name) { return scopes.back().find(name) != scopes.back().end(); }
+  /// type both operands of an arithmetic operation are converted to. vectors win over scalars and floating point over
+  /// integers, otherwise the wider type wins, like the usual arithmetic conversions of c. two vectors follow the same
+  /// rules lane by lane and need the same lane count.
+  llvm::Type *getCommonType(llvm::Type *t1, llvm::Type *t2) {
+    if (t1 == t2)
+      return t1;
+
+    // scalars are broadcast to the vector operand
+    if (t1->isVectorTy() != t2->isVectorTy())
+      return t1->isVectorTy() ? t1 : t2;
+
+    auto *v1 = llvm::dyn_cast<llvm::FixedVectorType>(t1);
+    auto *v2 = llvm::dyn_cast<llvm::FixedVectorType>(t2);
+    if (v1 && v2 && v1->getNumElements() != v2->getNumElements()) {
+      error::reportError(error::ErrorType::Codegen, "Vector operands have " + std::to_string(v1->getNumElements()) +
+                                                        " and " + std::to_string(v2->getNumElements()) + " lanes");
+    }
+
+    if (t1->isFPOrFPVectorTy() != t2->isFPOrFPVectorTy())
+      return t1->isFPOrFPVectorTy() ? t1 : t2;
+
+    if (t1->isFPOrFPVectorTy() || (t1->isIntOrIntVectorTy() && t2->isIntOrIntVectorTy()))
+      return t1->getScalarSizeInBits() >= t2->getScalarSizeInBits() ? t1 : t2;
+
+    return t1;
+  }
+
+  bool existsInCurrentScope(Symbol name) { return scopes.back().count(name); }
 };
 
 } // namespace axen::ast
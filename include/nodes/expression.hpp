@@ -1,155 +1,280 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <memory>
 #include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/Alignment.h>
 
 #include "context.hpp"
 #include "nodes/types.hpp"
+#include "symbol.hpp"
 
 namespace axen::ast {
 
+/// kind tags for llvm style isa/dyn_cast on expression nodes.
+enum class ExpressionKind {
+  VariableReference,
+  StructAccess,
+  ArrayAccess,
+  PtrIndexAccess,
+  LaneAccess,
+  Dref,
+  AddressOf,
+  IntLiteral,
+  FloatLiteral,
+  StringLiteral,
+  FunctionCall,
+  BuiltinCall,
+  BinaryOperation,
+};
+
 class ExpressionNode {
 public:
-  ExpressionNode(bool isSigned) : isSigned_(isSigned) {}
-  virtual ~ExpressionNode() = default;
+  ExpressionNode(ExpressionKind kind, bool isSigned) : kind_(kind), isSigned_(isSigned) {}
   virtual llvm::Value *codeGen(CodegenContext &ctx) = 0;
   virtual llvm::Value *codeGenLValue(CodegenContext &ctx) {
     fprintf(stderr, "Lvalue codegen not supported on this expression.");
     exit(EXIT_FAILURE);
   }
+  /// alignment known for the lvalue, empty when nothing is known beyond the abi alignment of its type.
+  virtual llvm::MaybeAlign getLValueAlignment(CodegenContext &ctx) { return llvm::MaybeAlign(); }
+  /// generates the value converted to type, whose signedness is isTargetSigned. literals are created in type
+  /// directly, so they take the type of the context they appear in.
+  virtual llvm::Value *codeGenAs(CodegenContext &ctx, llvm::Type *type, bool isTargetSigned) {
+    return ctx.convertIfNeeded(codeGen(ctx), type, isSigned(), isTargetSigned);
+  }
   virtual bool isSigned() { return isSigned_; }
 
+  ExpressionKind getKind() const { return kind_; }
+
+private:
+  const ExpressionKind kind_;
+
 protected:
+  // nodes are never destroyed on their own, the arena frees them with its slabs
+  ~ExpressionNode() = default;
+
   bool isSigned_;
 };
 
 class VariableReference : public ExpressionNode {
 public:
-  VariableReference(std::string name, bool isSigned) : name_(name), ExpressionNode(isSigned) {}
+  VariableReference(Symbol name, bool isSigned)
+      : name_(name), ExpressionNode(ExpressionKind::VariableReference, isSigned) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::VariableReference; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
   llvm::Value *codeGenLValue(CodegenContext &ctx) override;
 
 private:
-  std::string name_;
+  Symbol name_;
 };
 
 class StructAccess : public ExpressionNode {
 public:
-  StructAccess(std::unique_ptr<ExpressionNode> &&structExpr, std::string memberName, std::string structName,
-               bool isSigned, std::shared_ptr<ClassReferenceNode> &type)
-      : structExpr_(std::move(structExpr)), memberName_(std::move(memberName)), structName_(std::move(structName)),
-        ExpressionNode(isSigned), type_(type) {}
+  StructAccess(ExpressionNode *structExpr, Symbol memberName, bool isSigned, ClassReferenceNode *type)
+      : structExpr_(structExpr), memberName_(memberName), ExpressionNode(ExpressionKind::StructAccess, isSigned),
+        type_(type) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::StructAccess; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
   llvm::Value *codeGenLValue(CodegenContext &ctx) override;
+  llvm::MaybeAlign getLValueAlignment(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> structExpr_;
-  std::string memberName_;
-  std::string structName_;
-  std::shared_ptr<ClassReferenceNode> type_;
+  ExpressionNode *structExpr_;
+  Symbol memberName_;
+  ClassReferenceNode *type_;
 };
 
 class ArrayAccess : public ExpressionNode {
 public:
-  ArrayAccess(std::unique_ptr<ExpressionNode> &&arrayExpr, std::unique_ptr<ExpressionNode> &&indexExpr, bool isSigned,
-              std::shared_ptr<ArrayTypeNode> &type)
-      : arrayExpr_(std::move(arrayExpr)), indexExpr_(std::move(indexExpr)), ExpressionNode(isSigned), type_(type) {}
+  ArrayAccess(ExpressionNode *arrayExpr, ExpressionNode *indexExpr, bool isSigned, ArrayTypeNode *type)
+      : arrayExpr_(arrayExpr), indexExpr_(indexExpr), ExpressionNode(ExpressionKind::ArrayAccess, isSigned),
+        type_(type) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::ArrayAccess; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
   llvm::Value *codeGenLValue(CodegenContext &ctx) override;
+  llvm::MaybeAlign getLValueAlignment(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> arrayExpr_;
-  std::unique_ptr<ExpressionNode> indexExpr_;
-  std::shared_ptr<ArrayTypeNode> type_;
+  ExpressionNode *arrayExpr_;
+  ExpressionNode *indexExpr_;
+  ArrayTypeNode *type_;
+};
+
+/// a lane of a vector, read with extractelement.
+class LaneAccess : public ExpressionNode {
+public:
+  LaneAccess(ExpressionNode *vectorExpr, ExpressionNode *indexExpr, bool isSigned, VectorTypeNode *type)
+      : vectorExpr_(vectorExpr), indexExpr_(indexExpr), ExpressionNode(ExpressionKind::LaneAccess, isSigned),
+        type_(type) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::LaneAccess; }
+
+  llvm::Value *codeGen(CodegenContext &ctx) override;
+  llvm::Value *codeGenLValue(CodegenContext &ctx) override;
+
+private:
+  ExpressionNode *vectorExpr_;
+  ExpressionNode *indexExpr_;
+  VectorTypeNode *type_;
 };
 
 class PtrIndexAccess : public ExpressionNode {
 public:
-  PtrIndexAccess(std::unique_ptr<ExpressionNode> &&ptrExpr, std::unique_ptr<ExpressionNode> &&indexExpr, bool isSigned,
-                 std::shared_ptr<PointerTypeNode> &type)
-      : ptrExpr_(std::move(ptrExpr)), indexExpr_(std::move(indexExpr)), ExpressionNode(isSigned), type_(type) {}
+  PtrIndexAccess(ExpressionNode *ptrExpr, ExpressionNode *indexExpr, bool isSigned, PointerTypeNode *type)
+      : ptrExpr_(ptrExpr), indexExpr_(indexExpr), ExpressionNode(ExpressionKind::PtrIndexAccess, isSigned),
+        type_(type) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::PtrIndexAccess; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
   llvm::Value *codeGenLValue(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> ptrExpr_;
-  std::unique_ptr<ExpressionNode> indexExpr_;
-  std::shared_ptr<PointerTypeNode> type_;
+  ExpressionNode *ptrExpr_;
+  ExpressionNode *indexExpr_;
+  PointerTypeNode *type_;
 };
 
 class Dref : public ExpressionNode {
 public:
-  Dref(std::unique_ptr<ExpressionNode> &&target, std::shared_ptr<TypeNode> &derivedType, bool isSigned)
-      : target_(std::move(target)), derivedType_(derivedType), ExpressionNode(isSigned) {}
+  Dref(ExpressionNode *target, TypeNode *derivedType, bool isSigned)
+      : target_(target), derivedType_(derivedType), ExpressionNode(ExpressionKind::Dref, isSigned) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::Dref; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
   llvm::Value *codeGenLValue(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> target_;
-  std::shared_ptr<TypeNode> derivedType_;
+  ExpressionNode *target_;
+  TypeNode *derivedType_;
 };
 
 class AddressOf : public ExpressionNode {
 public:
-  AddressOf(std::unique_ptr<ExpressionNode> &&target, bool isSigned)
-      : target_(std::move(target)), ExpressionNode(isSigned) {}
+  AddressOf(ExpressionNode *target, bool isSigned)
+      : target_(target), ExpressionNode(ExpressionKind::AddressOf, isSigned) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::AddressOf; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> target_;
+  ExpressionNode *target_;
 };
 
+/// held in 64 bits and created in the type of its context, truncated when that is narrower. an unsigned literal is
+/// one above the range of a long.
 class IntLiteral : public ExpressionNode {
 public:
-  IntLiteral(int value) : value_(value), ExpressionNode(true) {}
+  IntLiteral(int64_t value, bool isSigned = true)
+      : value_(value), ExpressionNode(ExpressionKind::IntLiteral, isSigned) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::IntLiteral; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
+  llvm::Value *codeGenAs(CodegenContext &ctx, llvm::Type *type, bool isTargetSigned) override;
+
+  int64_t getValue() const { return value_; }
 
 private:
-  int value_;
+  int64_t value_;
 };
 
+/// held in double precision so a literal in a double context keeps all its digits, it is a float everywhere else.
 class FloatLiteral : public ExpressionNode {
 public:
-  FloatLiteral(float value) : value_(value), ExpressionNode(true) {}
+  FloatLiteral(double value) : value_(value), ExpressionNode(ExpressionKind::FloatLiteral, true) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::FloatLiteral; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
+  llvm::Value *codeGenAs(CodegenContext &ctx, llvm::Type *type, bool isTargetSigned) override;
 
 private:
-  float value_;
+  double value_;
 };
 
 class StringLiteral : public ExpressionNode {
 public:
-  StringLiteral(std::string value) : value_(value), ExpressionNode(false) {}
+  StringLiteral(llvm::StringRef value) : value_(value), ExpressionNode(ExpressionKind::StringLiteral, false) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::StringLiteral; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
 
 private:
-  std::string value_;
+  llvm::StringRef value_;
 };
 
 class FunctionCall : public ExpressionNode {
 public:
-  FunctionCall(std::string name, std::vector<std::unique_ptr<ExpressionNode>> &&args, bool isSigned)
-      : name_(std::move(name)), args_(std::move(args)), ExpressionNode(isSigned) {}
+  FunctionCall(Symbol name, llvm::ArrayRef<ExpressionNode *> args, bool isSigned)
+      : name_(name), args_(args), ExpressionNode(ExpressionKind::FunctionCall, isSigned) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::FunctionCall; }
+
+  llvm::Value *codeGen(CodegenContext &ctx) override;
+
+private:
+  Symbol name_;
+  llvm::ArrayRef<ExpressionNode *> args_;
+};
+
+/// vector builtins, called like functions. a function declared with the same name takes precedence.
+///   splat(value, lanes)      broadcasts value into every lane
+///   shuffle(a, b, lane...)   constant lane indices select from a followed by b
+///   reduceadd(v) ...         reduceadd/mul/min/max/and/or/xor map to llvm.vector.reduce.*
+///   load(p), loadu(p)        the vector type comes from the context, load assumes p is aligned to it and loadu
+///                            only to the element type
+///   store(p, v), storeu(p, v)
+enum class Builtin {
+  Splat,
+  Shuffle,
+  ReduceAdd,
+  ReduceMul,
+  ReduceMin,
+  ReduceMax,
+  ReduceAnd,
+  ReduceOr,
+  ReduceXor,
+  Load,
+  LoadUnaligned,
+  Store,
+  StoreUnaligned,
+};
+
+class BuiltinCall : public ExpressionNode {
+public:
+  BuiltinCall(Builtin builtin, llvm::ArrayRef<ExpressionNode *> args, llvm::ArrayRef<int> constants, bool isSigned)
+      : builtin_(builtin), args_(args), constants_(constants), ExpressionNode(ExpressionKind::BuiltinCall, isSigned) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::BuiltinCall; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
+  llvm::Value *codeGenAs(CodegenContext &ctx, llvm::Type *type, bool isTargetSigned) override;
 
 private:
-  std::string name_;
-  std::vector<std::unique_ptr<ExpressionNode>> args_;
+  Builtin builtin_;
+  llvm::ArrayRef<ExpressionNode *> args_;
+
+  // operands that have to be known at compile time, the lanes of a splat or the mask of a shuffle
+  llvm::ArrayRef<int> constants_;
 };
 
 enum class BinaryOperationType {
@@ -157,6 +282,7 @@ enum class BinaryOperationType {
   Subtract,
   Multiply,
   Divide,
+  Remainder,
   Less,
   More,
   Equal,
@@ -164,16 +290,25 @@ enum class BinaryOperationType {
 
 class BinaryOperation : public ExpressionNode {
 public:
-  BinaryOperation(BinaryOperationType opType, std::unique_ptr<ExpressionNode> &&L, std::unique_ptr<ExpressionNode> &&R,
-                  bool isSigned)
-      : type_(opType), L_(std::move(L)), R_(std::move(R)), ExpressionNode(isSigned) {}
+  BinaryOperation(BinaryOperationType opType, ExpressionNode *L, ExpressionNode *R, bool isSigned)
+      : type_(opType), L_(L), R_(R), ExpressionNode(ExpressionKind::BinaryOperation, isSigned) {}
+
+  static bool classof(const ExpressionNode *expr) { return expr->getKind() == ExpressionKind::BinaryOperation; }
 
   llvm::Value *codeGen(CodegenContext &ctx) override;
 
+  BinaryOperationType getOperation() const { return type_; }
+  ExpressionNode *getLHS() const { return L_; }
+  ExpressionNode *getRHS() const { return R_; }
+
 private:
   BinaryOperationType type_;
-  std::unique_ptr<ExpressionNode> L_;
-  std::unique_ptr<ExpressionNode> R_;
+  ExpressionNode *L_;
+  ExpressionNode *R_;
 };
 
+// the arena frees expressions without destroying them
+static_assert(std::is_trivially_destructible_v<FunctionCall> && std::is_trivially_destructible_v<BuiltinCall> &&
+              std::is_trivially_destructible_v<StringLiteral> && std::is_trivially_destructible_v<StructAccess>);
+
 } // namespace axen::ast
@@ -1,10 +1,12 @@
 #pragma once
 
-#include <memory>
+#include <optional>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/CFG.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
@@ -19,31 +21,87 @@
 #include "nodes/context.hpp"
 #include "nodes/statement.hpp"
 #include "nodes/types.hpp"
+#include "symbol.hpp"
 
 namespace axen::ast {
 
+struct Parameter {
+  Symbol name;
+  TypeNode *type;
+
+  // a restrict pointer is the only way its function reaches the memory behind it, so it is lowered to noalias
+  bool isRestrict = false;
+};
+
+/// annotations written ahead of the return type of a function.
+struct FunctionAttributes {
+  // private functions get internal linkage and are left out of the interface
+  bool isPrivate = false;
+
+  bool inlineHint = false;
+  bool noInline = false;
+  bool hot = false;
+  bool cold = false;
+
+  // pure functions only read memory, const functions do not access memory at all
+  bool pure = false;
+  bool isConst = false;
+
+  bool noReturn = false;
+
+  // left out of -finstrument, for functions too hot to trace and for the ones the hooks call themselves
+  bool noInstrument = false;
+};
+
 class FunctionNode {
 public:
-  FunctionNode(std::string name, std::shared_ptr<TypeNode> &&type, bool isPublic,
-               std::optional<std::vector<std::pair<std::string, std::shared_ptr<TypeNode>>>> &&params,
-               std::optional<std::vector<std::unique_ptr<StatementNode>>> &&body, bool isDetached)
-      : name_(std::move(name)), type_(type), params_(params), body_(std::move(body)), isPublic_(isPublic),
-        isDetached_(isDetached) {}
+  FunctionNode(Symbol name, TypeNode *type, FunctionAttributes attributes, llvm::ArrayRef<Parameter> params,
+               std::optional<llvm::ArrayRef<StatementNode *>> body, bool isDetached)
+      : name_(name), type_(type), params_(params), body_(body), attributes_(attributes), isDetached_(isDetached) {}
+
+  /// creates the prototype of the function. every prototype is declared before any body is generated, so calls do
+  /// not depend on the order functions are generated in.
+  llvm::Function *declare(CodegenContext &ctx);
 
+  /// generates the body of the function, declaring its prototype first if that has not happened yet.
   llvm::Function *codeGen(CodegenContext &ctx);
   void generateFunctionBody(CodegenContext &ctx, llvm::Function *function);
 
-  std::string getName() { return name_; }
+  /// marks the functions of the module that provably return with willreturn, run once every body is generated.
+  static void inferAttributes(CodegenContext &ctx);
 
-  std::shared_ptr<TypeNode> getReturnType() { return type_; }
+  /// the mangled name, member functions are prefixed with their class.
+  Symbol getName() const { return name_; }
+
+  TypeNode *getReturnType() { return type_; }
+
+  llvm::ArrayRef<Parameter> getParams() const { return params_; }
+
+  bool isDetached() const { return isDetached_; }
+
+  bool isPublic() const { return !attributes_.isPrivate; }
+
+  const FunctionAttributes &getAttributes() const { return attributes_; }
+
+  /// a function is defined once its body is known, even while the body itself is still waiting to be parsed.
+  bool isDefined() const { return body_.has_value(); }
+
+  void setBody(llvm::ArrayRef<StatementNode *> body) { body_ = body; }
+
+  /// drops the statements of a body that was generated and released along with its arena. the function stays
+  /// defined.
+  void releaseBody() { body_ = llvm::ArrayRef<StatementNode *>(); }
 
 private:
-  std::string name_;
-  std::shared_ptr<TypeNode> type_;
-  bool isPublic_;
-  std::optional<std::vector<std::pair<std::string, std::shared_ptr<TypeNode>>>> params_;
-  std::optional<std::vector<std::unique_ptr<StatementNode>>> body_;
+  Symbol name_;
+  TypeNode *type_;
+  llvm::ArrayRef<Parameter> params_;
+  std::optional<llvm::ArrayRef<StatementNode *>> body_;
+  FunctionAttributes attributes_;
   bool isDetached_;
 };
 
+// the arena frees functions without destroying them
+static_assert(std::is_trivially_destructible_v<FunctionNode>);
+
 } // namespace axen::ast
@@ -1,88 +1,109 @@
 #pragma once
 
-#include <memory>
+#include <optional>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
 
 #include "nodes/context.hpp"
 #include "nodes/expression.hpp"
 #include "nodes/types.hpp"
+#include "symbol.hpp"
 
 namespace axen::ast {
 class StatementNode {
 public:
-  virtual ~StatementNode() = default;
   virtual void codeGen(CodegenContext &ctx) = 0;
+
+protected:
+  // nodes are never destroyed on their own, the arena frees them with its slabs
+  ~StatementNode() = default;
 };
 
 class VariableDeclaration : public StatementNode {
 public:
-  VariableDeclaration(std::shared_ptr<TypeNode> &type, std::string name, std::unique_ptr<ExpressionNode> &&initialValue)
-      : type_(type), name_(std::move(name)), initialValue_(std::move(initialValue)) {};
+  VariableDeclaration(TypeNode *type, Symbol name, ExpressionNode *initialValue)
+      : type_(type), name_(name), initialValue_(initialValue) {};
   void codeGen(CodegenContext &ctx) override;
 
 private:
-  std::shared_ptr<TypeNode> type_;
-  std::string name_;
-  std::unique_ptr<ExpressionNode> initialValue_;
+  TypeNode *type_;
+  Symbol name_;
+  ExpressionNode *initialValue_;
 };
 
 class AssignmentStatement : public StatementNode {
 public:
-  AssignmentStatement(std::unique_ptr<ExpressionNode> &&target, std::unique_ptr<ExpressionNode> &&value)
-      : target_(std::move(target)), value_(std::move(value)) {}
+  AssignmentStatement(ExpressionNode *target, ExpressionNode *value) : target_(target), value_(value) {}
 
   void codeGen(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> target_;
-  std::unique_ptr<ExpressionNode> value_;
+  ExpressionNode *target_;
+  ExpressionNode *value_;
 };
 
 class Return : public StatementNode {
 public:
-  Return(std::unique_ptr<ExpressionNode> &&value) : value_(std::move(value)) {}
+  Return(ExpressionNode *value) : value_(value) {}
   void codeGen(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> value_;
+  ExpressionNode *value_;
 };
 
 class If : public StatementNode {
 public:
-  If(std::unique_ptr<ExpressionNode> &&condition, std::vector<std::unique_ptr<StatementNode>> &&trueBody,
-     std::optional<std::vector<std::unique_ptr<StatementNode>>> &&falseBody)
-      : condition_(std::move(condition)), trueBody_(std::move(trueBody)), falseBody_(std::move(falseBody)) {}
+  If(ExpressionNode *condition, llvm::ArrayRef<StatementNode *> trueBody,
+     std::optional<llvm::ArrayRef<StatementNode *>> falseBody)
+      : condition_(condition), trueBody_(trueBody), falseBody_(falseBody) {}
   void codeGen(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> condition_;
-  std::vector<std::unique_ptr<StatementNode>> trueBody_;
-  std::optional<std::vector<std::unique_ptr<StatementNode>>> falseBody_;
+  ExpressionNode *condition_;
+  llvm::ArrayRef<StatementNode *> trueBody_;
+  std::optional<llvm::ArrayRef<StatementNode *>> falseBody_;
+};
+
+/// optimizer hints written between the condition of a while and its body, lowered to llvm.loop metadata.
+struct LoopHints {
+  // unroll count, zero leaves the choice to the unroller
+  int unroll = 0;
+  bool noUnroll = false;
+
+  // vectorization width, one disables vectorization and zero leaves the choice to the vectorizer
+  int vectorize = 0;
+
+  bool empty() const { return unroll == 0 && !noUnroll && vectorize == 0; }
 };
 
 class While : public StatementNode {
 public:
-  While(std::unique_ptr<ExpressionNode> &&condition, std::vector<std::unique_ptr<StatementNode>> &&body)
-      : condition_(std::move(condition)), body_(std::move(body)) {}
+  While(ExpressionNode *condition, llvm::ArrayRef<StatementNode *> body, LoopHints hints = {})
+      : condition_(condition), body_(body), hints_(hints) {}
   void codeGen(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> condition_;
-  std::vector<std::unique_ptr<StatementNode>> body_;
+  ExpressionNode *condition_;
+  llvm::ArrayRef<StatementNode *> body_;
+  LoopHints hints_;
 };
 
 class ExpressionStatement : public StatementNode {
 public:
-  ExpressionStatement(std::unique_ptr<ExpressionNode> &&expression) : expression_(std::move(expression)) {}
+  ExpressionStatement(ExpressionNode *expression) : expression_(expression) {}
   void codeGen(CodegenContext &ctx) override;
 
 private:
-  std::unique_ptr<ExpressionNode> expression_;
+  ExpressionNode *expression_;
 };
 
+// the arena frees statements without destroying them
+static_assert(std::is_trivially_destructible_v<If> && std::is_trivially_destructible_v<While>);
+
 } // namespace axen::ast
@@ -1,54 +1,122 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/Type.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include "context.hpp"
 #include "error.hpp"
+#include "nodes/arena.hpp"
 
 namespace axen::ast {
 
+/// kind tags for llvm style isa/dyn_cast on type nodes.
+enum class TypeKind {
+  Primitive,
+  Pointer,
+  Array,
+  Vector,
+  ClassReference,
+};
+
+/// type nodes are canonical, see TypeTable. structurally equal types are the same node, so types compare by pointer.
 class TypeNode {
 public:
-  virtual ~TypeNode() = default;
-  virtual llvm::Type *codeGen(CodegenContext &ctx) = 0;
+  TypeNode(TypeKind kind) : kind_(kind) {}
+
+  /// lowers the type once per llvm context, every later call is a pointer load.
+  llvm::Type *codeGen(CodegenContext &ctx) {
+    if (lowered_ && loweredContext_ == &ctx.llvmContext)
+      return lowered_;
+
+    loweredContext_ = &ctx.llvmContext;
+    return lowered_ = lower(ctx);
+  }
 
   virtual bool isSigned() = 0;
+
+  TypeKind getKind() const { return kind_; }
+
+protected:
+  // nodes are never destroyed on their own, the arena frees them with its slabs
+  ~TypeNode() = default;
+
+  virtual llvm::Type *lower(CodegenContext &ctx) = 0;
+
+private:
+  const TypeKind kind_;
+
+  llvm::Type *lowered_ = nullptr;
+  const llvm::LLVMContext *loweredContext_ = nullptr;
 };
 
 class PointerTypeNode : public TypeNode {
 public:
-  PointerTypeNode(std::shared_ptr<TypeNode> &target) : target_(target) {}
+  PointerTypeNode(TypeNode *target) : TypeNode(TypeKind::Pointer), target_(target) {}
 
-  llvm::Type *codeGen(CodegenContext &ctx) override;
+  static bool classof(const TypeNode *type) { return type->getKind() == TypeKind::Pointer; }
 
-  std::shared_ptr<TypeNode> target() const { return target_; }
+  TypeNode *target() const { return target_; }
 
   bool isSigned() override { return target_->isSigned(); }
 
+protected:
+  llvm::Type *lower(CodegenContext &ctx) override;
+
 private:
-  std::shared_ptr<TypeNode> target_;
+  TypeNode *target_;
 };
 
 class ArrayTypeNode : public TypeNode {
 public:
-  ArrayTypeNode(std::shared_ptr<TypeNode> &target, int length) : target_(target), length_(length) {}
+  ArrayTypeNode(TypeNode *target, int length) : TypeNode(TypeKind::Array), target_(target), length_(length) {}
+
+  static bool classof(const TypeNode *type) { return type->getKind() == TypeKind::Array; }
 
-  llvm::Type *codeGen(CodegenContext &ctx) override;
+  TypeNode *target() const { return target_; }
 
-  std::shared_ptr<TypeNode> target() const { return target_; }
+  int length() const { return length_; }
 
   bool isSigned() override { return target_->isSigned(); }
 
+protected:
+  llvm::Type *lower(CodegenContext &ctx) override;
+
 private:
-  std::shared_ptr<TypeNode> target_;
+  TypeNode *target_;
   int length_;
 };
 
+/// fixed width simd vector of an integer or floating point type, written as the element type followed by x<lanes>.
+class VectorTypeNode : public TypeNode {
+public:
+  VectorTypeNode(TypeNode *target, int lanes) : TypeNode(TypeKind::Vector), target_(target), lanes_(lanes) {}
+
+  static bool classof(const TypeNode *type) { return type->getKind() == TypeKind::Vector; }
+
+  TypeNode *target() const { return target_; }
+
+  int lanes() const { return lanes_; }
+
+  bool isSigned() override { return target_->isSigned(); }
+
+protected:
+  llvm::Type *lower(CodegenContext &ctx) override;
+
+private:
+  TypeNode *target_;
+  int lanes_;
+};
+
 enum class PrimitiveType {
   Void,
   Bool,
@@ -68,12 +136,18 @@ enum class PrimitiveType {
 
 class PrimitiveTypeNode : public TypeNode {
 public:
-  PrimitiveTypeNode(PrimitiveType type, bool isSigned) : type_(type), isSigned_(isSigned) {}
+  PrimitiveTypeNode(PrimitiveType type, bool isSigned)
+      : TypeNode(TypeKind::Primitive), type_(type), isSigned_(isSigned) {}
 
-  llvm::Type *codeGen(CodegenContext &ctx) override;
+  static bool classof(const TypeNode *type) { return type->getKind() == TypeKind::Primitive; }
+
+  PrimitiveType type() const { return type_; }
 
   bool isSigned() override { return isSigned_; }
 
+protected:
+  llvm::Type *lower(CodegenContext &ctx) override;
+
 private:
   PrimitiveType type_;
 
@@ -81,75 +155,187 @@ private:
   bool isSigned_;
 };
 
-class ClassNode {
-public:
-  ClassNode(std::string name, std::map<std::string, std::shared_ptr<TypeNode>> &&members)
-      : name_(name), members_(std::move(members)) {}
+/// layout attributes written between a class name and its body, partial classes merge theirs.
+struct ClassAttributes {
+  // sort members by decreasing alignment instead of keeping declaration order, which removes most padding
+  bool reorder = false;
+
+  // no padding between members, the class gets an alignment of one unless align is also given
+  bool packed = false;
+
+  // minimum alignment in bytes, zero keeps the natural alignment
+  unsigned align = 0;
+
+  // not a layout attribute, the methods declared in this body of the class are left out of -finstrument. partial
+  // classes do not merge it
+  bool noInstrument = false;
+};
 
-  llvm::StructType *codeGen(CodegenContext &ctx) {
-    // TODO: move this to a source file lol
+struct ClassMember {
+  Symbol name;
+  TypeNode *type;
+};
 
-    auto it = ctx.namedStructs.find(name_);
-    if (it != ctx.namedStructs.end())
-      return it->second.first;
+/// member placement of a class, computed against the module's data layout when the class is lowered.
+struct ClassLayout {
+  struct Field {
+    // index into the members in declaration order
+    unsigned member;
+    uint64_t offset;
+    uint64_t size;
+  };
 
-    llvm::StructType *llvmStruct = llvm::StructType::create(ctx.llvmContext, name_);
+  // fields in memory order
+  std::vector<Field> fields;
 
-    std::vector<std::string> memberNames;
-    for (const auto &pair : members_)
-      memberNames.push_back(pair.first);
+  // llvm struct element and byte offset of each member in declaration order, padding elements shift the element
+  // indices off the member indices
+  std::vector<unsigned> elements;
+  std::vector<uint64_t> offsets;
 
-    ctx.declareStruct(name_, llvmStruct, memberNames);
+  // [offset, size] of every padding hole, tail padding included
+  std::vector<std::pair<uint64_t, uint64_t>> holes;
 
-    std::vector<llvm::Type *> llvmMembers;
-    for (const auto &pair : members_)
-      llvmMembers.push_back(pair.second->codeGen(ctx));
+  uint64_t size = 0;
+  uint64_t align = 1;
+};
 
-    llvmStruct->setBody(llvmMembers);
+class ClassNode {
+public:
+  ClassNode(std::string name, std::vector<ClassMember> &&members, ClassAttributes attributes = {})
+      : name_(std::move(name)), attributes_(attributes) {
+    addMembers(members);
+  }
 
-    return llvmStruct;
+  /// lays out the members and creates the struct type, once per module.
+  llvm::StructType *codeGen(CodegenContext &ctx);
+
+  /// writes size, alignment and the offset of every member and padding hole.
+  void printLayout(CodegenContext &ctx, llvm::raw_ostream &os);
+
+  TypeNode *lookupMemberType(Symbol name) const {
+    auto it = memberIndices_.find(name);
+    return it != memberIndices_.end() ? members_[it->second].type : nullptr;
   }
 
-  std::shared_ptr<ast::TypeNode> lookupMemberType(const std::string &name) const {
-    auto it = members_.find(name);
-    return it != members_.end() ? it->second : nullptr;
+  /// struct element index of a member, or -1 if there is none. only valid once the class has been lowered.
+  int lookupMemberIndex(Symbol name) const {
+    auto it = memberIndices_.find(name);
+    return it != memberIndices_.end() ? layout_.elements[it->second] : -1;
   }
 
-  int lookupMemberIndex(const std::string &name) const {
-    auto it = members_.find(name);
-    if (it != members_.end()) {
-      return std::distance(members_.begin(), it);
-    }
-    error::reportError(error::ErrorType::Internal,
-                       "Could not find index of member '" + name + "' in struct '" + name_ + "'");
-    return -1; // unreachable
+  /// byte offset of a member, only valid once the class has been lowered.
+  uint64_t lookupMemberOffset(Symbol name) const {
+    auto it = memberIndices_.find(name);
+    return it != memberIndices_.end() ? layout_.offsets[it->second] : 0;
   }
 
   const std::string &getName() const { return name_; }
 
-  void addMembers(const std::map<std::string, std::shared_ptr<TypeNode>> &newMembers) {
-    members_.insert(newMembers.begin(), newMembers.end());
+  /// members in declaration order.
+  const std::vector<ClassMember> &getMembers() const { return members_; }
+
+  const ClassAttributes &getAttributes() const { return attributes_; }
+
+  const ClassLayout &getLayout() const { return layout_; }
+
+  /// appends members of a partial class in declaration order, a name that is already a member keeps its first type.
+  void addMembers(const std::vector<ClassMember> &newMembers) {
+    for (const auto &member : newMembers) {
+      if (memberIndices_.try_emplace(member.name, members_.size()).second)
+        members_.push_back(member);
+    }
+  }
+
+  void addAttributes(const ClassAttributes &attributes) {
+    attributes_.reorder |= attributes.reorder;
+    attributes_.packed |= attributes.packed;
+    attributes_.align = std::max(attributes_.align, attributes.align);
   }
 
 private:
   std::string name_;
-  std::map<std::string, std::shared_ptr<TypeNode>> members_;
+  std::vector<ClassMember> members_;
+  llvm::DenseMap<Symbol, unsigned> memberIndices_;
+  ClassAttributes attributes_;
+  ClassLayout layout_;
 };
 
 class ClassReferenceNode : public TypeNode {
 public:
-  ClassReferenceNode(std::shared_ptr<ClassNode> decl) : decl_(decl) {}
+  ClassReferenceNode(ClassNode *decl) : TypeNode(TypeKind::ClassReference), decl_(decl) {}
 
-  llvm::Type *codeGen(CodegenContext &ctx) override;
+  static bool classof(const TypeNode *type) { return type->getKind() == TypeKind::ClassReference; }
 
   const std::string &name() const { return decl_->getName(); }
 
   bool isSigned() override { return false; }
 
-  std::shared_ptr<ClassNode> getDecl() { return decl_; }
+  ClassNode *getDecl() { return decl_; }
+
+protected:
+  llvm::Type *lower(CodegenContext &ctx) override;
 
 private:
-  std::shared_ptr<ClassNode> decl_;
+  ClassNode *decl_;
+};
+
+/// hands out one canonical node per structural type. nodes are allocated from the arena the table was created with.
+class TypeTable {
+public:
+  explicit TypeTable(Arena &arena) : arena_(arena) {}
+
+  PrimitiveTypeNode *getPrimitive(PrimitiveType type, bool isSigned) {
+    PrimitiveTypeNode *&node = primitives_[static_cast<size_t>(type)][isSigned];
+    if (!node)
+      node = arena_.create<PrimitiveTypeNode>(type, isSigned);
+    return node;
+  }
+
+  PointerTypeNode *getPointer(TypeNode *target) {
+    PointerTypeNode *&node = pointers_[target];
+    if (!node)
+      node = arena_.create<PointerTypeNode>(target);
+    return node;
+  }
+
+  ArrayTypeNode *getArray(TypeNode *target, int length) {
+    ArrayTypeNode *&node = arrays_[{target, length}];
+    if (!node)
+      node = arena_.create<ArrayTypeNode>(target, length);
+    return node;
+  }
+
+  VectorTypeNode *getVector(TypeNode *target, int lanes) {
+    VectorTypeNode *&node = vectors_[{target, lanes}];
+    if (!node)
+      node = arena_.create<VectorTypeNode>(target, lanes);
+    return node;
+  }
+
+  ClassReferenceNode *getClassReference(ClassNode *decl) {
+    ClassReferenceNode *&node = classReferences_[decl];
+    if (!node)
+      node = arena_.create<ClassReferenceNode>(decl);
+    return node;
+  }
+
+  /// number of distinct types handed out so far.
+  size_t size() const {
+    size_t count = pointers_.size() + arrays_.size() + vectors_.size() + classReferences_.size();
+    for (const auto &signedness : primitives_)
+      count += (signedness[0] != nullptr) + (signedness[1] != nullptr);
+    return count;
+  }
+
+private:
+  Arena &arena_;
+
+  std::array<std::array<PrimitiveTypeNode *, 2>, static_cast<size_t>(PrimitiveType::Quad) + 1> primitives_{};
+  llvm::DenseMap<TypeNode *, PointerTypeNode *> pointers_;
+  llvm::DenseMap<std::pair<TypeNode *, int>, ArrayTypeNode *> arrays_;
+  llvm::DenseMap<std::pair<TypeNode *, int>, VectorTypeNode *> vectors_;
+  llvm::DenseMap<ClassNode *, ClassReferenceNode *> classReferences_;
 };
 
 } // namespace axen::ast
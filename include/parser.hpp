@@ -1,81 +1,202 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+
 #include "error.hpp"
 #include "lexer.hpp"
+#include "nodes/arena.hpp"
 #include "nodes/expression.hpp"
 #include "nodes/function.hpp"
 #include "nodes/statement.hpp"
 #include "nodes/types.hpp"
+#include "symbol.hpp"
 
 namespace axen::parser {
 
+/// counters of a parse, imported files included.
+struct ParseStatistics {
+  // files parsed from source and imports loaded from their interface instead
+  size_t files = 0;
+  size_t interfaces = 0;
+
+  size_t tokens = 0;
+  size_t astNodes = 0;
+  size_t astBytes = 0;
+  size_t types = 0;
+
+  // nodes of the bodies that were streamed and released, and the most bytes one of them took at once
+  size_t streamedNodes = 0;
+  size_t peakBodyBytes = 0;
+
+  // wall seconds spent on each import, including the files it imports itself
+  std::vector<std::pair<std::string, double>> importTimes;
+};
+
+/// the contents of interface files by path. parsers read interfaces through here, so a process that compiles many
+/// files, like the compile server, only reads each of them once. an entry is read again once its file changes.
+class InterfaceCache {
+public:
+  /// returns nullptr if the file cannot be read.
+  static std::shared_ptr<const std::string> read(const std::string &path);
+
+  /// returns the paths read from disk since the last call.
+  static std::vector<std::string> takeMisses();
+};
+
 class Parser {
 public:
-  Parser(std::string &&sourceCode, std::string filePath = "")
-      : sourceCode_(std::move(sourceCode)), rootFilePath_(std::move(filePath)) {
+  /// symbols must outlive codegen, the ast refers to names by their symbols.
+  Parser(std::unique_ptr<llvm::MemoryBuffer> source, SymbolTable &symbols, std::string filePath = "")
+      : symbols_(symbols), sourceCode_(source->getBuffer()), rootFilePath_(std::move(filePath)),
+        thisSymbol_(symbols.intern("this")) {
+
+    sourceBuffers_.push_back(std::move(source));
 
-    registerPrimitiveType("bool", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Bool, false));
+    registerPrimitiveType("bool", typeTable_.getPrimitive(ast::PrimitiveType::Bool, false));
 
-    registerPrimitiveType("void", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Void, false));
+    registerPrimitiveType("void", typeTable_.getPrimitive(ast::PrimitiveType::Void, false));
 
-    registerPrimitiveType("char", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Char, true));
-    registerPrimitiveType("uchar", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Char, false));
+    registerPrimitiveType("char", typeTable_.getPrimitive(ast::PrimitiveType::Char, true));
+    registerPrimitiveType("uchar", typeTable_.getPrimitive(ast::PrimitiveType::Char, false));
 
-    registerPrimitiveType("short", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Short, true));
-    registerPrimitiveType("ushort", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Short, false));
+    registerPrimitiveType("short", typeTable_.getPrimitive(ast::PrimitiveType::Short, true));
+    registerPrimitiveType("ushort", typeTable_.getPrimitive(ast::PrimitiveType::Short, false));
 
-    registerPrimitiveType("int", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Int, true));
-    registerPrimitiveType("uint", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Int, false));
+    registerPrimitiveType("int", typeTable_.getPrimitive(ast::PrimitiveType::Int, true));
+    registerPrimitiveType("uint", typeTable_.getPrimitive(ast::PrimitiveType::Int, false));
 
-    registerPrimitiveType("long", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Long, true));
-    registerPrimitiveType("ulong", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Long, false));
+    registerPrimitiveType("long", typeTable_.getPrimitive(ast::PrimitiveType::Long, true));
+    registerPrimitiveType("ulong", typeTable_.getPrimitive(ast::PrimitiveType::Long, false));
 
     // fp types are always signed
-    registerPrimitiveType("half", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Half, true));
-    registerPrimitiveType("float", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Float, true));
-    registerPrimitiveType("double", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Double, true));
-    registerPrimitiveType("quad", std::make_shared<ast::PrimitiveTypeNode>(ast::PrimitiveType::Quad, true));
+    registerPrimitiveType("half", typeTable_.getPrimitive(ast::PrimitiveType::Half, true));
+    registerPrimitiveType("float", typeTable_.getPrimitive(ast::PrimitiveType::Float, true));
+    registerPrimitiveType("double", typeTable_.getPrimitive(ast::PrimitiveType::Double, true));
+    registerPrimitiveType("quad", typeTable_.getPrimitive(ast::PrimitiveType::Quad, true));
   }
 
   void parse();
-  const std::vector<std::unique_ptr<ast::FunctionNode>> *getFunctions() const { return &functions_; }
-  std::vector<std::unique_ptr<ast::FunctionNode>> &getFunctionsMut() { return functions_; }
-  const std::vector<std::shared_ptr<ast::ClassNode>> *getStructs() const { return &classes_; }
+
+  /// when enabled, imported files only contribute declarations. their bodies are expected to come from the object
+  /// that was compiled from the imported file itself. up to date interface files are loaded instead of the source.
+  void setSeparateImports(bool separateImports) { separateImports_ = separateImports; }
+
+  /// when enabled, parse only declares the signatures and classes of every file and holds on to where the bodies
+  /// start. streamBodies parses them afterwards.
+  void setStreaming(bool streaming) { streaming_ = streaming; }
+
+  /// imports are read and lexed ahead of parsing on threads of pool, which can be shared by the parsers of a batch.
+  /// without one they are read once the parser gets to them.
+  void setImportPool(llvm::ThreadPoolInterface *pool) { importPool_ = pool; }
+
+  /// parses the bodies held back by a streaming parse one at a time, in the order parse would have parsed them. each
+  /// body is handed to generate and released once it returns, so only one body is alive at any time. bodies see the
+  /// typedefs, intdefs and classes their file saw, but the functions of every file of the program.
+  void streamBodies(const std::function<void(ast::FunctionNode *)> &generate);
+
+  /// writes the classes, typedefs, intdefs and function signatures declared by the root file to path.
+  void writeInterface(const std::string &path) const;
+
+  /// returns the interface file path that belongs to a source file.
+  static std::string getInterfacePath(const std::string &sourcePath);
+  ParseStatistics getStatistics() const {
+    ParseStatistics statistics = statistics_;
+    statistics.astNodes = arena_.nodeCount();
+    statistics.astBytes = arena_.bytesAllocated();
+    statistics.types = typeTable_.size();
+    return statistics;
+  }
+
+  const std::vector<ast::FunctionNode *> *getFunctions() const { return &functions_; }
+  std::vector<ast::FunctionNode *> &getFunctionsMut() { return functions_; }
+  const std::vector<ast::ClassNode *> *getStructs() const { return &classes_; }
 
 private:
-  void parseClass();
+  // a file read ahead of parsing on another thread, and lexed against a table of its own unless an up to date
+  // interface replaces its source
+  struct PreparedFile {
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    std::string sourceHash;
+    SymbolTable symbols;
+    std::unique_ptr<lexer::Lexer> lexer;
+  };
+
+  // the type names and intdefs in scope at the end of a file, where its bodies are parsed
+  struct Definitions {
+    llvm::DenseMap<Symbol, ast::TypeNode *> types;
+    llvm::DenseMap<Symbol, int> intDefs;
+  };
+
+  // a declared function whose body is parsed once every signature of its file is known
+  struct PendingBody {
+    ast::FunctionNode *function;
+    lexer::Lexer::LexerState start;
+    std::string className;
+
+    // the file the body is in, a streamed body is parsed after its file is done
+    std::shared_ptr<lexer::Lexer> lexer;
+    std::string fileName;
+
+    // only kept for streamed bodies, later files may redefine an intdef the body uses
+    std::shared_ptr<const Definitions> definitions;
+  };
+
+  ast::ClassAttributes parseClassAttributes();
+  void parseClass(std::vector<PendingBody> &bodies, const ast::ClassAttributes &attributes);
   void parseFile();
-  void parseFunctions();
+  void reportLexError();
+  void skipFunction();
+  void skipBody();
   void processImports();
-  std::unique_ptr<ast::FunctionNode> parseFunction();
-  std::unique_ptr<ast::ExpressionNode> parseExpression(lexer::TokenType terminator);
-  std::unique_ptr<ast::ExpressionNode> parsePrimaryExpression(lexer::TokenType terminator);
+  void loadImport(const std::string &canonicalPath);
+  void prepareImports(const std::vector<std::string> &rootImports);
+  bool loadInterface(const std::string &path, const std::string &sourceHash);
+  static bool readInterfaceImports(const std::string &path, const std::string &sourceHash,
+                                   std::vector<std::string> &imports);
+  static std::string hashSource(std::string_view sourceCode);
+  ast::FunctionAttributes parseFunctionAttributes();
+  ast::FunctionNode *declareFunction(std::vector<PendingBody> &bodies);
+  void parseFunctionBody(const PendingBody &pending);
+  ast::ExpressionNode *parseExpression(lexer::TokenType terminator);
+  ast::ExpressionNode *parsePrimaryExpression(lexer::TokenType terminator);
 
   ast::BinaryOperationType tokenToBinaryOp(lexer::TokenType type);
-  std::unique_ptr<ast::ExpressionNode> parseBinaryOpRHS(int exprPrec, std::unique_ptr<ast::ExpressionNode> lhs,
-                                                        lexer::TokenType terminator);
-  std::unique_ptr<ast::StatementNode> parseStatement();
-  std::shared_ptr<ast::TypeNode> parseType();
+  ast::ExpressionNode *parseBinaryOpRHS(int exprPrec, ast::ExpressionNode *lhs, lexer::TokenType terminator);
+  ast::ExpressionNode *createBuiltinCall(const std::string &name, std::vector<ast::ExpressionNode *> &args);
+  uint64_t parseIntLiteral();
+  std::optional<int64_t> evaluateConstant(ast::ExpressionNode *expr);
+  int parseConstantExpression(lexer::TokenType terminator, const std::string &what);
+  ast::StatementNode *parseStatement();
+  ast::LoopHints parseLoopHints();
+  ast::TypeNode *parseType();
   int getNextTypeLength();
-  std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>> parseValue();
+  int peekVectorLanes(int offset);
+  std::pair<ast::ExpressionNode *, ast::TypeNode *> parseValue();
 
   inline const void emitSyntaxError(const std::string &msg) {
     error::SourceLocation loc(currentFileName_, currentClassName_, lexer_->peek().row, lexer_->peek().col,
-                              lexer_->peek().src);
+                              std::string(lexer_->peek().src));
     error::reportError(error::ErrorType::Syntax, msg, &loc);
   }
 
   inline const void emitSemanticError(const std::string &msg) {
     error::SourceLocation loc(currentFileName_, currentClassName_, lexer_->peek().row, lexer_->peek().col,
-                              lexer_->peek().src);
+                              std::string(lexer_->peek().src));
     error::reportError(error::ErrorType::Semantic, msg, &loc);
   }
 
@@ -95,29 +216,29 @@ private:
       }
 
       error::SourceLocation loc(currentFileName_, currentClassName_, lexer_->peek().row, lexer_->peek().col,
-                                lexer_->peek().src);
+                                std::string(lexer_->peek().src));
       error::reportError(error::ErrorType::Syntax, "Expected token: '" + expectedString + "'", &loc);
     }
     return lexer_->consume();
   }
 
-  void validateIdentifier(const std::string &id) {
-    if (id.find('_') != std::string::npos) {
-      emitSyntaxError("Invalid identifier '" + id + "': underscores are not allowed in identifiers");
+  void validateIdentifier(std::string_view id) {
+    if (id.find('_') != std::string_view::npos) {
+      emitSyntaxError("Invalid identifier '" + std::string(id) + "': underscores are not allowed in identifiers");
     }
   }
 
   // variable utils
-  void pushScope() { scopes.push_back({}); }
+  void pushScope() { scopes.emplace_back(); }
   void popScope() {
     if (!scopes.empty())
       scopes.pop_back();
   }
-  void indexVariableType(const std::string &name, std::shared_ptr<ast::TypeNode> &type) { scopes.back()[name] = type; }
-  bool variableExistsInCurrentScope(const std::string &name) { return scopes.back().find(name) != scopes.back().end(); }
+  void indexVariableType(Symbol name, ast::TypeNode *type) { scopes.back()[name] = type; }
+  bool variableExistsInCurrentScope(Symbol name) { return scopes.back().count(name); }
 
   /// returns variable type from name. returns nullptr if variable does not exist
-  std::shared_ptr<ast::TypeNode> lookupVariableType(const std::string &name) {
+  ast::TypeNode *lookupVariableType(Symbol name) {
     for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
       auto found = it->find(name);
       if (found != it->end()) {
@@ -128,70 +249,171 @@ private:
   }
 
   // type utils
-  void registerPrimitiveType(const std::string &name, std::shared_ptr<ast::PrimitiveTypeNode> type) {
-    types_.insert({name, type});
+  void registerPrimitiveType(std::string_view name, ast::PrimitiveTypeNode *type) {
+    types_.insert({symbols_.intern(name), type});
   }
-  void registerStructType(const std::string &name, const std::shared_ptr<ast::ClassNode> &structDeclNode) {
-    types_.insert({name, std::make_shared<ast::ClassReferenceNode>(structDeclNode)});
+  void registerPrimitiveType(Symbol name, ast::PrimitiveTypeNode *type) { types_.insert({name, type}); }
+  void registerStructType(Symbol name, ast::ClassNode *structDeclNode) {
+    types_.insert({name, typeTable_.getClassReference(structDeclNode)});
+  }
+
+  ast::TypeNode *getTypeNode(Symbol name) const { return types_.lookup(name); }
+
+  /// returns the type named by the next token without consuming it. returns nullptr if it does not name a type.
+  ast::TypeNode *peekTypeNode() {
+    const lexer::Token &token = lexer_->peek();
+    return token.type == lexer::TokenType::Identifier ? getTypeNode(token.symbol) : nullptr;
   }
 
-  std::shared_ptr<ast::TypeNode> getTypeNode(const std::string &name) const {
-    auto it = types_.find(name);
-    if (it == types_.end()) {
-      return nullptr;
+  /// returns nullptr if no function with the mangled name has been declared
+  ast::TypeNode *lookupFunctionReturnType(Symbol name) const {
+    auto it = functionIndex_.find(name);
+    return it != functionIndex_.end() ? it->second.function->getReturnType() : nullptr;
+  }
+
+  /// adds function to the function index and returns the function its name resolves to. a repeated prototype
+  /// resolves to the function declared first, while a definition replaces an earlier prototype in place. every
+  /// declaration has to agree with the first on the return and parameter types, calls parsed in between rely on them.
+  ast::FunctionNode *indexFunction(ast::FunctionNode *function) {
+    auto [it, inserted] = functionIndex_.try_emplace(function->getName());
+    IndexedFunction &indexed = it->second;
+
+    if (inserted) {
+      indexed = {function, functions_.size()};
+      functions_.push_back(function);
+      return function;
     }
-    return it->second;
+
+    const std::string &name = symbols_.name(function->getName());
+    if (!hasSameSignature(indexed.function, function))
+      emitSemanticError("Declaration of function '" + name + "' does not match its earlier declaration");
+
+    if (!function->isDefined())
+      return indexed.function;
+
+    if (indexed.function->isDefined())
+      emitSemanticError("Redefinition of function '" + name + "'");
+
+    functions_[indexed.index] = function;
+    if (indexed.rootIndex)
+      rootFunctions_[*indexed.rootIndex] = function;
+    indexed.function = function;
+    return function;
   }
 
-  std::shared_ptr<ast::TypeNode> lookupFunctionReturnType(const std::string &name) {
-    for (auto &func : functions_)
-      if (func->getName() == name)
-        return func->getReturnType();
+  /// lists an indexed function among the declarations of the root file, once.
+  void addRootFunction(ast::FunctionNode *function) {
+    IndexedFunction &indexed = functionIndex_[function->getName()];
+    if (indexed.rootIndex)
+      return;
 
-    return nullptr;
+    indexed.rootIndex = rootFunctions_.size();
+    rootFunctions_.push_back(function);
   }
 
-  void insertTypeDef(std::string &alias, const std::string &&targetName) {
+  /// types are canonical, so equal signatures have the same type nodes. parameter names may differ.
+  static bool hasSameSignature(ast::FunctionNode *a, ast::FunctionNode *b) {
+    llvm::ArrayRef<ast::Parameter> aParams = a->getParams();
+    llvm::ArrayRef<ast::Parameter> bParams = b->getParams();
+    if (a->getReturnType() != b->getReturnType() || aParams.size() != bParams.size())
+      return false;
+
+    for (size_t i = 0; i < aParams.size(); i++) {
+      if (aParams[i].type != bParams[i].type)
+        return false;
+    }
+    return true;
+  }
+
+  void insertTypeDef(Symbol alias, Symbol targetName) {
 
     auto targetType = getTypeNode(targetName);
 
-    auto targetPrimitiveType = std::dynamic_pointer_cast<ast::PrimitiveTypeNode>(targetType);
-    if (targetPrimitiveType) {
+    if (auto *targetPrimitiveType = llvm::dyn_cast_or_null<ast::PrimitiveTypeNode>(targetType)) {
       registerPrimitiveType(alias, targetPrimitiveType);
       return;
     }
 
-    auto targetClassType = std::dynamic_pointer_cast<ast::ClassNode>(targetType);
-    if (targetClassType) {
-      registerStructType(alias, targetClassType);
+    if (auto *targetClassType = llvm::dyn_cast_or_null<ast::ClassReferenceNode>(targetType)) {
+      registerStructType(alias, targetClassType->getDecl());
       return;
     }
 
     emitSyntaxError("Invalid target type in typedef");
   }
 
-  void insertIntDef(std::string &alias, int targetInt) { intDefs_[alias] = targetInt; }
+  void insertIntDef(Symbol alias, int targetInt) { intDefs_[alias] = targetInt; }
+
+  bool isParsingRoot() const { return currentFileName_ == rootFilePath_; }
+
+  // every ast and type node of the compilation is allocated here, so the parser must outlive codegen
+  ast::Arena arena_;
+
+  // every type node is created through here so equal types share one node
+  ast::TypeTable typeTable_{arena_};
+
+  // expressions and statements are created here, a streamed body gets an arena of its own that is reset after it
+  ast::Arena *nodes_ = &arena_;
+
+  bool streaming_ = false;
+  llvm::ThreadPoolInterface *importPool_ = nullptr;
+  std::vector<PendingBody> streamedBodies_;
+
+  SymbolTable &symbols_;
 
   std::string currentClassName_;
   std::string currentFileName_;
 
-  std::string sourceCode_;
+  // set while parsing the body of a class declared noinstrument, its methods inherit the annotation
+  bool currentClassNoInstrument_ = false;
+
+  // every source buffer is kept alive for the whole compilation since tokens point into them
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> sourceBuffers_;
+
+  std::string_view sourceCode_;
   std::string rootFilePath_;
   std::shared_ptr<lexer::Lexer> lexer_;
 
-  std::vector<std::unique_ptr<ast::FunctionNode>> functions_;
-  std::vector<std::shared_ptr<ast::ClassNode>> classes_;
+  ParseStatistics statistics_;
+
+  std::vector<ast::FunctionNode *> functions_;
+  std::vector<ast::ClassNode *> classes_;
+
+  // a declared function and where it is listed, so a definition replaces its prototype without a search
+  struct IndexedFunction {
+    ast::FunctionNode *function = nullptr;
+    size_t index = 0;
+
+    // set once the root file declares it
+    std::optional<size_t> rootIndex;
+  };
+
+  // every declared function by mangled name
+  llvm::DenseMap<Symbol, IndexedFunction> functionIndex_;
 
   // for variables
-  std::vector<std::map<std::string, std::shared_ptr<ast::TypeNode>>> scopes;
+  std::vector<llvm::DenseMap<Symbol, ast::TypeNode *>> scopes;
 
   // for types
-  std::map<std::string, std::shared_ptr<ast::TypeNode>> types_;
+  llvm::DenseMap<Symbol, ast::TypeNode *> types_;
 
   // for int defs
-  std::map<std::string, int> intDefs_;
+  llvm::DenseMap<Symbol, int> intDefs_;
+
+  // the implicit parameter of member functions
+  Symbol thisSymbol_;
 
   // for tracking imports
   std::set<std::string> importedFiles_;
+  std::unordered_map<std::string, std::unique_ptr<PreparedFile>> preparedFiles_;
+  std::vector<std::string> rootImports_;
+
+  // declarations made by the root file, these make up its interface
+  std::vector<std::pair<Symbol, Symbol>> rootTypeDefs_;
+  std::vector<Symbol> rootIntDefs_;
+  std::vector<ast::ClassNode *> rootClasses_;
+  std::vector<ast::FunctionNode *> rootFunctions_;
+
+  bool separateImports_ = false;
 };
 } // namespace axen::parser
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace axen {
+
+/// dense id of an interned identifier, ids are only meaningful within the table that interned them.
+using Symbol = uint32_t;
+
+/// interns identifiers so scopes and type tables can hash and compare them as integers. the lexer interns every
+/// identifier token, so one table has to be shared by everything that lexes or looks up names in a compilation.
+class SymbolTable {
+public:
+  SymbolTable();
+  SymbolTable(const SymbolTable &) = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+
+  /// returns the symbol of name, interning it first if it has not been seen yet.
+  Symbol intern(std::string_view name);
+
+  /// the returned reference stays valid for the lifetime of the table.
+  const std::string &name(Symbol symbol) const { return names_[symbol]; }
+
+  size_t size() const { return names_.size(); }
+
+private:
+  void grow();
+
+  // a deque never moves its elements, so names handed out by name() stay put as the table grows
+  std::deque<std::string> names_;
+  std::vector<uint32_t> hashes_;
+
+  // open addressing with linear probing, each slot holds symbol + 1 so zero marks an empty slot
+  std::vector<uint32_t> slots_;
+};
+
+} // namespace axen
@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Type.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/TargetParser/Triple.h>
+
+#include "nodes/abi.hpp"
+#include "nodes/context.hpp"
+#include "nodes/expression.hpp"
+#include "nodes/types.hpp"
+
+namespace axen::ast {
+
+namespace {
+
+enum class ABIKind {
+  SysV,
+  Win64,
+  AAPCS64,
+
+  // every class goes through memory, which is what most c abis do with anything but small classes
+  Generic,
+};
+
+ABIKind getABIKind(CodegenContext &ctx) {
+  llvm::Triple triple(ctx.module->getTargetTriple());
+  if (triple.getArch() == llvm::Triple::x86_64)
+    return triple.isOSWindows() ? ABIKind::Win64 : ABIKind::SysV;
+  if (triple.isAArch64())
+    return ABIKind::AAPCS64;
+  return ABIKind::Generic;
+}
+
+// a scalar or vector of a class and its byte offset
+struct Leaf {
+  llvm::Type *type;
+  uint64_t offset;
+};
+
+// only small classes are classified by their members, so large arrays are never walked
+constexpr uint64_t maxFlattenedSize = 64;
+
+void flatten(CodegenContext &ctx, TypeNode *type, uint64_t offset, std::vector<Leaf> &leaves) {
+  if (auto *classType = llvm::dyn_cast<ClassReferenceNode>(type)) {
+    ClassNode *decl = classType->getDecl();
+    decl->codeGen(ctx);
+    const ClassLayout &layout = decl->getLayout();
+    for (size_t i = 0; i < decl->getMembers().size(); i++)
+      flatten(ctx, decl->getMembers()[i].type, offset + layout.offsets[i], leaves);
+    return;
+  }
+
+  if (auto *arrayType = llvm::dyn_cast<ArrayTypeNode>(type)) {
+    uint64_t size = ctx.module->getDataLayout().getTypeAllocSize(arrayType->target()->codeGen(ctx));
+    for (int i = 0; i < arrayType->length(); i++)
+      flatten(ctx, arrayType->target(), offset + i * size, leaves);
+    return;
+  }
+
+  leaves.push_back({type->codeGen(ctx), offset});
+}
+
+llvm::Type *getIntegerType(CodegenContext &ctx, uint64_t bytes) {
+  return llvm::Type::getIntNTy(ctx.llvmContext, bytes * 8);
+}
+
+ABIArgInfo getIndirect(llvm::Type *type, uint64_t align, bool byVal) {
+  ABIArgInfo info;
+  info.kind = ABIArgInfo::Kind::Indirect;
+  info.type = type;
+  info.align = align;
+  info.byVal = byVal;
+  return info;
+}
+
+ABIArgInfo getCoerce(llvm::Type *type, llvm::ArrayRef<llvm::Type *> coerced) {
+  ABIArgInfo info;
+  info.kind = ABIArgInfo::Kind::Coerce;
+  info.type = type;
+  info.coerced.assign(coerced.begin(), coerced.end());
+  return info;
+}
+
+// classes of an eightbyte on sysv x86-64, merging two classes keeps the larger one
+enum class EightbyteClass {
+  None,
+  SSE,
+  SSEUp,
+  Integer,
+  Memory,
+};
+
+// the register type of an sse eightbyte holding bytes bytes of leaves
+llvm::Type *getSSEType(CodegenContext &ctx, const std::vector<Leaf> &leaves, uint64_t begin, uint64_t bytes) {
+  llvm::SmallVector<llvm::Type *, 4> types;
+  for (const auto &leaf : leaves)
+    if (leaf.offset >= begin && leaf.offset < begin + 8)
+      types.push_back(leaf.type);
+
+  // a single vector or scalar is passed as itself, floats of the same kind as a vector of them
+  if (types.size() == 1 && ctx.module->getDataLayout().getTypeAllocSize(types[0]) == bytes)
+    return types[0];
+
+  bool uniform = std::all_of(types.begin(), types.end(), [&](llvm::Type *type) { return type == types[0]; });
+  if (uniform && types[0]->isFloatingPointTy()) {
+    uint64_t count = bytes / ctx.module->getDataLayout().getTypeAllocSize(types[0]);
+    return count == 1 ? types[0] : llvm::FixedVectorType::get(types[0], count);
+  }
+
+  // only the bytes matter once they are in an xmm register
+  return bytes > 4 ? llvm::Type::getDoubleTy(ctx.llvmContext) : llvm::Type::getFloatTy(ctx.llvmContext);
+}
+
+ABIArgInfo classifySysV(CodegenContext &ctx, ClassReferenceNode *type, bool isReturn, unsigned &freeInt,
+                        unsigned &freeSSE) {
+  const llvm::DataLayout &dataLayout = ctx.module->getDataLayout();
+  const ClassLayout &layout = type->getDecl()->getLayout();
+  llvm::Type *llvmType = type->codeGen(ctx);
+  // byval copies get a stack slot of at least eight bytes, an sret pointer only promises the alignment of the class
+  ABIArgInfo memory = getIndirect(llvmType, isReturn ? layout.align : std::max<uint64_t>(8, layout.align), !isReturn);
+
+  if (layout.size > 16)
+    return memory;
+
+  std::vector<Leaf> leaves;
+  flatten(ctx, type, 0, leaves);
+
+  EightbyteClass classes[2] = {EightbyteClass::None, EightbyteClass::None};
+  for (const auto &leaf : leaves) {
+    uint64_t size = dataLayout.getTypeStoreSize(leaf.type);
+    uint64_t first = leaf.offset / 8;
+    uint64_t last = (leaf.offset + size - 1) / 8;
+
+    // packed members that are not at their alignment are passed in memory
+    if (leaf.offset % dataLayout.getABITypeAlign(leaf.type).value() != 0)
+      return memory;
+
+    EightbyteClass leafClass;
+    if (leaf.type->isIntegerTy() || leaf.type->isPointerTy()) {
+      leafClass = EightbyteClass::Integer;
+    } else if (leaf.type->isHalfTy() || leaf.type->isFloatTy() || leaf.type->isDoubleTy() ||
+               (leaf.type->isVectorTy() && size <= 8)) {
+      leafClass = EightbyteClass::SSE;
+    } else if ((leaf.type->isVectorTy() || leaf.type->isFP128Ty()) && size == 16) {
+      // a quad is __float128, which takes an xmm register like a vector of the same size
+      classes[0] = EightbyteClass::SSE;
+      classes[1] = EightbyteClass::SSEUp;
+      continue;
+    } else {
+      return memory;
+    }
+
+    if (first != last)
+      return memory;
+
+    classes[first] = std::max(classes[first], leafClass);
+  }
+
+  // leading padding would shift the second register off its eightbyte
+  if (classes[0] == EightbyteClass::None && classes[1] != EightbyteClass::None)
+    return memory;
+
+  // a class with nothing but padding has nothing to pass
+  if (classes[0] == EightbyteClass::None) {
+    ABIArgInfo info;
+    info.type = llvmType;
+    return info;
+  }
+
+  llvm::SmallVector<llvm::Type *, 2> coerced;
+  unsigned needInt = 0;
+  unsigned needSSE = 0;
+
+  if (classes[1] == EightbyteClass::SSEUp) {
+    coerced.push_back(leaves.front().type);
+    needSSE = 1;
+  } else {
+    for (uint64_t i = 0; i < 2 && i * 8 < layout.size; i++) {
+      // only the last eightbyte may be narrower, so the second register always starts at offset 8
+      uint64_t bytes = i == 0 && layout.size > 8 ? 8 : layout.size - i * 8;
+
+      if (classes[i] == EightbyteClass::Integer) {
+        coerced.push_back(getIntegerType(ctx, bytes));
+        needInt++;
+      } else if (classes[i] == EightbyteClass::SSE) {
+        coerced.push_back(getSSEType(ctx, leaves, i * 8, bytes));
+        needSSE++;
+      }
+    }
+  }
+
+  // a class is passed entirely in registers or entirely on the stack
+  if (!isReturn) {
+    if (needInt > freeInt || needSSE > freeSSE)
+      return memory;
+    freeInt -= needInt;
+    freeSSE -= needSSE;
+  }
+
+  return getCoerce(llvmType, coerced);
+}
+
+// the member type of a homogeneous aggregate of up to four floating point or vector members, nullptr for any other
+// class
+llvm::Type *getHomogeneousType(CodegenContext &ctx, ClassReferenceNode *type, uint64_t &count) {
+  const ClassLayout &layout = type->getDecl()->getLayout();
+  const llvm::DataLayout &dataLayout = ctx.module->getDataLayout();
+  if (layout.size == 0 || layout.size > maxFlattenedSize)
+    return nullptr;
+
+  std::vector<Leaf> leaves;
+  flatten(ctx, type, 0, leaves);
+
+  llvm::Type *base = leaves.empty() ? nullptr : leaves.front().type;
+  if (!base || leaves.size() > 4)
+    return nullptr;
+
+  uint64_t baseSize = dataLayout.getTypeAllocSize(base);
+  bool isVector = base->isVectorTy() && (baseSize == 8 || baseSize == 16);
+  if (!base->isFloatingPointTy() && !isVector)
+    return nullptr;
+
+  for (const auto &leaf : leaves)
+    if (leaf.type != base)
+      return nullptr;
+
+  // padding between the members rules it out
+  if (layout.size != leaves.size() * baseSize)
+    return nullptr;
+
+  count = leaves.size();
+  return base;
+}
+
+ABIArgInfo classifyAAPCS64(CodegenContext &ctx, ClassReferenceNode *type, bool isReturn) {
+  const ClassLayout &layout = type->getDecl()->getLayout();
+  llvm::Type *llvmType = type->codeGen(ctx);
+
+  // homogeneous aggregates go in consecutive simd registers, the backend keeps them together
+  uint64_t count = 0;
+  if (llvm::Type *base = getHomogeneousType(ctx, type, count))
+    return getCoerce(llvmType, {llvm::ArrayType::get(base, count)});
+
+  // large classes are copied by the caller and passed by address, not on the stack
+  if (layout.size > 16)
+    return getIndirect(llvmType, layout.align, false);
+
+  llvm::Type *int64 = llvm::Type::getInt64Ty(ctx.llvmContext);
+  llvm::Type *int128 = llvm::Type::getInt128Ty(ctx.llvmContext);
+
+  if (isReturn && layout.size <= 8)
+    return getCoerce(llvmType, {getIntegerType(ctx, layout.size)});
+
+  if (layout.align >= 16)
+    return getCoerce(llvmType, {int128});
+  if (layout.size <= 8)
+    return getCoerce(llvmType, {int64});
+  return getCoerce(llvmType, {llvm::ArrayType::get(int64, 2)});
+}
+
+ABIArgInfo classifyWin64(CodegenContext &ctx, ClassReferenceNode *type) {
+  const ClassLayout &layout = type->getDecl()->getLayout();
+  llvm::Type *llvmType = type->codeGen(ctx);
+
+  if (layout.size == 1 || layout.size == 2 || layout.size == 4 || layout.size == 8)
+    return getCoerce(llvmType, {getIntegerType(ctx, layout.size)});
+  return getIndirect(llvmType, layout.align, false);
+}
+
+ABIArgInfo classifyType(CodegenContext &ctx, ABIKind kind, TypeNode *type, bool isReturn, unsigned &freeInt,
+                        unsigned &freeSSE) {
+  llvm::Type *llvmType = type->codeGen(ctx);
+  auto *classType = llvm::dyn_cast<ClassReferenceNode>(type);
+
+  if (!classType || classType->getDecl()->getLayout().size == 0) {
+    // scalars take registers on sysv too, which decides whether a later class still fits in them
+    if (kind == ABIKind::SysV && !isReturn) {
+      if (llvmType->isIntegerTy() || llvmType->isPointerTy()) {
+        freeInt -= freeInt > 0;
+      } else if (llvmType->isFloatingPointTy() || llvmType->isVectorTy()) {
+        freeSSE -= freeSSE > 0;
+      }
+    }
+
+    ABIArgInfo info;
+    info.type = llvmType;
+    info.isSigned = type->isSigned();
+    return info;
+  }
+
+  switch (kind) {
+  case ABIKind::SysV:
+    return classifySysV(ctx, classType, isReturn, freeInt, freeSSE);
+  case ABIKind::AAPCS64:
+    return classifyAAPCS64(ctx, classType, isReturn);
+  case ABIKind::Win64:
+    return classifyWin64(ctx, classType);
+  case ABIKind::Generic:
+  default:
+    return getIndirect(llvmType, classType->getDecl()->getLayout().align, !isReturn);
+  }
+}
+
+// a literal struct of the coerced registers, which is how they are laid out in memory
+llvm::StructType *getCoercedType(CodegenContext &ctx, const ABIArgInfo &info) {
+  return llvm::StructType::get(ctx.llvmContext, info.coerced);
+}
+
+} // namespace
+
+FunctionABI classifyFunction(CodegenContext &ctx, TypeNode *returnType, llvm::ArrayRef<TypeNode *> paramTypes,
+                             bool isPrivate) {
+  ABIKind kind = getABIKind(ctx);
+  FunctionABI abi;
+
+  // the integer and sse argument registers of sysv x86-64, an sret pointer takes the first integer register
+  unsigned freeInt = 6;
+  unsigned freeSSE = 8;
+
+  abi.ret = classifyType(ctx, kind, returnType, true, freeInt, freeSSE);
+
+  std::vector<llvm::Type *> arguments;
+  llvm::Type *llvmReturnType = abi.ret.type;
+
+  if (abi.ret.kind == ABIArgInfo::Kind::Indirect) {
+    arguments.push_back(llvm::PointerType::getUnqual(ctx.llvmContext));
+    llvmReturnType = llvm::Type::getVoidTy(ctx.llvmContext);
+    freeInt--;
+  } else if (abi.ret.kind == ABIArgInfo::Kind::Coerce) {
+    llvmReturnType = abi.ret.coerced.size() == 1 ? abi.ret.coerced[0] : getCoercedType(ctx, abi.ret);
+  }
+
+  for (TypeNode *paramType : paramTypes) {
+    ABIArgInfo info = classifyType(ctx, kind, paramType, false, freeInt, freeSSE);
+    info.argIndex = arguments.size();
+
+    // no other module calls a private function, so its signature does not have to follow the c abi
+    if (info.kind == ABIArgInfo::Kind::Indirect && isPrivate && ctx.classArgsByReference) {
+      info.kind = ABIArgInfo::Kind::Reference;
+      info.byVal = false;
+      info.align = ctx.getAlignment(info.type);
+    }
+
+    if (info.kind == ABIArgInfo::Kind::Coerce) {
+      arguments.insert(arguments.end(), info.coerced.begin(), info.coerced.end());
+    } else if (info.kind == ABIArgInfo::Kind::Direct) {
+      arguments.push_back(info.type);
+    } else {
+      arguments.push_back(llvm::PointerType::getUnqual(ctx.llvmContext));
+    }
+
+    abi.params.push_back(std::move(info));
+  }
+
+  abi.type = llvm::FunctionType::get(llvmReturnType, arguments, false);
+  return abi;
+}
+
+void addABIAttributes(CodegenContext &ctx, const FunctionABI &abi, llvm::Function *function) {
+  if (abi.ret.kind == ABIArgInfo::Kind::Indirect) {
+    function->addParamAttr(0, llvm::Attribute::getWithStructRetType(ctx.llvmContext, abi.ret.type));
+    function->addParamAttr(0, llvm::Attribute::NoAlias);
+    function->addParamAttr(0, llvm::Attribute::getWithAlignment(ctx.llvmContext, llvm::Align(abi.ret.align)));
+  }
+
+  for (const auto &info : abi.params) {
+    if (info.kind != ABIArgInfo::Kind::Indirect && info.kind != ABIArgInfo::Kind::Reference)
+      continue;
+
+    function->addParamAttr(info.argIndex, llvm::Attribute::getWithAlignment(ctx.llvmContext, llvm::Align(info.align)));
+
+    if (info.byVal)
+      function->addParamAttr(info.argIndex, llvm::Attribute::getWithByValType(ctx.llvmContext, info.type));
+
+    // the callee only ever copies a referenced object
+    if (info.kind == ABIArgInfo::Kind::Reference) {
+      function->addParamAttr(info.argIndex, llvm::Attribute::ReadOnly);
+      function->addParamAttr(info.argIndex, llvm::Attribute::NonNull);
+      function->addDereferenceableParamAttr(info.argIndex,
+                                            ctx.module->getDataLayout().getTypeAllocSize(info.type));
+    }
+  }
+}
+
+llvm::Value *emitClassAddress(CodegenContext &ctx, const ABIArgInfo &info, ExpressionNode *expr, bool &isTemporary) {
+  auto typeName = [&] {
+    auto *structType = llvm::dyn_cast<llvm::StructType>(info.type);
+    return structType && structType->hasName() ? structType->getName().str() : std::string("class");
+  };
+
+  if (llvm::isa<VariableReference>(expr)) {
+    auto *alloca = llvm::cast<llvm::AllocaInst>(expr->codeGenLValue(ctx));
+    if (alloca->getAllocatedType() != info.type) {
+      error::reportError(error::ErrorType::Codegen, "Expected a value of type '" + typeName() + "'");
+    }
+
+    isTemporary = false;
+    return alloca;
+  }
+
+  llvm::Value *value = expr->codeGen(ctx);
+  if (!value || value->getType() != info.type) {
+    error::reportError(error::ErrorType::Codegen, "Expected a value of type '" + typeName() + "'");
+  }
+
+  llvm::AllocaInst *temporary = ctx.createEntryAlloca(info.type, "tmp");
+  ctx.builder.CreateStore(value, temporary);
+
+  isTemporary = true;
+  return temporary;
+}
+
+llvm::SmallVector<llvm::Value *, 2> loadCoerced(CodegenContext &ctx, const ABIArgInfo &info, llvm::Value *address,
+                                                llvm::Align align) {
+  const llvm::DataLayout &dataLayout = ctx.module->getDataLayout();
+  llvm::StructType *coercedType = getCoercedType(ctx, info);
+  uint64_t size = dataLayout.getTypeAllocSize(info.type);
+
+  // registers cover the class rounded up, the bytes past its end are read from a temporary instead
+  if (dataLayout.getTypeAllocSize(coercedType) > size) {
+    llvm::AllocaInst *temporary = ctx.createEntryAlloca(coercedType, "coerce");
+    ctx.builder.CreateMemCpy(temporary, temporary->getAlign(), address, align, size);
+    address = temporary;
+    align = temporary->getAlign();
+  }
+
+  const llvm::StructLayout *layout = dataLayout.getStructLayout(coercedType);
+  llvm::SmallVector<llvm::Value *, 2> pieces;
+  for (unsigned i = 0; i < info.coerced.size(); i++) {
+    llvm::Value *piece = ctx.builder.CreateStructGEP(coercedType, address, i);
+    llvm::Align pieceAlign = llvm::commonAlignment(align, layout->getElementOffset(i));
+    pieces.push_back(ctx.builder.CreateAlignedLoad(info.coerced[i], piece, pieceAlign, "coerce"));
+  }
+  return pieces;
+}
+
+void storeCoerced(CodegenContext &ctx, const ABIArgInfo &info, llvm::ArrayRef<llvm::Value *> pieces, llvm::Value *dest,
+                  llvm::Align destAlign) {
+  const llvm::DataLayout &dataLayout = ctx.module->getDataLayout();
+  llvm::StructType *coercedType = getCoercedType(ctx, info);
+  uint64_t size = dataLayout.getTypeAllocSize(info.type);
+
+  // registers that reach past the end of the class are stored to a temporary, which is then copied to dest
+  llvm::Value *address = dest;
+  llvm::Align align = destAlign;
+  llvm::AllocaInst *temporary = nullptr;
+  if (dataLayout.getTypeAllocSize(coercedType) > size) {
+    temporary = ctx.createEntryAlloca(coercedType, "coerce");
+    address = temporary;
+    align = temporary->getAlign();
+  }
+
+  const llvm::StructLayout *layout = dataLayout.getStructLayout(coercedType);
+  for (unsigned i = 0; i < pieces.size(); i++) {
+    llvm::Value *piece = ctx.builder.CreateStructGEP(coercedType, address, i);
+    ctx.builder.CreateAlignedStore(pieces[i], piece, llvm::commonAlignment(align, layout->getElementOffset(i)));
+  }
+
+  if (temporary)
+    ctx.builder.CreateMemCpy(dest, destAlign, temporary, temporary->getAlign(), size);
+}
+
+void copyClass(CodegenContext &ctx, const ABIArgInfo &info, llvm::Value *dest, llvm::Align destAlign, llvm::Value *src,
+               llvm::Align srcAlign) {
+  ctx.builder.CreateMemCpy(dest, destAlign, src, srcAlign, ctx.module->getDataLayout().getTypeAllocSize(info.type));
+}
+
+} // namespace axen::ast
@@ -0,0 +1,149 @@
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Type.h>
+#include <llvm/IR/Value.h>
+#include <llvm/Support/Alignment.h>
+#include <llvm/Support/Casting.h>
+
+#include "nodes/context.hpp"
+#include "nodes/expression.hpp"
+
+namespace axen::ast {
+
+static llvm::FixedVectorType *expectVector(llvm::Value *value, const std::string &builtin) {
+  auto *vectorType = value ? llvm::dyn_cast<llvm::FixedVectorType>(value->getType()) : nullptr;
+  if (!vectorType)
+    error::reportError(error::ErrorType::Codegen, "'" + builtin + "' expects a vector operand");
+  return vectorType;
+}
+
+static llvm::Value *codeGenReduction(CodegenContext &ctx, Builtin builtin, llvm::Value *vector, bool isSigned) {
+  llvm::Type *elementType = expectVector(vector, "reduce")->getElementType();
+
+  if (elementType->isFloatingPointTy()) {
+    // without fast math the fp reductions are ordered, starting from the identity of the operation
+    switch (builtin) {
+    case Builtin::ReduceAdd:
+      return ctx.builder.CreateFAddReduce(llvm::ConstantFP::getNegativeZero(elementType), vector);
+    case Builtin::ReduceMul:
+      return ctx.builder.CreateFMulReduce(llvm::ConstantFP::get(elementType, 1.0), vector);
+    case Builtin::ReduceMin:
+      return ctx.builder.CreateFPMinReduce(vector);
+    case Builtin::ReduceMax:
+      return ctx.builder.CreateFPMaxReduce(vector);
+    default:
+      error::reportError(error::ErrorType::Codegen, "Bitwise reductions require integer vectors");
+      return nullptr; // unreachable
+    }
+  }
+
+  switch (builtin) {
+  case Builtin::ReduceAdd:
+    return ctx.builder.CreateAddReduce(vector);
+  case Builtin::ReduceMul:
+    return ctx.builder.CreateMulReduce(vector);
+  case Builtin::ReduceMin:
+    return ctx.builder.CreateIntMinReduce(vector, isSigned);
+  case Builtin::ReduceMax:
+    return ctx.builder.CreateIntMaxReduce(vector, isSigned);
+  case Builtin::ReduceAnd:
+    return ctx.builder.CreateAndReduce(vector);
+  case Builtin::ReduceOr:
+    return ctx.builder.CreateOrReduce(vector);
+  case Builtin::ReduceXor:
+    return ctx.builder.CreateXorReduce(vector);
+  default:
+    error::reportError(error::ErrorType::Internal, "Unexpected reduction builtin");
+    return nullptr; // unreachable
+  }
+}
+
+llvm::Value *BuiltinCall::codeGen(CodegenContext &ctx) {
+  switch (builtin_) {
+  case Builtin::Splat: {
+    llvm::Value *value = args_[0]->codeGen(ctx);
+    return ctx.builder.CreateVectorSplat(constants_[0], value, "splat");
+  }
+
+  case Builtin::Shuffle: {
+    llvm::Value *a = args_[0]->codeGen(ctx);
+    llvm::Value *b = args_[1]->codeGen(ctx);
+
+    auto *vectorType = expectVector(a, "shuffle");
+    if (a->getType() != b->getType())
+      error::reportError(error::ErrorType::Codegen, "'shuffle' expects two vectors of the same type");
+
+    int lanes = vectorType->getNumElements();
+    for (int lane : constants_) {
+      if (lane < 0 || lane >= 2 * lanes)
+        error::reportError(error::ErrorType::Codegen, "Shuffle lane " + std::to_string(lane) + " is out of range");
+    }
+
+    return ctx.builder.CreateShuffleVector(a, b, constants_, "shuffle");
+  }
+
+  case Builtin::ReduceAdd:
+  case Builtin::ReduceMul:
+  case Builtin::ReduceMin:
+  case Builtin::ReduceMax:
+  case Builtin::ReduceAnd:
+  case Builtin::ReduceOr:
+  case Builtin::ReduceXor:
+    return codeGenReduction(ctx, builtin_, args_[0]->codeGen(ctx), isSigned_);
+
+  case Builtin::Load:
+  case Builtin::LoadUnaligned:
+    error::reportError(error::ErrorType::Codegen,
+                       "Vector loads need a vector type from their context, assign them to a vector first");
+    return nullptr; // unreachable
+
+  case Builtin::Store:
+  case Builtin::StoreUnaligned: {
+    llvm::Value *ptr = args_[0]->codeGen(ctx);
+    llvm::Value *vector = args_[1]->codeGen(ctx);
+
+    auto *vectorType = expectVector(vector, "store");
+    if (!ptr || !ptr->getType()->isPointerTy())
+      error::reportError(error::ErrorType::Codegen, "Vector stores expect a pointer as their first operand");
+
+    llvm::Type *alignType = builtin_ == Builtin::Store ? vectorType : vectorType->getElementType();
+    return ctx.builder.CreateAlignedStore(vector, ptr, llvm::Align(ctx.getAlignment(alignType)));
+  }
+
+  default:
+    error::reportError(error::ErrorType::Internal, "Unexpected builtin");
+    return nullptr; // unreachable
+  }
+}
+
+llvm::Value *BuiltinCall::codeGenAs(CodegenContext &ctx, llvm::Type *type, bool isTargetSigned) {
+  auto *vectorType = llvm::dyn_cast<llvm::FixedVectorType>(type);
+
+  // the splatted value is created in the element type, so literals take it as well
+  if (builtin_ == Builtin::Splat && vectorType) {
+    if (static_cast<int>(vectorType->getNumElements()) != constants_[0])
+      error::reportError(error::ErrorType::Codegen, "Splat lane count does not match the vector it is assigned to");
+
+    llvm::Value *value = args_[0]->codeGenAs(ctx, vectorType->getElementType(), isTargetSigned);
+    return ctx.builder.CreateVectorSplat(constants_[0], value, "splat");
+  }
+
+  if (builtin_ == Builtin::Load || builtin_ == Builtin::LoadUnaligned) {
+    if (!vectorType)
+      error::reportError(error::ErrorType::Codegen, "Vector loads can only be assigned to vectors");
+
+    llvm::Value *ptr = args_[0]->codeGen(ctx);
+    if (!ptr || !ptr->getType()->isPointerTy())
+      error::reportError(error::ErrorType::Codegen, "Vector loads expect a pointer operand");
+
+    llvm::Type *alignType = builtin_ == Builtin::Load ? vectorType : vectorType->getElementType();
+    return ctx.builder.CreateAlignedLoad(vectorType, ptr, llvm::Align(ctx.getAlignment(alignType)), "vload");
+  }
+
+  return ExpressionNode::codeGenAs(ctx, type, isTargetSigned);
+}
+
+} // namespace axen::ast
@@ -1,6 +1,8 @@
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Attributes.h>
 #include <llvm/IR/Constants.h>
 #include <string>
 #include <vector>
@@ -11,6 +13,7 @@
 #include <llvm/IR/Value.h>
 #include <llvm/Support/Casting.h>
 
+#include "nodes/abi.hpp"
 #include "nodes/context.hpp"
 #include "nodes/expression.hpp"
 
@@ -21,7 +24,7 @@ llvm::Value *VariableReference::codeGen(CodegenContext &ctx) {
   llvm::AllocaInst *alloca = ctx.lookupVariable(name_);
 
   if (!alloca) {
-    error::reportError(error::ErrorType::Codegen, "Undefined variable '" + name_ + "'");
+    error::reportError(error::ErrorType::Codegen, "Undefined variable '" + ctx.symbols.name(name_) + "'");
   }
 
   return ctx.builder.CreateLoad(alloca->getAllocatedType(), alloca, "varValRef");
@@ -32,7 +35,7 @@ llvm::Value *VariableReference::codeGenLValue(CodegenContext &ctx) {
   llvm::AllocaInst *alloca = ctx.lookupVariable(name_);
 
   if (!alloca) {
-    error::reportError(error::ErrorType::Codegen, "Undefined variable '" + name_ + "'");
+    error::reportError(error::ErrorType::Codegen, "Undefined variable '" + ctx.symbols.name(name_) + "'");
   }
 
   return alloca;
@@ -81,18 +84,21 @@ llvm::Value *AddressOf::codeGen(CodegenContext &ctx) {
 llvm::Value *StructAccess::codeGen(CodegenContext &ctx) {
   llvm::Value *fieldPtr = codeGenLValue(ctx);
   if (!fieldPtr) {
-    error::reportError(error::ErrorType::Codegen, "Failed to generate lvalue for struct member '" + memberName_ + "'");
+    error::reportError(error::ErrorType::Codegen,
+                       "Failed to generate lvalue for struct member '" + ctx.symbols.name(memberName_) + "'");
   }
 
-  std::shared_ptr<ast::TypeNode> memberType = type_->getDecl()->lookupMemberType(memberName_);
+  ast::TypeNode *memberType = type_->getDecl()->lookupMemberType(memberName_);
   if (!memberType) {
     error::reportError(error::ErrorType::Codegen,
-                       "Struct '" + structName_ + "' has no member named '" + memberName_ + "'");
+                       "Struct '" + type_->name() + "' has no member named '" + ctx.symbols.name(memberName_) + "'");
   }
 
   llvm::Type *fieldType = memberType->codeGen(ctx);
 
-  return ctx.builder.CreateLoad(fieldType, fieldPtr, structName_ + "_member");
+  return ctx.builder.CreateAlignedLoad(fieldType, fieldPtr,
+                                       ctx.getAccessAlignment(fieldType, getLValueAlignment(ctx)),
+                                       type_->name() + "_member");
 }
 
 llvm::Value *StructAccess::codeGenLValue(CodegenContext &ctx) {
@@ -110,10 +116,26 @@ llvm::Value *StructAccess::codeGenLValue(CodegenContext &ctx) {
   }
 
   int memberIndex = type_->getDecl()->lookupMemberIndex(memberName_);
+  if (memberIndex < 0) {
+    error::reportError(error::ErrorType::Internal, "Could not find index of member '" +
+                                                       ctx.symbols.name(memberName_) + "' in struct '" +
+                                                       type_->name() + "'");
+  }
 
   return ctx.builder.CreateStructGEP(llvmStructType, structPtr, memberIndex);
 }
 
+llvm::MaybeAlign StructAccess::getLValueAlignment(CodegenContext &ctx) {
+  // lowering the class computes its layout
+  type_->codeGen(ctx);
+  ClassNode *decl = type_->getDecl();
+
+  // a struct reached through a packed member may sit below its own alignment
+  llvm::MaybeAlign baseAlign = structExpr_->getLValueAlignment(ctx);
+  llvm::Align structAlign = baseAlign ? *baseAlign : llvm::Align(decl->getLayout().align);
+  return llvm::commonAlignment(structAlign, decl->lookupMemberOffset(memberName_));
+}
+
 llvm::Value *ArrayAccess::codeGen(CodegenContext &ctx) {
   llvm::Value *elemPtr = codeGenLValue(ctx);
 
@@ -130,7 +152,8 @@ llvm::Value *ArrayAccess::codeGen(CodegenContext &ctx) {
 
   llvm::Type *elemType = arrayType->getElementType();
 
-  return ctx.builder.CreateLoad(elemType, elemPtr, "arrayval");
+  return ctx.builder.CreateAlignedLoad(elemType, elemPtr, ctx.getAccessAlignment(elemType, getLValueAlignment(ctx)),
+                                       "arrayval");
 }
 
 llvm::Value *ArrayAccess::codeGenLValue(CodegenContext &ctx) {
@@ -167,6 +190,46 @@ llvm::Value *ArrayAccess::codeGenLValue(CodegenContext &ctx) {
   return ctx.builder.CreateGEP(arrayType, arrayPtr, indices, "arrayidx");
 }
 
+llvm::MaybeAlign ArrayAccess::getLValueAlignment(CodegenContext &ctx) {
+  llvm::MaybeAlign arrayAlign = arrayExpr_->getLValueAlignment(ctx);
+  if (!arrayAlign)
+    return arrayAlign;
+
+  // the index is not known here, so only what every element shares with the array start holds
+  llvm::Type *elemType = llvm::cast<llvm::ArrayType>(type_->codeGen(ctx))->getElementType();
+  return llvm::commonAlignment(*arrayAlign, ctx.module->getDataLayout().getTypeAllocSize(elemType));
+}
+
+llvm::Value *LaneAccess::codeGen(CodegenContext &ctx) {
+  llvm::Value *vector = vectorExpr_->codeGen(ctx);
+  if (!vector) {
+    error::reportError(error::ErrorType::Codegen, "Failed to generate vector for lane access");
+  }
+
+  llvm::Value *indexVal = indexExpr_->codeGen(ctx);
+  if (!indexVal || !indexVal->getType()->isIntegerTy()) {
+    error::reportError(error::ErrorType::Codegen, "Lane index must be an integer type");
+  }
+
+  return ctx.builder.CreateExtractElement(vector, indexVal, "lane");
+}
+
+llvm::Value *LaneAccess::codeGenLValue(CodegenContext &ctx) {
+  llvm::Value *vectorPtr = vectorExpr_->codeGenLValue(ctx);
+  if (!vectorPtr) {
+    error::reportError(error::ErrorType::Codegen, "Failed to generate lvalue for vector expression");
+  }
+
+  llvm::Value *indexVal = indexExpr_->codeGen(ctx);
+  if (!indexVal || !indexVal->getType()->isIntegerTy()) {
+    error::reportError(error::ErrorType::Codegen, "Lane index must be an integer type");
+  }
+
+  // element types are at least a byte wide, so every lane has an address of its own
+  llvm::Value *zero = llvm::ConstantInt::get(llvm::Type::getInt32Ty(ctx.llvmContext), 0);
+  return ctx.builder.CreateGEP(type_->codeGen(ctx), vectorPtr, {zero, indexVal}, "laneidx");
+}
+
 llvm::Value *PtrIndexAccess::codeGen(CodegenContext &ctx) {
   llvm::Value *elemPtr = codeGenLValue(ctx);
 
@@ -213,134 +276,235 @@ llvm::Value *PtrIndexAccess::codeGenLValue(CodegenContext &ctx) {
 }
 
 llvm::Value *IntLiteral::codeGen(CodegenContext &ctx) {
-  return llvm::ConstantInt::get(llvm::Type::getInt32Ty(ctx.llvmContext), value_, true);
+  // an int without context, unless it needs a long
+  bool fitsInt = isSigned_ && value_ >= INT32_MIN && value_ <= INT32_MAX;
+  llvm::Type *type = fitsInt ? llvm::Type::getInt32Ty(ctx.llvmContext) : llvm::Type::getInt64Ty(ctx.llvmContext);
+  return codeGenAs(ctx, type, isSigned_);
+}
+
+llvm::Value *IntLiteral::codeGenAs(CodegenContext &ctx, llvm::Type *type, bool isTargetSigned) {
+  // a vector type gets the literal splatted into every lane
+  if (type->isIntOrIntVectorTy()) {
+    llvm::APInt bits(64, static_cast<uint64_t>(value_));
+    return llvm::ConstantInt::get(type, bits.trunc(type->getScalarSizeInBits()));
+  }
+  if (type->isFPOrFPVectorTy())
+    return llvm::ConstantFP::get(type, isSigned_ ? static_cast<double>(value_)
+                                                 : static_cast<double>(static_cast<uint64_t>(value_)));
+  return ExpressionNode::codeGenAs(ctx, type, isTargetSigned);
 }
 
 llvm::Value *FloatLiteral::codeGen(CodegenContext &ctx) {
   return llvm::ConstantFP::get(llvm::Type::getFloatTy(ctx.llvmContext), value_);
 }
 
+llvm::Value *FloatLiteral::codeGenAs(CodegenContext &ctx, llvm::Type *type, bool isTargetSigned) {
+  if (type->isFPOrFPVectorTy())
+    return llvm::ConstantFP::get(type, value_);
+  return ExpressionNode::codeGenAs(ctx, type, isTargetSigned);
+}
+
 llvm::Value *StringLiteral::codeGen(CodegenContext &ctx) {
 
-  llvm::GlobalVariable *gvar = ctx.builder.CreateGlobalString(value_);
+  llvm::GlobalVariable *gvar = ctx.getStringConstant(value_);
 
   llvm::Value *zero = ctx.builder.getInt32(0);
   return ctx.builder.CreateInBoundsGEP(gvar->getValueType(), gvar, {zero, zero});
 }
 
 llvm::Value *FunctionCall::codeGen(CodegenContext &ctx) {
-  llvm::Function *calleeFunc = ctx.module->getFunction(name_);
+  const std::string &name = ctx.symbols.name(name_);
+  llvm::Function *calleeFunc = ctx.functions.lookup(name_);
 
   if (!calleeFunc) {
-    error::reportError(error::ErrorType::Codegen, "Unknown function '" + name_ + "'");
+    error::reportError(error::ErrorType::Codegen, "Unknown function '" + name + "'");
   }
 
-  if (calleeFunc->arg_size() != args_.size()) {
-    error::reportError(error::ErrorType::Codegen, "Function '" + name_ + "' expects " +
-                                                      std::to_string(calleeFunc->arg_size()) + " arguments, got " +
+  const FunctionABI &abi = ctx.abis.find(calleeFunc)->second;
+
+  if (abi.params.size() != args_.size()) {
+    error::reportError(error::ErrorType::Codegen, "Function '" + name + "' expects " +
+                                                      std::to_string(abi.params.size()) + " arguments, got " +
                                                       std::to_string(args_.size()));
   }
 
   std::vector<llvm::Value *> args;
-  args.reserve(args_.size());
+  args.reserve(calleeFunc->arg_size());
+
+  // a returned class the callee writes to memory goes to a temporary of the caller
+  llvm::AllocaInst *sret = nullptr;
+  if (abi.ret.kind == ABIArgInfo::Kind::Indirect) {
+    sret = ctx.createEntryAlloca(abi.ret.type, "sret");
+    args.push_back(sret);
+  }
 
   for (size_t i = 0; i < args_.size(); ++i) {
-    llvm::Value *argValue = args_.at(i)->codeGen(ctx);
+    const ABIArgInfo &info = abi.params[i];
+
+    if (info.kind == ABIArgInfo::Kind::Direct) {
+      llvm::Value *argValue = args_[i]->codeGenAs(ctx, info.type, info.isSigned);
 
-    if (!argValue) {
-      error::reportError(error::ErrorType::Codegen,
-                         "Failed to generate argument " + std::to_string(i) + " for function '" + name_ + "'");
-      return nullptr;
+      if (!argValue) {
+        error::reportError(error::ErrorType::Codegen,
+                           "Failed to generate argument " + std::to_string(i) + " for function '" + name + "'");
+        return nullptr;
+      }
+
+      args.push_back(argValue);
+      continue;
     }
 
-    args.push_back(argValue);
+    bool isTemporary;
+    llvm::Value *address = emitClassAddress(ctx, info, args_[i], isTemporary);
+    llvm::Align align(ctx.getAlignment(info.type));
+
+    switch (info.kind) {
+    case ABIArgInfo::Kind::Coerce:
+      for (llvm::Value *piece : loadCoerced(ctx, info, address, align))
+        args.push_back(piece);
+      break;
+    case ABIArgInfo::Kind::Indirect:
+      // the backend copies byval arguments itself, any other copy belongs to the callee which may write to it
+      if (!info.byVal && !isTemporary) {
+        llvm::AllocaInst *copy = ctx.createEntryAlloca(info.type, "copy");
+        copyClass(ctx, info, copy, copy->getAlign(), address, align);
+        address = copy;
+      }
+      args.push_back(address);
+      break;
+    case ABIArgInfo::Kind::Reference:
+    default:
+      args.push_back(address);
+      break;
+    }
   }
 
-  llvm::Value *result =
+  llvm::CallInst *call =
       ctx.builder.CreateCall(calleeFunc, args, calleeFunc->getReturnType()->isVoidTy() ? "" : "calltmp");
 
-  if (!result) {
-    error::reportError(error::ErrorType::Codegen, "Failed to create call to function '" + name_ + "'");
+  if (!call) {
+    error::reportError(error::ErrorType::Codegen, "Failed to create call to function '" + name + "'");
     return nullptr;
   }
 
-  return result;
+  // the call carries the sret and byval attributes of its pointers as well, like clang's calls do
+  llvm::AttributeList attributes = calleeFunc->getAttributes();
+  auto copyAttributes = [&](unsigned index) {
+    llvm::AttrBuilder builder(ctx.llvmContext, attributes.getParamAttrs(index));
+    call->setAttributes(call->getAttributes().addParamAttributes(ctx.llvmContext, index, builder));
+  };
+  if (sret)
+    copyAttributes(0);
+  for (const auto &info : abi.params)
+    if (info.kind == ABIArgInfo::Kind::Indirect || info.kind == ABIArgInfo::Kind::Reference)
+      copyAttributes(info.argIndex);
+
+  if (sret)
+    return ctx.builder.CreateLoad(abi.ret.type, sret, "calltmp");
+
+  if (abi.ret.kind == ABIArgInfo::Kind::Coerce) {
+    llvm::SmallVector<llvm::Value *, 2> pieces;
+    if (abi.ret.coerced.size() == 1) {
+      pieces.push_back(call);
+    } else {
+      for (unsigned piece = 0; piece < abi.ret.coerced.size(); piece++)
+        pieces.push_back(ctx.builder.CreateExtractValue(call, piece));
+    }
+
+    llvm::AllocaInst *result = ctx.createEntryAlloca(abi.ret.type, "result");
+    storeCoerced(ctx, abi.ret, pieces, result, result->getAlign());
+    return ctx.builder.CreateLoad(abi.ret.type, result, "calltmp");
+  }
+
+  return call;
 }
 
 llvm::Value *BinaryOperation::codeGen(CodegenContext &ctx) {
 
-  llvm::Value *L = L_->codeGen(ctx);
-  llvm::Value *R = R_->codeGen(ctx);
-
-  R = ctx.convertIfNeeded(R, L->getType(), isSigned_);
+  // a literal takes the type of the other operand, so its operand is generated first
+  auto isLiteral = [](ExpressionNode *expr) { return llvm::isa<IntLiteral, FloatLiteral>(expr); };
+
+  llvm::Value *L;
+  llvm::Value *R;
+  if (isLiteral(L_) && !isLiteral(R_)) {
+    R = R_->codeGen(ctx);
+    L = R ? L_->codeGenAs(ctx, R->getType(), R_->isSigned()) : nullptr;
+  } else {
+    L = L_->codeGen(ctx);
+    R = L && isLiteral(R_) ? R_->codeGenAs(ctx, L->getType(), L_->isSigned()) : R_->codeGen(ctx);
+  }
 
   if (!L || !R) {
     error::reportError(error::ErrorType::Codegen, "Failed to generate operands for binary operation");
   }
 
-  switch (type_) {
-  case BinaryOperationType::Add:
-
+  if (type_ == BinaryOperationType::Add || type_ == BinaryOperationType::Subtract) {
     if (L->getType()->isPointerTy()) {
       if (!R->getType()->isIntegerTy()) {
-        error::reportError(error::ErrorType::Codegen, "Cannot add non-integer to pointer");
+        error::reportError(error::ErrorType::Codegen, "Cannot add or subtract non-integer and pointer");
       }
-      return ctx.builder.CreateGEP(L->getType(), L, R);
+      return ctx.builder.CreateGEP(L->getType(), L,
+                                   type_ == BinaryOperationType::Add ? R : ctx.builder.CreateNeg(R));
     } else if (R->getType()->isPointerTy()) {
-      if (!L->getType()->isIntegerTy()) {
+      if (type_ == BinaryOperationType::Subtract || !L->getType()->isIntegerTy()) {
         error::reportError(error::ErrorType::Codegen, "Cannot add non-integer to pointer");
       }
       return ctx.builder.CreateGEP(R->getType(), R, L);
-    } else {
-      if (!L->getType()->isIntegerTy() || !R->getType()->isIntegerTy()) {
-        error::reportError(error::ErrorType::Codegen, "Addition requires integer operands");
-      }
-      return ctx.builder.CreateAdd(L, R, "addtmp");
     }
+  }
 
-  case BinaryOperationType::Subtract:
+  // usual arithmetic conversions, each operand is extended according to its own signedness
+  llvm::Type *type = ctx.getCommonType(L->getType(), R->getType());
+  L = ctx.convertIfNeeded(L, type, L_->isSigned());
+  R = ctx.convertIfNeeded(R, type, R_->isSigned());
 
-    if (L->getType()->isPointerTy()) {
-      if (!R->getType()->isIntegerTy()) {
-        error::reportError(error::ErrorType::Codegen, "Cannot subtract non-integer from pointer");
-      }
-      return ctx.builder.CreateGEP(L->getType(), L, ctx.builder.CreateNeg(R));
-    } else {
-      if (!L->getType()->isIntegerTy() || !R->getType()->isIntegerTy()) {
-        error::reportError(error::ErrorType::Codegen, "Subtraction requires integer operands");
-      }
-      return ctx.builder.CreateSub(L, R, "subtmp");
-    }
+  // vectors are operated on lane by lane, comparisons produce a vector of i1
+  bool isFP = type->isFPOrFPVectorTy();
+  bool isComparison =
+      type_ == BinaryOperationType::Less || type_ == BinaryOperationType::More || type_ == BinaryOperationType::Equal;
+
+  // pointers can only be compared, and compare as unsigned addresses
+  bool isPointerComparison = isComparison && type->isPointerTy() && L->getType() == R->getType();
+  bool isSigned = isSigned_ && !isPointerComparison;
+
+  if (!isFP && !type->isIntOrIntVectorTy() && !isPointerComparison) {
+    error::reportError(error::ErrorType::Codegen, "Binary operation requires integer or floating point operands");
+  }
+
+  // signed overflow is undefined, which lets induction variables be widened. unsigned arithmetic wraps, so it gets
+  // no flags. fast math flags apply through the builder
+  switch (type_) {
+  case BinaryOperationType::Add:
+    return isFP ? ctx.builder.CreateFAdd(L, R, "addtmp") : ctx.builder.CreateAdd(L, R, "addtmp", false, isSigned);
+
+  case BinaryOperationType::Subtract:
+    return isFP ? ctx.builder.CreateFSub(L, R, "subtmp") : ctx.builder.CreateSub(L, R, "subtmp", false, isSigned);
 
   case BinaryOperationType::Multiply:
-    if (!L->getType()->isIntegerTy() || !R->getType()->isIntegerTy()) {
-      error::reportError(error::ErrorType::Codegen, "Multiplication requires integer operands");
-    }
-    return ctx.builder.CreateMul(L, R, "multmp");
+    return isFP ? ctx.builder.CreateFMul(L, R, "multmp") : ctx.builder.CreateMul(L, R, "multmp", false, isSigned);
 
   case BinaryOperationType::Divide:
-    if (!L->getType()->isIntegerTy() || !R->getType()->isIntegerTy()) {
-      error::reportError(error::ErrorType::Codegen, "Division requires integer operands");
-    }
-    return ctx.builder.CreateUDiv(L, R, "udivtmp");
+    if (isFP)
+      return ctx.builder.CreateFDiv(L, R, "divtmp");
+    return isSigned ? ctx.builder.CreateSDiv(L, R, "sdivtmp") : ctx.builder.CreateUDiv(L, R, "udivtmp");
+
+  case BinaryOperationType::Remainder:
+    if (isFP)
+      return ctx.builder.CreateFRem(L, R, "remtmp");
+    return isSigned ? ctx.builder.CreateSRem(L, R, "sremtmp") : ctx.builder.CreateURem(L, R, "uremtmp");
 
   case BinaryOperationType::Less:
-    if (!L->getType()->isIntegerTy() || !R->getType()->isIntegerTy()) {
-      error::reportError(error::ErrorType::Codegen, "Comparison requires integer operands");
-    }
-    return ctx.builder.CreateICmpULT(L, R);
+    if (isFP)
+      return ctx.builder.CreateFCmpOLT(L, R);
+    return isSigned ? ctx.builder.CreateICmpSLT(L, R) : ctx.builder.CreateICmpULT(L, R);
 
   case BinaryOperationType::More:
-    if (!L->getType()->isIntegerTy() || !R->getType()->isIntegerTy()) {
-      error::reportError(error::ErrorType::Codegen, "Comparison requires integer operands");
-    }
-    return ctx.builder.CreateICmpUGT(L, R);
+    if (isFP)
+      return ctx.builder.CreateFCmpOGT(L, R);
+    return isSigned ? ctx.builder.CreateICmpSGT(L, R) : ctx.builder.CreateICmpUGT(L, R);
 
   case BinaryOperationType::Equal:
-    if (!L->getType()->isIntegerTy() || !R->getType()->isIntegerTy()) {
-      error::reportError(error::ErrorType::Codegen, "Equality comparison requires integer operands");
-    }
-    return ctx.builder.CreateICmpEQ(L, R);
+    return isFP ? ctx.builder.CreateFCmpOEQ(L, R) : ctx.builder.CreateICmpEQ(L, R);
 
   default:
     error::reportError(error::ErrorType::Codegen, "Unexpected binary operation type");
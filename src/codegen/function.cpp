@@ -1,41 +1,155 @@
 #include <cstdio>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/CFG.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Type.h>
+#include <llvm/Support/Alignment.h>
+#include <llvm/Support/AtomicOrdering.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/TargetParser/Triple.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
+#include "nodes/abi.hpp"
 #include "nodes/context.hpp"
 #include "nodes/function.hpp"
 
 namespace axen::ast {
 
+// calls one of gcc's profiling hooks with the address of function and the address it returns to
+static void callProfileHook(CodegenContext &ctx, llvm::Function *function, llvm::StringRef hook) {
+  llvm::Type *pointerType = llvm::PointerType::getUnqual(ctx.llvmContext);
+  llvm::FunctionCallee callee =
+      ctx.module->getOrInsertFunction(hook, ctx.builder.getVoidTy(), pointerType, pointerType);
+  if (auto *declaration = llvm::dyn_cast<llvm::Function>(callee.getCallee()))
+    declaration->setDoesNotThrow();
+
+  llvm::Value *returnAddress =
+      ctx.builder.CreateIntrinsic(llvm::Intrinsic::returnaddress, {}, {ctx.builder.getInt32(0)});
+  ctx.builder.CreateCall(callee, {function, returnAddress});
+}
+
+// adds the hooks of -finstrument to a function whose entry block the builder is at. functions that are left out get
+// nothing, so they cost exactly what they did without instrumentation
+static void instrumentEntry(CodegenContext &ctx, llvm::Function *function, bool noInstrument) {
+  const Instrumentation &instrumentation = ctx.instrumentation;
+
+  // xray-never also keeps the threshold from giving small loops in the function sleds
+  if (instrumentation.xray) {
+    if (noInstrument)
+      function->addFnAttr("function-instrument", "xray-never");
+    else
+      function->addFnAttr("xray-instruction-threshold", std::to_string(instrumentation.xrayThreshold));
+  }
+
+  if (noInstrument)
+    return;
+
+  // each record is { i64 calls, ptr name }. the linker gathers them into one section a runtime walks from
+  // __start_axen_calls to __stop_axen_calls, inlined copies of the function keep counting into it
+  if (instrumentation.callCounts) {
+    llvm::Type *int64Type = ctx.builder.getInt64Ty();
+    auto *recordType = llvm::StructType::get(int64Type, llvm::PointerType::getUnqual(ctx.llvmContext));
+    llvm::Constant *name = ctx.getStringConstant(function->getName());
+
+    auto *record = new llvm::GlobalVariable(
+        *ctx.module, recordType, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantStruct::get(recordType, {llvm::ConstantInt::get(int64Type, 0), name}),
+        "__axen_calls." + function->getName());
+    record->setAlignment(llvm::Align(8));
+    record->setSection(llvm::Triple(ctx.module->getTargetTriple()).isOSBinFormatMachO() ? "__DATA,__axen_calls"
+                                                                                       : "axen_calls");
+
+    // nothing in the program reads the records, they would be dropped without this
+    llvm::appendToCompilerUsed(*ctx.module, {record});
+
+    ctx.builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, record, llvm::ConstantInt::get(int64Type, 1),
+                                llvm::Align(8), llvm::AtomicOrdering::Monotonic);
+  }
+
+  // the hooks are opaque calls, so inlined copies of the function still report themselves the way gcc's do
+  if (instrumentation.entryExit)
+    callProfileHook(ctx, function, "__cyg_profile_func_enter");
+}
+
+// calls the exit hook ahead of every return of the finished body
+static void instrumentReturns(CodegenContext &ctx, llvm::Function *function, bool noInstrument) {
+  if (!ctx.instrumentation.entryExit || noInstrument)
+    return;
+
+  for (llvm::BasicBlock &block : *function) {
+    if (auto *ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator())) {
+      ctx.builder.SetInsertPoint(ret);
+      callProfileHook(ctx, function, "__cyg_profile_func_exit");
+    }
+  }
+}
+
 void FunctionNode::generateFunctionBody(CodegenContext &ctx, llvm::Function *function) {
 
   llvm::BasicBlock *entry = llvm::BasicBlock::Create(ctx.llvmContext, "entry", function);
   ctx.builder.SetInsertPoint(entry);
 
+  instrumentEntry(ctx, function, attributes_.noInstrument);
+
   // push new scope for function body
   ctx.pushScope();
 
+  const FunctionABI &abi = ctx.abis.find(function)->second;
+  if (abi.ret.kind == ABIArgInfo::Kind::Indirect)
+    function->getArg(0)->setName("sret");
+
   // copy parameters to stack variables to make them mutable
-  auto argIt = function->arg_begin();
-  for (size_t i = 0; i < params_->size(); ++i, ++argIt) {
-    llvm::Argument *arg = &(*argIt);
-    arg->setName(params_->at(i).first);
+  for (size_t i = 0; i < params_.size(); ++i) {
+    const ABIArgInfo &info = abi.params[i];
+    llvm::Argument *arg = function->getArg(info.argIndex);
+    const std::string &paramName = ctx.symbols.name(params_[i].name);
+
+    // classes arrive in registers or behind a pointer, either way they end up in the variable
+    if (info.kind == ABIArgInfo::Kind::Coerce) {
+      for (unsigned piece = 0; piece < info.coerced.size(); piece++)
+        function->getArg(info.argIndex + piece)->setName(paramName + ".coerce" + std::to_string(piece));
+    } else {
+      arg->setName(info.kind == ABIArgInfo::Kind::Direct ? paramName : paramName + ".addr");
+    }
 
-    llvm::AllocaInst *alloca = ctx.builder.CreateAlloca(arg->getType(), nullptr, params_->at(i).first);
+    llvm::AllocaInst *alloca = ctx.createEntryAlloca(info.type, paramName);
 
     if (!alloca) {
-      error::reportError(error::ErrorType::Codegen,
-                         "Failed to allocate parameter '" + params_->at(i).first + "' in function '" + name_ + "'");
+      error::reportError(error::ErrorType::Codegen, "Failed to allocate parameter '" + paramName +
+                                                        "' in function '" + ctx.symbols.name(name_) + "'");
       ctx.popScope();
       return;
     }
 
-    ctx.builder.CreateStore(arg, alloca);
+    switch (info.kind) {
+    case ABIArgInfo::Kind::Direct:
+      ctx.builder.CreateStore(arg, alloca);
+      break;
+    case ABIArgInfo::Kind::Coerce: {
+      llvm::SmallVector<llvm::Value *, 2> pieces;
+      for (unsigned piece = 0; piece < info.coerced.size(); piece++)
+        pieces.push_back(function->getArg(info.argIndex + piece));
+      storeCoerced(ctx, info, pieces, alloca, alloca->getAlign());
+      break;
+    }
+    case ABIArgInfo::Kind::Indirect:
+    case ABIArgInfo::Kind::Reference:
+      copyClass(ctx, info, alloca, alloca->getAlign(), arg, llvm::Align(info.align));
+      break;
+    }
 
-    ctx.declareVariable(params_->at(i).first, alloca);
+    ctx.declareVariable(params_[i].name, alloca);
   }
 
   // generate body
@@ -48,43 +162,147 @@ void FunctionNode::generateFunctionBody(CodegenContext &ctx, llvm::Function *fun
       break;
   }
 
-  // implicitly return return void if block has no terminator
-  if (!ctx.builder.GetInsertBlock()->getTerminator())
-    ctx.builder.CreateRetVoid();
+  // implicitly return return void if block has no terminator, falling off the end of a noreturn function is undefined
+  if (!ctx.builder.GetInsertBlock()->getTerminator()) {
+    if (attributes_.noReturn)
+      ctx.builder.CreateUnreachable();
+    else
+      ctx.builder.CreateRetVoid();
+  }
+
+  instrumentReturns(ctx, function, attributes_.noInstrument);
 
   ctx.popScope();
 }
 
-llvm::Function *FunctionNode::codeGen(CodegenContext &ctx) {
+llvm::Function *FunctionNode::declare(CodegenContext &ctx) {
 
-  llvm::Type *type = type_->codeGen(ctx);
+  const std::string &name = ctx.symbols.name(name_);
 
-  auto parameters = std::vector<llvm::Type *>();
+  auto parameters = std::vector<TypeNode *>();
 
-  for (auto &param : *params_) {
-    parameters.emplace_back(param.second->codeGen(ctx));
+  for (auto &param : params_) {
+    parameters.emplace_back(param.type);
   }
 
-  auto functionType = llvm::FunctionType::get(type, parameters, false);
+  // classes are passed the way c passes structs on the target, so c code can call and be called with them
+  FunctionABI abi = classifyFunction(ctx, type_, parameters, !isPublic());
+  llvm::FunctionType *functionType = abi.type;
 
   if (!functionType) {
-    error::reportError(error::ErrorType::Codegen, "Failed to create function type for '" + name_ + "'");
+    error::reportError(error::ErrorType::Codegen, "Failed to create function type for '" + name + "'");
     return nullptr;
   }
 
   llvm::Function *function;
 
-  if (isPublic_) {
-    function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, name_, ctx.module.get());
+  if (isPublic()) {
+    function = llvm::Function::Create(functionType, llvm::Function::ExternalLinkage, name, ctx.module.get());
   } else {
-    function = llvm::Function::Create(functionType, llvm::Function::InternalLinkage, name_, ctx.module.get());
+    function = llvm::Function::Create(functionType, llvm::Function::InternalLinkage, name, ctx.module.get());
   }
 
   if (!function) {
-    error::reportError(error::ErrorType::Codegen, "Failed to create function '" + name_ + "'");
+    error::reportError(error::ErrorType::Codegen, "Failed to create function '" + name + "'");
     return nullptr;
   }
 
+  // axen has no exceptions, nothing can unwind through a function written in it
+  function->setDoesNotThrow();
+
+  if (attributes_.inlineHint)
+    function->addFnAttr(llvm::Attribute::InlineHint);
+  if (attributes_.noInline)
+    function->addFnAttr(llvm::Attribute::NoInline);
+  if (attributes_.hot)
+    function->addFnAttr(llvm::Attribute::Hot);
+  if (attributes_.cold)
+    function->addFnAttr(llvm::Attribute::Cold);
+  if (attributes_.pure)
+    function->setOnlyReadsMemory();
+  if (attributes_.isConst)
+    function->setDoesNotAccessMemory();
+  if (attributes_.noReturn)
+    function->setDoesNotReturn();
+
+  addABIAttributes(ctx, abi, function);
+
+  for (unsigned i = 0; i < params_.size(); i++) {
+    if (params_[i].isRestrict)
+      function->addParamAttr(abi.params[i].argIndex, llvm::Attribute::NoAlias);
+  }
+
+  // 'this' is always the address of an object, so the whole class behind it can be loaded from speculatively
+  if (!isDetached_ && !params_.empty() && ctx.symbols.name(params_.front().name) == "this") {
+    auto *thisType = llvm::dyn_cast<PointerTypeNode>(params_.front().type);
+    auto *classType = thisType ? llvm::dyn_cast<ClassReferenceNode>(thisType->target()) : nullptr;
+
+    if (classType) {
+      // lowering the parameter types above already laid the class out
+      const ClassLayout &layout = classType->getDecl()->getLayout();
+      unsigned thisIndex = abi.params.front().argIndex;
+      function->addParamAttr(thisIndex, llvm::Attribute::NonNull);
+      if (layout.size != 0)
+        function->addDereferenceableParamAttr(thisIndex, layout.size);
+      function->addParamAttr(thisIndex,
+                             llvm::Attribute::getWithAlignment(ctx.llvmContext, llvm::Align(layout.align)));
+    }
+  }
+
+  if (!ctx.targetCPU.empty())
+    function->addFnAttr("target-cpu", ctx.targetCPU);
+  if (!ctx.targetFeatures.empty())
+    function->addFnAttr("target-features", ctx.targetFeatures);
+
+  ctx.functions[name_] = function;
+  ctx.abis[function] = std::move(abi);
+
+  return function;
+}
+
+void FunctionNode::inferAttributes(CodegenContext &ctx) {
+  // a function returns if it has no loops and everything it calls returns. functions are only marked once all of
+  // their callees are, so recursion never gets marked and the iteration stops when a round marks nothing new
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (llvm::Function &function : *ctx.module) {
+      if (function.isDeclaration() || function.willReturn() || function.doesNotReturn())
+        continue;
+
+      llvm::SmallVector<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>, 4> backedges;
+      llvm::FindFunctionBackedges(function, backedges);
+      if (!backedges.empty())
+        continue;
+
+      bool returns = true;
+      for (llvm::Instruction &instruction : llvm::instructions(function)) {
+        auto *call = llvm::dyn_cast<llvm::CallBase>(&instruction);
+        if (!call)
+          continue;
+
+        llvm::Function *callee = call->getCalledFunction();
+        if (!callee || !callee->willReturn()) {
+          returns = false;
+          break;
+        }
+      }
+
+      if (returns) {
+        function.setWillReturn();
+        changed = true;
+      }
+    }
+  }
+}
+
+llvm::Function *FunctionNode::codeGen(CodegenContext &ctx) {
+
+  llvm::Function *function = ctx.functions.lookup(name_);
+  if (!function)
+    function = declare(ctx);
+
   // generate body only if it exists, functions can be bodyless.
   if (body_.has_value()) {
     generateFunctionBody(ctx, function);
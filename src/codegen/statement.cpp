@@ -1,39 +1,73 @@
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Type.h>
 #include <llvm/Support/Casting.h>
 
+#include "nodes/abi.hpp"
 #include "nodes/context.hpp"
 #include "nodes/statement.hpp"
 
 namespace axen::ast {
 
+// builds the distinct, self referencing loop id the loop passes look their hints up in
+static llvm::MDNode *createLoopID(CodegenContext &ctx, const LoopHints &hints) {
+  llvm::LLVMContext &context = ctx.llvmContext;
+  llvm::Type *i32 = llvm::Type::getInt32Ty(context);
+
+  auto hint = [&](llvm::StringRef name, llvm::Metadata *value = nullptr) -> llvm::Metadata * {
+    if (!value)
+      return llvm::MDNode::get(context, llvm::MDString::get(context, name));
+    return llvm::MDNode::get(context, {llvm::MDString::get(context, name), value});
+  };
+  auto constant = [&](llvm::Constant *value) { return llvm::ConstantAsMetadata::get(value); };
+
+  // the first operand is replaced with the node itself once it exists
+  llvm::SmallVector<llvm::Metadata *, 4> operands{nullptr};
+
+  if (hints.noUnroll)
+    operands.push_back(hint("llvm.loop.unroll.disable"));
+  else if (hints.unroll != 0)
+    operands.push_back(hint("llvm.loop.unroll.count", constant(llvm::ConstantInt::get(i32, hints.unroll))));
+
+  if (hints.vectorize != 0) {
+    operands.push_back(hint("llvm.loop.vectorize.width", constant(llvm::ConstantInt::get(i32, hints.vectorize))));
+    operands.push_back(hint("llvm.loop.vectorize.enable",
+                            constant(llvm::ConstantInt::getBool(context, hints.vectorize > 1))));
+  }
+
+  llvm::MDNode *loopID = llvm::MDNode::getDistinct(context, operands);
+  loopID->replaceOperandWith(0, loopID);
+  return loopID;
+}
+
 void VariableDeclaration::codeGen(CodegenContext &ctx) {
 
+  const std::string &name = ctx.symbols.name(name_);
   llvm::Type *type = type_->codeGen(ctx);
 
   if (!type) {
-    error::reportError(error::ErrorType::Codegen, "Failed to create type for variable '" + name_ + "'");
+    error::reportError(error::ErrorType::Codegen, "Failed to create type for variable '" + name + "'");
   }
 
-  llvm::AllocaInst *variable = ctx.builder.CreateAlloca(type, nullptr, name_);
+  llvm::AllocaInst *variable = ctx.createEntryAlloca(type, name);
   if (!variable) {
-    error::reportError(error::ErrorType::Codegen, "Failed to allocate variable '" + name_ + "'");
+    error::reportError(error::ErrorType::Codegen, "Failed to allocate variable '" + name + "'");
   }
 
   if (initialValue_) {
-    llvm::Value *init_val = initialValue_->codeGen(ctx);
+    llvm::Value *converted = initialValue_->codeGenAs(ctx, type, type_->isSigned());
 
-    if (!init_val) {
-      error::reportError(error::ErrorType::Codegen, "Failed to generate initial value for variable '" + name_ + "'");
+    if (!converted) {
+      error::reportError(error::ErrorType::Codegen, "Failed to generate initial value for variable '" + name + "'");
     }
 
-    llvm::Value *converted = ctx.convertIfNeeded(init_val, type, initialValue_->isSigned());
-
     if (ctx.checkTypeCompatible(type, converted->getType())) {
       ctx.builder.CreateStore(converted, variable);
     } else {
       error::reportError(error::ErrorType::Codegen,
-                         "Cannot initialize variable '" + name_ + "' with incompatible type");
+                         "Cannot initialize variable '" + name + "' with incompatible type");
     }
   }
 
@@ -47,38 +81,64 @@ void AssignmentStatement::codeGen(CodegenContext &ctx) {
     error::reportError(error::ErrorType::Codegen, "Failed to generate lvalue for assignment target");
   }
 
-  llvm::Value *val = value_->codeGen(ctx);
-
-  if (!val) {
-    error::reportError(error::ErrorType::Codegen, "Failed to generate value for assignment");
-  }
-
   llvm::Type *targetType = nullptr;
   if (auto *alloca = llvm::dyn_cast<llvm::AllocaInst>(ptr)) {
     targetType = alloca->getAllocatedType();
   } else if (auto *gep = llvm::dyn_cast<llvm::GetElementPtrInst>(ptr)) {
     targetType = gep->getResultElementType();
-  } else {
-    targetType = val->getType();
   }
 
-  llvm::Value *converted = ctx.convertIfNeeded(val, targetType, value_->isSigned());
+  // without a known target type the value is stored as it is
+  llvm::Value *converted = targetType ? value_->codeGenAs(ctx, targetType, target_->isSigned()) : value_->codeGen(ctx);
 
-  ctx.builder.CreateStore(converted, ptr);
+  if (!converted) {
+    error::reportError(error::ErrorType::Codegen, "Failed to generate value for assignment");
+  }
+
+  ctx.builder.CreateAlignedStore(converted, ptr,
+                                 ctx.getAccessAlignment(converted->getType(), target_->getLValueAlignment(ctx)));
 }
 
 void Return::codeGen(CodegenContext &ctx) {
 
-  if (value_) {
-    llvm::Value *value = value_->codeGen(ctx);
+  llvm::Function *function = ctx.builder.GetInsertBlock()->getParent();
+  const ABIArgInfo &ret = ctx.abis.find(function)->second.ret;
 
-    if (!value) {
-      error::reportError(error::ErrorType::Codegen, "Failed to generate return value");
+  // a returned class is written to the sret pointer or returned in the registers it is coerced to
+  if (value_ && ret.kind == ABIArgInfo::Kind::Indirect) {
+    bool isTemporary;
+    llvm::Value *address = emitClassAddress(ctx, ret, value_, isTemporary);
+    copyClass(ctx, ret, function->getArg(0), llvm::Align(ret.align), address, llvm::Align(ctx.getAlignment(ret.type)));
+    ctx.builder.CreateRetVoid();
+    return;
+  }
+
+  if (value_ && ret.kind == ABIArgInfo::Kind::Coerce) {
+    bool isTemporary;
+    llvm::Value *address = emitClassAddress(ctx, ret, value_, isTemporary);
+    llvm::SmallVector<llvm::Value *, 2> pieces =
+        loadCoerced(ctx, ret, address, llvm::Align(ctx.getAlignment(ret.type)));
+
+    if (pieces.size() == 1) {
+      ctx.builder.CreateRet(pieces.front());
+      return;
     }
 
-    llvm::Type *returnType = ctx.builder.getCurrentFunctionReturnType();
+    llvm::Value *aggregate = llvm::PoisonValue::get(function->getReturnType());
+    for (unsigned piece = 0; piece < pieces.size(); piece++)
+      aggregate = ctx.builder.CreateInsertValue(aggregate, pieces[piece], piece);
+    ctx.builder.CreateRet(aggregate);
+    return;
+  }
+
+  if (value_) {
+    llvm::Type *returnType = ret.type;
+
+    llvm::Value *converted = value_->codeGenAs(ctx, returnType, ret.isSigned);
 
-    llvm::Value *converted = ctx.convertIfNeeded(value, returnType, value_->isSigned());
+    if (!converted) {
+      error::reportError(error::ErrorType::Codegen, "Failed to generate return value");
+    }
 
     if (!ctx.checkTypeCompatible(returnType, converted->getType())) {
       error::reportError(error::ErrorType::Codegen, "Return value type does not match function return type");
@@ -86,9 +146,8 @@ void Return::codeGen(CodegenContext &ctx) {
 
     ctx.builder.CreateRet(converted);
   } else {
-    llvm::Type *returnType = ctx.builder.getCurrentFunctionReturnType();
-
-    if (!returnType->isVoidTy()) {
+    // a class returned through sret leaves the llvm function returning void
+    if (!ret.type->isVoidTy()) {
       error::reportError(error::ErrorType::Codegen, "Non-void function must return a value");
     }
 
@@ -178,7 +237,12 @@ void While::codeGen(CodegenContext &ctx) {
     stmt->codeGen(ctx);
   }
 
-  ctx.builder.CreateBr(condBB);
+  // the back edge is the only latch of the loop, so that is where its hints are attached
+  if (!ctx.builder.GetInsertBlock()->getTerminator()) {
+    llvm::BranchInst *latch = ctx.builder.CreateBr(condBB);
+    if (!hints_.empty())
+      latch->setMetadata(llvm::LLVMContext::MD_loop, createLoopID(ctx, hints_));
+  }
 
   ctx.builder.SetInsertPoint(exitBB);
 }
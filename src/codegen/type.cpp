@@ -1,15 +1,19 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <numeric>
 
+#include <llvm/IR/DataLayout.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Type.h>
+#include <llvm/Support/MathExtras.h>
 
 #include "nodes/context.hpp"
 #include "nodes/types.hpp"
 
 namespace axen::ast {
 
-llvm::Type *PrimitiveTypeNode::codeGen(CodegenContext &ctx) {
+llvm::Type *PrimitiveTypeNode::lower(CodegenContext &ctx) {
   switch (type_) {
 
   case PrimitiveType::Void:
@@ -38,16 +42,127 @@ llvm::Type *PrimitiveTypeNode::codeGen(CodegenContext &ctx) {
   }
 }
 
-llvm::Type *ClassReferenceNode::codeGen(CodegenContext &ctx) { return decl_->codeGen(ctx); }
+llvm::Type *ClassReferenceNode::lower(CodegenContext &ctx) { return decl_->codeGen(ctx); }
 
-llvm::Type *PointerTypeNode::codeGen(CodegenContext &ctx) {
+llvm::Type *PointerTypeNode::lower(CodegenContext &ctx) {
   llvm::Type *targetType = target_->codeGen(ctx);
   return llvm::PointerType::getUnqual(ctx.llvmContext);
 }
 
-llvm::Type *ArrayTypeNode::codeGen(CodegenContext &ctx) {
+llvm::Type *ArrayTypeNode::lower(CodegenContext &ctx) {
   llvm::Type *targetType = target_->codeGen(ctx);
   return llvm::ArrayType::get(targetType, length_);
 }
 
+llvm::Type *VectorTypeNode::lower(CodegenContext &ctx) {
+  return llvm::FixedVectorType::get(target_->codeGen(ctx), lanes_);
+}
+
+llvm::StructType *ClassNode::codeGen(CodegenContext &ctx) {
+  auto it = ctx.namedStructs.find(this);
+  if (it != ctx.namedStructs.end())
+    return it->second;
+
+  llvm::StructType *llvmStruct = llvm::StructType::create(ctx.llvmContext, name_);
+
+  // declared before the body so members may point back to their own class
+  ctx.declareStruct(this, llvmStruct);
+
+  const llvm::DataLayout &dataLayout = ctx.module->getDataLayout();
+
+  std::vector<llvm::Type *> memberTypes;
+  std::vector<uint64_t> memberAligns;
+  for (const auto &member : members_) {
+    llvm::Type *type = member.type->codeGen(ctx);
+    memberTypes.push_back(type);
+    memberAligns.push_back(attributes_.packed ? 1 : ctx.getAlignment(type));
+  }
+
+  std::vector<unsigned> order(members_.size());
+  std::iota(order.begin(), order.end(), 0);
+
+  // stable so members of equal alignment keep their declaration order
+  if (attributes_.reorder)
+    std::stable_sort(order.begin(), order.end(),
+                     [&](unsigned a, unsigned b) { return memberAligns[a] > memberAligns[b]; });
+
+  layout_ = ClassLayout();
+  layout_.offsets.resize(members_.size());
+
+  // llvm only lays out a plain struct the same way when every member sits at its abi alignment
+  bool natural = !attributes_.packed;
+  uint64_t offset = 0;
+
+  for (unsigned member : order) {
+    uint64_t aligned = llvm::alignTo(offset, memberAligns[member]);
+    if (aligned > offset)
+      layout_.holes.push_back({offset, aligned - offset});
+
+    uint64_t size = dataLayout.getTypeAllocSize(memberTypes[member]);
+    layout_.fields.push_back({member, aligned, size});
+    layout_.offsets[member] = aligned;
+    layout_.align = std::max(layout_.align, memberAligns[member]);
+
+    if (memberAligns[member] != dataLayout.getABITypeAlign(memberTypes[member]).value())
+      natural = false;
+
+    offset = aligned + size;
+  }
+
+  if (attributes_.align > layout_.align) {
+    layout_.align = attributes_.align;
+    natural = false;
+  }
+
+  layout_.size = llvm::alignTo(offset, layout_.align);
+  if (layout_.size > offset)
+    layout_.holes.push_back({offset, layout_.size - offset});
+
+  // anything llvm would not place by itself becomes a packed struct with the padding spelled out as byte arrays
+  std::vector<llvm::Type *> elements;
+  layout_.elements.resize(members_.size());
+  uint64_t position = 0;
+
+  for (const auto &field : layout_.fields) {
+    if (!natural && field.offset > position)
+      elements.push_back(llvm::ArrayType::get(llvm::Type::getInt8Ty(ctx.llvmContext), field.offset - position));
+
+    layout_.elements[field.member] = elements.size();
+    elements.push_back(memberTypes[field.member]);
+    position = field.offset + field.size;
+  }
+
+  if (!natural && layout_.size > position)
+    elements.push_back(llvm::ArrayType::get(llvm::Type::getInt8Ty(ctx.llvmContext), layout_.size - position));
+
+  llvmStruct->setBody(elements, !natural);
+  ctx.structAlignments[llvmStruct] = layout_.align;
+
+  return llvmStruct;
+}
+
+void ClassNode::printLayout(CodegenContext &ctx, llvm::raw_ostream &os) {
+  codeGen(ctx);
+
+  uint64_t padding = 0;
+  for (const auto &hole : layout_.holes)
+    padding += hole.second;
+
+  os << "class '" << name_ << "': size " << layout_.size << ", align " << layout_.align << ", padding " << padding
+     << "\n";
+
+  // fields and holes are both sorted by offset, so merging them walks the class front to back
+  auto hole = layout_.holes.begin();
+  for (const auto &field : layout_.fields) {
+    for (; hole != layout_.holes.end() && hole->first < field.offset; ++hole)
+      os << "  [" << hole->first << ", " << hole->first + hole->second << ") padding\n";
+
+    os << "  [" << field.offset << ", " << field.offset + field.size << ") "
+       << ctx.symbols.name(members_[field.member].name) << "\n";
+  }
+
+  for (; hole != layout_.holes.end(); ++hole)
+    os << "  [" << hole->first << ", " << hole->first + hole->second << ") padding\n";
+}
+
 } // namespace axen::ast
@@ -0,0 +1,173 @@
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA256.h>
+
+#include "driver.hpp"
+#include "error.hpp"
+#include "lexer.hpp"
+#include "nodes/context.hpp"
+
+namespace axen::driver {
+
+static std::unique_ptr<llvm::MemoryBuffer> readFile(const std::filesystem::path &path) {
+  auto buffer = llvm::MemoryBuffer::getFile(path.string());
+  if (!buffer) {
+    error::reportError(error::ErrorType::Syntax, "Could not open file: '" + path.string() + "'");
+  }
+  return std::move(*buffer);
+}
+
+/// every field goes in behind its length, so no two different sequences of fields feed the hasher the same bytes.
+static void hashField(llvm::SHA256 &hasher, llvm::StringRef field) {
+  uint8_t size[8];
+  llvm::support::endian::write64le(size, field.size());
+  hasher.update(llvm::ArrayRef<uint8_t>(size));
+  hasher.update(field);
+}
+
+/// hashes the file, then every file it imports in the same depth first order Parser::processImports uses.
+static void hashSources(llvm::SHA256 &hasher, const std::filesystem::path &path, std::set<std::string> &visited) {
+  auto buffer = readFile(path);
+  llvm::StringRef source = buffer->getBuffer();
+
+  hashField(hasher, path.filename().string());
+  hashField(hasher, source);
+
+  // imports are only allowed at the top of a file so only the leading import statements are lexed
+  SymbolTable symbols;
+  lexer::Lexer lexer(std::string_view(source.data(), source.size()), symbols);
+  while (lexer.peekT(lexer::TokenType::Import)) {
+    lexer.consume();
+    if (!lexer.peekT(lexer::TokenType::StringLit))
+      return;
+
+    std::filesystem::path importPath = std::filesystem::path(lexer::unescape(lexer.consume().src));
+    if (!importPath.is_absolute())
+      importPath = path.parent_path() / importPath;
+
+    if (!lexer.peekT(lexer::TokenType::Semi) || !std::filesystem::exists(importPath))
+      return; // the parser reports the error
+
+    lexer.consume();
+
+    std::string canonicalPath = std::filesystem::canonical(importPath).string();
+    if (!visited.insert(canonicalPath).second)
+      continue;
+
+    hashSources(hasher, canonicalPath, visited);
+  }
+}
+
+std::string computeCacheKey(const std::string &srcFile, const TargetSelection &selection, OptLevel level,
+                            unsigned jobs, bool separateImports, bool streaming, bool fastMath,
+                            bool classArgsByReference, const ast::Instrumentation &instrumentation, EmitKind emit,
+                            LTOMode lto, const ProfileOptions &profile) {
+  llvm::SHA256 hasher;
+
+  hashField(hasher, "axenc " AXENC_VERSION " llvm " LLVM_VERSION_STRING);
+  hashField(hasher, selection.triple);
+  hashField(hasher, selection.cpu);
+  hashField(hasher, selection.features);
+  hashField(hasher, std::to_string(static_cast<int>(level)));
+  hashField(hasher, std::to_string(jobs));
+  hashField(hasher, separateImports ? "separate" : "whole");
+
+  // streamed functions are simplified on their own before the module pipeline runs
+  hashField(hasher, streaming ? "streamed" : "batched");
+  hashField(hasher, fastMath ? "fast-math" : "strict-math");
+  hashField(hasher, classArgsByReference ? "class-args-by-reference" : "class-args-by-value");
+  hashField(hasher, instrumentation.xray ? "xray " + std::to_string(instrumentation.xrayThreshold) : "no-xray");
+  hashField(hasher, instrumentation.entryExit ? "entry-exit" : "no-entry-exit");
+  hashField(hasher, instrumentation.callCounts ? "calls" : "no-calls");
+  hashField(hasher, std::to_string(static_cast<int>(emit)));
+  hashField(hasher, std::to_string(static_cast<int>(lto)));
+  hashField(hasher, profile.generatePath);
+
+  // a newly merged profile changes the objects without changing any option
+  if (!profile.usePath.empty()) {
+    auto buffer = readFile(profile.usePath);
+    hashField(hasher, "profile");
+    hashField(hasher, buffer->getBuffer());
+  }
+
+  // the root is keyed by where it is rather than how it was spelled, so 'a.ax' and './a.ax' share their objects. the
+  // module is named after the path as typed, which only shows up in the source file name the object records
+  std::string canonicalPath = std::filesystem::canonical(srcFile).string();
+  hashField(hasher, canonicalPath);
+
+  std::set<std::string> visited = {canonicalPath};
+  hashSources(hasher, srcFile, visited);
+
+  return llvm::toHex(hasher.final(), true);
+}
+
+static std::vector<std::string> getCacheEntries(const std::string &cacheDir, const std::string &key, size_t count) {
+  std::string base = (std::filesystem::path(cacheDir) / (key + ".o")).string();
+  if (count == 1)
+    return {base};
+
+  std::vector<std::string> entries;
+  for (unsigned i = 0; i < count; ++i)
+    entries.push_back(getPartitionPath(base, i));
+  return entries;
+}
+
+/// the interface of the root file is stored next to its objects, the objects do not depend on whether it is written.
+static std::string getInterfaceEntry(const std::string &cacheDir, const std::string &key) {
+  return (std::filesystem::path(cacheDir) / (key + ".axi")).string();
+}
+
+bool restoreFromCache(const std::string &cacheDir, const std::string &key, const std::vector<std::string> &outputs,
+                      const std::string &interfaceFile) {
+  std::vector<std::string> entries = getCacheEntries(cacheDir, key, outputs.size());
+  std::vector<std::string> targets = outputs;
+
+  // an interface is only cached once a compilation wrote one, until then emitting it is a miss
+  if (!interfaceFile.empty()) {
+    entries.push_back(getInterfaceEntry(cacheDir, key));
+    targets.push_back(interfaceFile);
+  }
+
+  for (const auto &entry : entries)
+    if (!llvm::sys::fs::exists(entry))
+      return false;
+
+  for (size_t i = 0; i < entries.size(); ++i)
+    if (llvm::sys::fs::copy_file(entries[i], targets[i]))
+      return false;
+
+  return true;
+}
+
+void storeInCache(const std::string &cacheDir, const std::string &key, const std::vector<std::string> &outputs,
+                  const std::string &interfaceFile) {
+  if (llvm::sys::fs::create_directories(cacheDir))
+    return; // the cache is best effort, a failed store just means a miss next time
+
+  std::vector<std::string> entries = getCacheEntries(cacheDir, key, outputs.size());
+  std::vector<std::string> sources = outputs;
+
+  if (!interfaceFile.empty()) {
+    entries.push_back(getInterfaceEntry(cacheDir, key));
+    sources.push_back(interfaceFile);
+  }
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    // copy to a unique temporary first so concurrent compilers never observe a partial entry
+    std::string tmp = entries[i] + ".tmp" + std::to_string(llvm::sys::Process::getProcessId());
+    if (llvm::sys::fs::copy_file(sources[i], tmp) || llvm::sys::fs::rename(tmp, entries[i]))
+      llvm::sys::fs::remove(tmp);
+  }
+}
+
+} // namespace axen::driver
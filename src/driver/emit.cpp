@@ -0,0 +1,239 @@
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Bitcode/BitcodeWriterPass.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO/ThinLTOBitcodeWriter.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include "driver.hpp"
+#include "error.hpp"
+
+namespace axen::driver {
+
+static std::unique_ptr<llvm::raw_fd_ostream> openOutput(const std::string &path, llvm::sys::fs::OpenFlags flags) {
+  std::error_code EC;
+  auto dest = std::make_unique<llvm::raw_fd_ostream>(path, EC, flags);
+
+  if (EC) {
+    error::reportError(error::ErrorType::Internal, "Could not open file '" + path + "': " + EC.message());
+  }
+
+  return dest;
+}
+
+// returns why the file could not be written rather than reporting it, pool threads must not exit the compiler
+static std::optional<std::string> writeObjectFile(llvm::Module &module, llvm::TargetMachine &targetMachine,
+                                                  const std::string &path, llvm::CodeGenFileType fileType) {
+  std::error_code EC;
+  llvm::raw_fd_ostream dest(path, EC, fileType == llvm::CodeGenFileType::AssemblyFile ? llvm::sys::fs::OF_Text
+                                                                                    : llvm::sys::fs::OF_None);
+  if (EC)
+    return "Could not open file '" + path + "': " + EC.message();
+
+  llvm::legacy::PassManager pass;
+
+  if (targetMachine.addPassesToEmitFile(pass, dest, nullptr, fileType))
+    return std::string("TargetMachine can't emit a file of this type");
+
+  pass.run(module);
+  dest.flush();
+  return std::nullopt;
+}
+
+void emitObjectFile(llvm::Module &module, llvm::TargetMachine &targetMachine, const std::string &path,
+                    llvm::CodeGenFileType fileType) {
+  if (auto message = writeObjectFile(module, targetMachine, path, fileType)) {
+    error::reportError(error::ErrorType::Internal, *message);
+  }
+}
+
+void emitBitcodeFile(llvm::Module &module, const std::string &path, LTOMode lto) {
+  auto dest = openOutput(path, llvm::sys::fs::OF_None);
+
+  if (lto == LTOMode::None) {
+    llvm::WriteBitcodeToFile(module, *dest);
+    dest->flush();
+    return;
+  }
+
+  // the linker reads these flags to tell how each module was split, clang sets the same ones
+  if (lto == LTOMode::Thin) {
+    if (!module.getModuleFlag("EnableSplitLTOUnit"))
+      module.addModuleFlag(llvm::Module::Error, "EnableSplitLTOUnit", 0u);
+  } else if (!module.getModuleFlag("ThinLTO")) {
+    module.addModuleFlag(llvm::Module::Error, "ThinLTO", 0u);
+  }
+
+  // both writers compute the summary through the module analyses, so they run under a pass manager
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+
+  llvm::PassBuilder PB;
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  llvm::ModulePassManager MPM;
+  if (lto == LTOMode::Thin)
+    MPM.addPass(llvm::ThinLTOBitcodeWriterPass(*dest, nullptr));
+  else
+    MPM.addPass(llvm::BitcodeWriterPass(*dest, false, true));
+
+  MPM.run(module, MAM);
+  dest->flush();
+}
+
+void emitIRFile(llvm::Module &module, const std::string &path) {
+  auto dest = openOutput(path, llvm::sys::fs::OF_Text);
+  module.print(*dest, nullptr);
+  dest->flush();
+}
+
+std::string getPartitionPath(const std::string &outputFile, unsigned index) {
+  // out.o -> out.0.o, out.1.o, ...
+  std::filesystem::path path(outputFile);
+  std::string name = path.stem().string() + "." + std::to_string(index) + path.extension().string();
+  return (path.parent_path() / name).string();
+}
+
+std::string getPartitionSuffix(const std::string &srcFile) {
+  // the path as it was typed is the same for files of the same name compiled from different directories
+  std::error_code EC;
+  std::filesystem::path canonicalPath = std::filesystem::canonical(srcFile, EC);
+
+  llvm::MD5 hasher;
+  hasher.update(EC ? srcFile : canonicalPath.string());
+  if (auto buffer = llvm::MemoryBuffer::getFile(srcFile))
+    hasher.update((*buffer)->getBuffer());
+
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  return ".axen." + llvm::utohexstr(result.low());
+}
+
+void flushPartition(llvm::Module &module, llvm::TargetMachine &targetMachine, OptLevel level,
+                    const std::string &suffix, const std::string &path) {
+  // functions generated after this partition may still call its private functions or count into its records. the
+  // suffix keeps them from clashing with the locals of other objects once they are global
+  for (llvm::GlobalValue &value : module.global_values()) {
+    if (!value.hasLocalLinkage())
+      continue;
+    if (auto *variable = llvm::dyn_cast<llvm::GlobalVariable>(&value); variable && variable->isConstant())
+      continue;
+
+    value.setName(value.getName() + suffix);
+    value.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    value.setVisibility(llvm::GlobalValue::HiddenVisibility);
+  }
+
+  llvm::ValueToValueMapTy map;
+  std::unique_ptr<llvm::Module> partition = llvm::CloneModule(module, map, [](const llvm::GlobalValue *value) {
+    if (llvm::isa<llvm::Function>(value))
+      return true;
+    auto *variable = llvm::dyn_cast<llvm::GlobalVariable>(value);
+    return variable && variable->hasLocalLinkage() && variable->isConstant();
+  });
+
+  // the records it lists stay defined in the module, which keeps them alive
+  if (llvm::GlobalVariable *used = partition->getNamedGlobal("llvm.compiler.used"))
+    used->eraseFromParent();
+
+  for (llvm::Function &function : module) {
+    if (!function.isDeclaration())
+      function.deleteBody();
+  }
+
+  optimizeModule(*partition, &targetMachine, level);
+  emitObjectFile(*partition, targetMachine, path);
+}
+
+std::vector<std::string> emitParallel(llvm::Module &module, const TargetSelection &selection, OptLevel level,
+                                      const ProfileOptions &profile, unsigned jobs, const std::string &outputFile,
+                                      llvm::ThreadPoolInterface &pool) {
+
+  // partitions are handed to the threads as bitcode so each one can be read into its own context
+  std::vector<llvm::SmallVector<char, 0>> partitions;
+
+  // locals are kept with their users so internal functions can still be inlined within a partition
+  llvm::SplitModule(
+      module, jobs,
+      [&](std::unique_ptr<llvm::Module> partition) {
+        llvm::SmallVector<char, 0> &buffer = partitions.emplace_back();
+        llvm::raw_svector_ostream os(buffer);
+        llvm::WriteBitcodeToFile(*partition, os);
+      },
+      true);
+
+  std::vector<std::string> outputs;
+  for (unsigned i = 0; i < partitions.size(); ++i)
+    outputs.push_back(getPartitionPath(outputFile, i));
+
+  // reportError exits the whole compiler under the other threads, so the threads only record their errors and the
+  // first one is reported once they are done. the target machines are created up front for the same reason
+  std::vector<std::string> errors(partitions.size());
+  std::vector<std::unique_ptr<llvm::TargetMachine>> targetMachines;
+  for (unsigned i = 0; i < partitions.size(); ++i) {
+    TargetSelection partitionSelection = selection;
+    targetMachines.push_back(createTargetMachine(partitionSelection, level));
+  }
+
+  for (unsigned i = 0; i < partitions.size(); ++i) {
+    pool.async([&, i] {
+      llvm::LLVMContext context;
+
+      llvm::StringRef bitcode(partitions[i].data(), partitions[i].size());
+      auto partition = llvm::parseBitcodeFile(llvm::MemoryBufferRef(bitcode, "partition"), context);
+
+      if (!partition) {
+        errors[i] =
+            "Could not read module partition " + std::to_string(i) + ": " + llvm::toString(partition.takeError());
+        return;
+      }
+
+      optimizeModule(**partition, targetMachines[i].get(), level, LTOMode::None, profile);
+      auto message =
+          writeObjectFile(**partition, *targetMachines[i], outputs[i], llvm::CodeGenFileType::ObjectFile);
+      if (message)
+        errors[i] = *message;
+    });
+  }
+
+  pool.wait();
+
+  for (const auto &message : errors) {
+    if (!message.empty()) {
+      error::reportError(error::ErrorType::Internal, message);
+    }
+  }
+
+  return outputs;
+}
+
+} // namespace axen::driver
@@ -0,0 +1,92 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/TargetProcess/TargetExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/SubtargetFeature.h>
+
+#include "driver.hpp"
+#include "error.hpp"
+
+namespace axen::driver {
+
+static void reportJITError(llvm::Error err, const std::string &what) {
+  error::reportError(error::ErrorType::Internal, what + ": " + llvm::toString(std::move(err)));
+}
+
+template <typename T> static T unwrap(llvm::Expected<T> value, const std::string &what) {
+  if (!value)
+    reportJITError(value.takeError(), what);
+  return std::move(*value);
+}
+
+int runModule(llvm::Module &module, const TargetSelection &selection, OptLevel level, bool lazy,
+              const std::vector<std::string> &args) {
+
+  // the jit owns the context of its modules, so the module moves over as bitcode the same way partitions are handed
+  // to codegen threads
+  llvm::SmallVector<char, 0> buffer;
+  llvm::raw_svector_ostream os(buffer);
+  llvm::WriteBitcodeToFile(module, os);
+
+  auto context = std::make_unique<llvm::LLVMContext>();
+  llvm::StringRef bitcode(buffer.data(), buffer.size());
+  auto jitModule = unwrap(llvm::parseBitcodeFile(llvm::MemoryBufferRef(bitcode, module.getModuleIdentifier()), *context),
+                          "Could not hand the module to the jit");
+
+  llvm::orc::ThreadSafeModule threadSafeModule(std::move(jitModule), std::move(context));
+
+  // the host triple with the selected cpu and features, functions carry their own target attributes on top
+  auto machineBuilder = unwrap(llvm::orc::JITTargetMachineBuilder::detectHost(), "Could not detect the host target");
+  machineBuilder.setCPU(selection.cpu);
+  machineBuilder.getFeatures() = llvm::SubtargetFeatures(selection.features);
+  machineBuilder.setCodeGenOptLevel(toCodeGenOptLevel(level));
+
+  // process symbols are linked into the main dylib, so bodyless functions bind to libc and anything else the
+  // compiler itself links against
+  std::unique_ptr<llvm::orc::LLJIT> jit;
+  if (lazy) {
+    // each function is only compiled on its first call, through a stub that is patched once it has been compiled
+    auto lazyJIT = unwrap(llvm::orc::LLLazyJITBuilder()
+                              .setJITTargetMachineBuilder(std::move(machineBuilder))
+                              .setLinkProcessSymbolsByDefault(true)
+                              .create(),
+                          "Could not create the jit");
+
+    if (auto err = lazyJIT->addLazyIRModule(std::move(threadSafeModule)))
+      reportJITError(std::move(err), "Could not add the module to the jit");
+
+    jit = std::move(lazyJIT);
+  } else {
+    jit = unwrap(llvm::orc::LLJITBuilder()
+                     .setJITTargetMachineBuilder(std::move(machineBuilder))
+                     .setLinkProcessSymbolsByDefault(true)
+                     .create(),
+                 "Could not create the jit");
+
+    if (auto err = jit->addIRModule(std::move(threadSafeModule)))
+      reportJITError(std::move(err), "Could not add the module to the jit");
+  }
+
+  auto mainSymbol = jit->lookup("main");
+  if (!mainSymbol) {
+    llvm::consumeError(mainSymbol.takeError());
+    error::reportError(error::ErrorType::Codegen, "Cannot run '" + module.getModuleIdentifier() +
+                                                      "', it has no main function");
+  }
+
+  // the program name becomes argv[0], a main without parameters simply ignores argc and argv
+  return llvm::orc::runAsMain(mainSymbol->toPtr<int(int, char *[])>(), args, module.getModuleIdentifier());
+}
+
+} // namespace axen::driver
@@ -0,0 +1,199 @@
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Support/PGOOptions.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/SROA.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+
+#include "driver.hpp"
+
+namespace axen::driver {
+
+bool parseOptLevel(const std::string &arg, OptLevel &level) {
+  if (arg == "-O0") {
+    level = OptLevel::O0;
+  } else if (arg == "-O1") {
+    level = OptLevel::O1;
+  } else if (arg == "-O2" || arg == "-O") {
+    level = OptLevel::O2;
+  } else if (arg == "-O3") {
+    level = OptLevel::O3;
+  } else if (arg == "-Os") {
+    level = OptLevel::Os;
+  } else if (arg == "-Oz") {
+    level = OptLevel::Oz;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool parseEmitKind(const std::string &value, EmitKind &kind) {
+  if (value == "obj") {
+    kind = EmitKind::Object;
+  } else if (value == "asm") {
+    kind = EmitKind::Assembly;
+  } else if (value == "bc") {
+    kind = EmitKind::Bitcode;
+  } else if (value == "ll") {
+    kind = EmitKind::IR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool parseLTOMode(const std::string &value, LTOMode &mode) {
+  if (value == "thin") {
+    mode = LTOMode::Thin;
+  } else if (value == "full") {
+    mode = LTOMode::Full;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+llvm::CodeGenOptLevel toCodeGenOptLevel(OptLevel level) {
+  switch (level) {
+  case OptLevel::O0:
+    return llvm::CodeGenOptLevel::None;
+  case OptLevel::O1:
+    return llvm::CodeGenOptLevel::Less;
+  case OptLevel::O3:
+    return llvm::CodeGenOptLevel::Aggressive;
+  // size levels still want the default backend, size is handled by the ir pipeline
+  case OptLevel::O2:
+  case OptLevel::Os:
+  case OptLevel::Oz:
+  default:
+    return llvm::CodeGenOptLevel::Default;
+  }
+}
+
+static llvm::OptimizationLevel toPassBuilderLevel(OptLevel level) {
+  switch (level) {
+  case OptLevel::O0:
+    return llvm::OptimizationLevel::O0;
+  case OptLevel::O1:
+    return llvm::OptimizationLevel::O1;
+  case OptLevel::O3:
+    return llvm::OptimizationLevel::O3;
+  case OptLevel::Os:
+    return llvm::OptimizationLevel::Os;
+  case OptLevel::Oz:
+    return llvm::OptimizationLevel::Oz;
+  case OptLevel::O2:
+  default:
+    return llvm::OptimizationLevel::O2;
+  }
+}
+
+std::string getProfileGeneratePath(const std::string &dir) {
+  // the default name of clang's '-fprofile-generate', so both languages of a program profile into the same files
+  return (std::filesystem::path(dir) / "default_%m.profraw").string();
+}
+
+static std::optional<llvm::PGOOptions> getPGOOptions(const ProfileOptions &profile) {
+  // the pipeline inserts the counters or reads the profile itself, at every level and for lto pre-linking as well
+  if (!profile.generatePath.empty()) {
+    return llvm::PGOOptions(profile.generatePath, "", "", "", nullptr, llvm::PGOOptions::IRInstr);
+  }
+  if (!profile.usePath.empty()) {
+    return llvm::PGOOptions(profile.usePath, "", "", "", llvm::vfs::getRealFileSystem(), llvm::PGOOptions::IRUse);
+  }
+  return std::nullopt;
+}
+
+void optimizeModule(llvm::Module &module, llvm::TargetMachine *targetMachine, OptLevel level, LTOMode lto,
+                    const ProfileOptions &profile) {
+  // analysis managers must be declared in this order so they are destroyed in reverse
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+
+  // standard instrumentation is what times the passes for -ftime-report and traces them for -ftime-trace
+  llvm::PassInstrumentationCallbacks PIC;
+  llvm::StandardInstrumentations SI(module.getContext(), false);
+  SI.registerCallbacks(PIC, &MAM);
+
+  llvm::PassBuilder PB(targetMachine, llvm::PipelineTuningOptions(), getPGOOptions(profile), &PIC);
+
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  llvm::OptimizationLevel passLevel = toPassBuilderLevel(level);
+
+  llvm::ModulePassManager MPM;
+  if (level == OptLevel::O0) {
+    llvm::ThinOrFullLTOPhase phase = lto == LTOMode::Thin   ? llvm::ThinOrFullLTOPhase::ThinLTOPreLink
+                                     : lto == LTOMode::Full ? llvm::ThinOrFullLTOPhase::FullLTOPreLink
+                                                            : llvm::ThinOrFullLTOPhase::None;
+    MPM = PB.buildO0DefaultPipeline(passLevel, phase);
+  } else if (lto == LTOMode::Thin) {
+    MPM = PB.buildThinLTOPreLinkDefaultPipeline(passLevel);
+  } else if (lto == LTOMode::Full) {
+    MPM = PB.buildLTOPreLinkDefaultPipeline(passLevel);
+  } else {
+    MPM = PB.buildPerModuleDefaultPipeline(passLevel);
+  }
+
+  MPM.run(module, MAM);
+}
+
+struct FunctionOptimizer::Pipeline {
+  // the analyses are created by the pass builder on first use, so it has to outlive the managers
+  llvm::PassBuilder PB;
+
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+
+  llvm::FunctionPassManager FPM;
+
+  explicit Pipeline(llvm::TargetMachine *targetMachine) : PB(targetMachine) {}
+};
+
+FunctionOptimizer::FunctionOptimizer(llvm::TargetMachine *targetMachine)
+    : pipeline_(std::make_unique<Pipeline>(targetMachine)) {
+  llvm::PassBuilder &PB = pipeline_->PB;
+  PB.registerModuleAnalyses(pipeline_->MAM);
+  PB.registerCGSCCAnalyses(pipeline_->CGAM);
+  PB.registerFunctionAnalyses(pipeline_->FAM);
+  PB.registerLoopAnalyses(pipeline_->LAM);
+  PB.crossRegisterProxies(pipeline_->LAM, pipeline_->FAM, pipeline_->CGAM, pipeline_->MAM);
+
+  // the start of the default function simplification pipeline, everything that needs callers or callees waits for
+  // the module pipeline
+  pipeline_->FPM.addPass(llvm::SROAPass(llvm::SROAOptions::ModifyCFG));
+  pipeline_->FPM.addPass(llvm::EarlyCSEPass(true));
+  pipeline_->FPM.addPass(llvm::SimplifyCFGPass());
+  pipeline_->FPM.addPass(llvm::InstCombinePass());
+}
+
+FunctionOptimizer::~FunctionOptimizer() = default;
+
+void FunctionOptimizer::run(llvm::Function &function) {
+  pipeline_->FPM.run(function, pipeline_->FAM);
+
+  // nothing looks at the function again before the module pipeline, which computes its analyses anew
+  pipeline_->FAM.clear(function, function.getName());
+}
+
+} // namespace axen::driver
@@ -0,0 +1,404 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "driver.hpp"
+#include "error.hpp"
+#include "parser.hpp"
+
+// a request is one byte carrying the standard streams of the client, followed by the length of the request and the
+// working directory and arguments of the client as length prefixed strings. the server answers with the exit code of
+// the compilation once it is done.
+namespace axen::driver {
+
+namespace {
+
+constexpr int streamCount = 3;
+
+// far above the command lines execve accepts, a larger request is not one of ours
+constexpr uint32_t maxRequestSize = 16 << 20;
+
+// a client that connects and then stalls only holds up the child serving it, and only this long
+constexpr time_t requestTimeoutSeconds = 30;
+
+bool writeAll(int fd, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t written = ::send(fd, bytes, size, MSG_NOSIGNAL);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool readAll(int fd, void *data, size_t size) {
+  char *bytes = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t read = ::read(fd, bytes, size);
+    if (read < 0 && errno == EINTR)
+      continue;
+    if (read <= 0)
+      return false;
+    bytes += read;
+    size -= read;
+  }
+  return true;
+}
+
+void appendString(std::string &request, const std::string &value) {
+  uint32_t size = value.size();
+  request.append(reinterpret_cast<const char *>(&size), sizeof(size));
+  request += value;
+}
+
+bool readString(const std::string &request, size_t &offset, std::string &value) {
+  uint32_t size;
+  if (offset + sizeof(size) > request.size())
+    return false;
+  std::memcpy(&size, request.data() + offset, sizeof(size));
+  offset += sizeof(size);
+
+  if (offset + size > request.size())
+    return false;
+  value = request.substr(offset, size);
+  offset += size;
+  return true;
+}
+
+sockaddr_un getAddress(const std::string &socketPath) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    error::reportError(error::ErrorType::Internal, "Socket path is too long: '" + socketPath + "'");
+  }
+
+  std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+  return address;
+}
+
+// a request that was read completely, along with the streams it came with
+struct Request {
+  int streams[streamCount];
+  std::string workingDirectory;
+  std::vector<std::string> args;
+};
+
+std::optional<Request> receiveRequest(int connection) {
+  Request request;
+
+  char tag;
+  iovec data{&tag, sizeof(tag)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(request.streams))];
+
+  msghdr message{};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  if (::recvmsg(connection, &message, 0) != sizeof(tag))
+    return std::nullopt;
+
+  cmsghdr *header = CMSG_FIRSTHDR(&message);
+  if (!header || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(sizeof(request.streams)))
+    return std::nullopt;
+  std::memcpy(request.streams, CMSG_DATA(header), sizeof(request.streams));
+
+  auto closeStreams = [&] {
+    for (int stream : request.streams)
+      ::close(stream);
+  };
+
+  uint32_t size;
+  std::string body;
+  if (!readAll(connection, &size, sizeof(size)) || size > maxRequestSize) {
+    closeStreams();
+    return std::nullopt;
+  }
+  body.resize(size);
+
+  size_t offset = 0;
+  uint32_t argCount;
+  if (!readAll(connection, body.data(), size) || !readString(body, offset, request.workingDirectory) ||
+      offset + sizeof(argCount) > body.size()) {
+    closeStreams();
+    return std::nullopt;
+  }
+
+  std::memcpy(&argCount, body.data() + offset, sizeof(argCount));
+  offset += sizeof(argCount);
+  for (uint32_t i = 0; i < argCount; i++) {
+    if (!readString(body, offset, request.args.emplace_back())) {
+      closeStreams();
+      return std::nullopt;
+    }
+  }
+
+  return request;
+}
+
+// anyone who can compile on the server can write files as the user running it, so only that user may
+bool isServerUser(int connection) {
+#ifdef SO_PEERCRED
+  ucred credentials{};
+  socklen_t length = sizeof(credentials);
+  if (::getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+    return false;
+  return credentials.uid == ::geteuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  if (::getpeereid(connection, &uid, &gid) != 0)
+    return false;
+  return uid == ::geteuid();
+#endif
+}
+
+// written to from the atexit handler of a child, which has no other way to find it
+int missesPipe = -1;
+
+void reportMisses() {
+  std::string misses;
+  for (const auto &path : parser::InterfaceCache::takeMisses())
+    misses += path + "\n";
+  if (!misses.empty() && ::write(missesPipe, misses.data(), misses.size()) < 0) {
+    // the server only misses out on caching these
+  }
+  ::close(missesPipe);
+}
+
+// a compilation running in a child of the server
+struct Child {
+  pid_t pid;
+  int connection;
+
+  // the interface files the child read, the server caches them for the children that come after it
+  std::string misses;
+};
+
+[[noreturn]] void runChild(int connection, int missesWriter, const std::function<int(int, char **)> &compile) {
+  // the request is read here rather than by the server, which keeps accepting while this waits for it
+  timeval timeout{requestTimeoutSeconds, 0};
+  ::setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::optional<Request> request = receiveRequest(connection);
+  ::close(connection);
+  if (!request)
+    std::exit(EXIT_FAILURE);
+
+  for (int i = 0; i < streamCount; i++) {
+    ::dup2(request->streams[i], i);
+    ::close(request->streams[i]);
+  }
+
+  // errors exit without returning here, the handler still reports what the child read so far
+  missesPipe = missesWriter;
+  std::atexit(reportMisses);
+
+  std::error_code EC;
+  std::filesystem::current_path(request->workingDirectory, EC);
+  if (EC) {
+    error::reportError(error::ErrorType::Internal,
+                       "Could not enter '" + request->workingDirectory + "': " + EC.message());
+  }
+
+  std::vector<char *> argv;
+  for (auto &arg : request->args)
+    argv.push_back(arg.data());
+  argv.push_back(nullptr);
+
+  std::exit(compile(static_cast<int>(argv.size() - 1), argv.data()));
+}
+
+} // namespace
+
+void runServer(const std::string &socketPath, const std::function<int(int, char **)> &compile) {
+  sockaddr_un address = getAddress(socketPath);
+
+  int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    error::reportError(error::ErrorType::Internal, "Could not create socket: " + std::string(std::strerror(errno)));
+  }
+
+  // a socket left behind by a server that was killed would fail the bind, anything else at the path is not ours
+  struct stat existing;
+  if (::lstat(socketPath.c_str(), &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode)) {
+      error::reportError(error::ErrorType::Internal, "'" + socketPath + "' exists and is not a socket");
+    }
+    ::unlink(socketPath.c_str());
+  }
+
+  // the socket is created accessible to the user running the server alone
+  mode_t mask = ::umask(0177);
+  bool bound = ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+  ::umask(mask);
+
+  if (!bound || ::listen(listener, 64) != 0) {
+    error::reportError(error::ErrorType::Internal,
+                       "Could not listen on '" + socketPath + "': " + std::strerror(errno));
+  }
+
+  // children by the read end of their pipe, which closes once the child exits
+  std::map<int, Child> children;
+
+  while (true) {
+    std::vector<pollfd> polled{{listener, POLLIN, 0}};
+    for (const auto &[pipe, child] : children)
+      polled.push_back({pipe, POLLIN, 0});
+
+    if (::poll(polled.data(), polled.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      error::reportError(error::ErrorType::Internal,
+                         "Could not wait for requests: " + std::string(std::strerror(errno)));
+    }
+
+    for (size_t i = 1; i < polled.size(); i++) {
+      if (!polled[i].revents)
+        continue;
+
+      Child &child = children.at(polled[i].fd);
+      char buffer[4096];
+      ssize_t read = ::read(polled[i].fd, buffer, sizeof(buffer));
+      if (read > 0) {
+        child.misses.append(buffer, read);
+        continue;
+      }
+      if (read < 0 && errno == EINTR)
+        continue;
+
+      int status = 0;
+      while (::waitpid(child.pid, &status, 0) < 0 && errno == EINTR) {
+      }
+      int32_t exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+      writeAll(child.connection, &exitCode, sizeof(exitCode));
+      ::close(child.connection);
+
+      // reading them here puts them in the cache every later child inherits
+      size_t start = 0;
+      for (size_t end; (end = child.misses.find('\n', start)) != std::string::npos; start = end + 1)
+        parser::InterfaceCache::read(child.misses.substr(start, end - start));
+      parser::InterfaceCache::takeMisses();
+
+      ::close(polled[i].fd);
+      children.erase(polled[i].fd);
+    }
+
+    if (!(polled[0].revents & POLLIN))
+      continue;
+
+    int connection = ::accept(listener, nullptr, nullptr);
+    if (connection < 0)
+      continue;
+
+    if (!isServerUser(connection)) {
+      ::close(connection);
+      continue;
+    }
+
+    int pipe[2];
+    if (::pipe(pipe) != 0) {
+      ::close(connection);
+      continue;
+    }
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      ::close(listener);
+      ::close(pipe[0]);
+      for (const auto &[childPipe, child] : children) {
+        ::close(childPipe);
+        ::close(child.connection);
+      }
+      runChild(connection, pipe[1], compile);
+    }
+
+    ::close(pipe[1]);
+
+    if (pid < 0) {
+      int32_t exitCode = EXIT_FAILURE;
+      writeAll(connection, &exitCode, sizeof(exitCode));
+      ::close(connection);
+      ::close(pipe[0]);
+      continue;
+    }
+
+    children.emplace(pipe[0], Child{pid, connection, ""});
+  }
+}
+
+std::optional<int> compileOnServer(const std::string &socketPath, const std::vector<std::string> &args) {
+  sockaddr_un address = getAddress(socketPath);
+
+  int connection = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0)
+    return std::nullopt;
+
+  if (::connect(connection, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+    ::close(connection);
+    return std::nullopt;
+  }
+
+  std::error_code EC;
+  std::string body;
+  appendString(body, std::filesystem::current_path(EC).string());
+
+  uint32_t argCount = args.size();
+  body.append(reinterpret_cast<const char *>(&argCount), sizeof(argCount));
+  for (const auto &arg : args)
+    appendString(body, arg);
+
+  // the child compiling the request writes straight to the streams of this process
+  int streams[streamCount] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  char tag = 0;
+  iovec data{&tag, sizeof(tag)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(streams))] = {};
+
+  msghdr message{};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(streams));
+  std::memcpy(CMSG_DATA(header), streams, sizeof(streams));
+
+  uint32_t size = body.size();
+  int32_t exitCode;
+  bool answered = ::sendmsg(connection, &message, MSG_NOSIGNAL) == sizeof(tag) &&
+                  writeAll(connection, &size, sizeof(size)) && writeAll(connection, body.data(), body.size()) &&
+                  readAll(connection, &exitCode, sizeof(exitCode));
+  ::close(connection);
+
+  // a server that went away mid request has compiled nothing anyone can rely on
+  if (!answered) {
+    error::reportError(error::ErrorType::Internal, "The compile server at '" + socketPath + "' did not answer");
+  }
+
+  return exitCode;
+}
+
+} // namespace axen::driver
@@ -0,0 +1,174 @@
+#include <cstdint>
+#include <string>
+#include <sys/resource.h>
+#include <utility>
+
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "driver.hpp"
+
+namespace axen::driver {
+
+// the same granularity clang uses, shorter events only add noise to the trace
+static constexpr unsigned traceGranularityMicroseconds = 500;
+
+static uint64_t getPeakResidentBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+#if defined(__APPLE__)
+  return usage.ru_maxrss;
+#else
+  // kilobytes everywhere but darwin
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+bool parseStatsFormat(const std::string &value, StatsFormat &format) {
+  if (value == "text") {
+    format = StatsFormat::Text;
+  } else if (value == "json") {
+    format = StatsFormat::Json;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+CompileStats::CompileStats(bool timeReport, std::string traceFile, StatsFormat format, std::string statsFile)
+    : timeReport_(timeReport), traceFile_(std::move(traceFile)), format_(format), statsFile_(std::move(statsFile)),
+      timerGroup_("axenc", "Compilation phases") {
+
+  // the optimizer and the backend time their passes on their own once this is set
+  llvm::TimePassesIsEnabled = timeReport_;
+
+  if (!traceFile_.empty())
+    llvm::timeTraceProfilerInitialize(traceGranularityMicroseconds, "axenc");
+}
+
+CompileStats::~CompileStats() {
+  if (!traceFile_.empty()) {
+    if (auto err = llvm::timeTraceProfilerWrite(traceFile_, traceFile_)) {
+      llvm::errs() << "Could not write time trace '" << traceFile_ << "': " << llvm::toString(std::move(err)) << "\n";
+    }
+    llvm::timeTraceProfilerCleanup();
+  }
+
+  if (format_ != StatsFormat::None) {
+    count("peak-rss-bytes", getPeakResidentBytes());
+
+    std::error_code EC;
+    std::unique_ptr<llvm::raw_fd_ostream> file;
+    if (!statsFile_.empty()) {
+      file = std::make_unique<llvm::raw_fd_ostream>(statsFile_, EC, llvm::sys::fs::OF_Text);
+      if (EC)
+        llvm::errs() << "Could not open stats file '" << statsFile_ << "': " << EC.message() << "\n";
+    }
+
+    llvm::raw_ostream &os = file && !EC ? *file : llvm::errs();
+    if (format_ == StatsFormat::Json)
+      printJson(os);
+    else
+      printText(os);
+  }
+
+  // a group prints the timers it still holds when it is destroyed, so without a report they are cleared first
+  if (timeReport_) {
+    timerGroup_.print(llvm::errs(), true);
+
+    if (!importTimes_.empty()) {
+      llvm::errs() << "===" << std::string(73, '-') << "===\n";
+      llvm::errs() << "  Import times, each including the files it imports\n";
+      llvm::errs() << "===" << std::string(73, '-') << "===\n";
+      for (const auto &[file, seconds] : importTimes_)
+        llvm::errs() << llvm::format("  %10.4f  ", seconds) << file << "\n";
+      llvm::errs() << "\n";
+    }
+  } else {
+    timerGroup_.clear();
+  }
+}
+
+CompileStats::Phase CompileStats::phase(llvm::StringRef name) {
+  llvm::Timer *&timer = timersByName_[name];
+  if (!timer) {
+    timer = timers_.emplace_back(std::make_unique<llvm::Timer>(name, name, timerGroup_)).get();
+  }
+  return Phase(*timer, name);
+}
+
+void CompileStats::count(llvm::StringRef name, uint64_t value) {
+  for (auto &counter : counters_) {
+    if (counter.first == name) {
+      counter.second += value;
+      return;
+    }
+  }
+  counters_.emplace_back(name.str(), value);
+}
+
+void CompileStats::countModule(const llvm::Module &module, llvm::StringRef suffix) {
+  uint64_t functions = 0, declarations = 0, instructions = 0;
+  for (const llvm::Function &function : module) {
+    if (function.isDeclaration()) {
+      declarations++;
+      continue;
+    }
+    functions++;
+    instructions += function.getInstructionCount();
+  }
+
+  count(("functions" + suffix).str(), functions);
+  count(("declarations" + suffix).str(), declarations);
+  count(("instructions" + suffix).str(), instructions);
+}
+
+void CompileStats::printText(llvm::raw_ostream &os) {
+  for (const auto &timer : timers_)
+    os << llvm::format("%12.6f s  ", timer->getTotalTime().getWallTime()) << timer->getName() << "\n";
+  for (const auto &[file, seconds] : importTimes_)
+    os << llvm::format("%12.6f s  ", seconds) << "import " << file << "\n";
+  for (const auto &[name, value] : counters_)
+    os << llvm::format("%14llu  ", static_cast<unsigned long long>(value)) << name << "\n";
+}
+
+void CompileStats::printJson(llvm::raw_ostream &os) {
+  llvm::json::OStream json(os, 2);
+
+  json.object([&] {
+    json.attributeArray("phases", [&] {
+      for (const auto &timer : timers_) {
+        const llvm::TimeRecord &time = timer->getTotalTime();
+        json.object([&] {
+          json.attribute("name", timer->getName());
+          json.attribute("wall", time.getWallTime());
+          json.attribute("user", time.getUserTime());
+          json.attribute("system", time.getSystemTime());
+        });
+      }
+    });
+
+    json.attributeArray("imports", [&] {
+      for (const auto &[file, seconds] : importTimes_) {
+        json.object([&] {
+          json.attribute("file", file);
+          json.attribute("wall", seconds);
+        });
+      }
+    });
+
+    json.attributeObject("counters", [&] {
+      for (const auto &[name, value] : counters_)
+        json.attribute(name, static_cast<int64_t>(value));
+    });
+  });
+
+  os << "\n";
+}
+
+} // namespace axen::driver
@@ -0,0 +1,174 @@
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/TargetParser/Host.h>
+#include <llvm/TargetParser/Triple.h>
+
+#include "driver.hpp"
+#include "error.hpp"
+
+namespace axen::driver {
+
+static std::string getHostFeatures() {
+  std::string features;
+  for (const auto &feature : llvm::sys::getHostCPUFeatures()) {
+    if (!features.empty())
+      features += ",";
+    features += (feature.second ? "+" : "-") + feature.first().str();
+  }
+  return features;
+}
+
+namespace {
+
+// one backend llvm was built with, named like its directory under llvm/lib/Target
+struct Backend {
+  const char *name;
+  void (*initializeTargetInfo)();
+  void (*initializeTarget)();
+  void (*initializeTargetMC)();
+};
+
+const Backend backends[] = {
+#define LLVM_TARGET(TargetName)                                                                                        \
+  {#TargetName, LLVMInitialize##TargetName##TargetInfo, LLVMInitialize##TargetName##Target,                           \
+   LLVMInitialize##TargetName##TargetMC},
+#include <llvm/Config/Targets.def>
+};
+
+const std::pair<const char *, void (*)()> asmPrinters[] = {
+#define LLVM_ASM_PRINTER(TargetName) {#TargetName, LLVMInitialize##TargetName##AsmPrinter},
+#include <llvm/Config/AsmPrinters.def>
+};
+
+const std::pair<const char *, void (*)()> asmParsers[] = {
+#define LLVM_ASM_PARSER(TargetName) {#TargetName, LLVMInitialize##TargetName##AsmParser},
+#include <llvm/Config/AsmParsers.def>
+};
+
+// target machines are also created from codegen threads, the registry must only be changed by one of them at a time
+std::mutex registryMutex;
+
+// a target machine kept for the next compilation with the same selection and level
+struct KeptTargetMachine {
+  TargetSelection requested;
+  TargetSelection resolved;
+  OptLevel level;
+  std::unique_ptr<llvm::TargetMachine> targetMachine;
+};
+
+std::optional<KeptTargetMachine> keptTargetMachine;
+
+bool operator==(const TargetSelection &a, const TargetSelection &b) {
+  return a.triple == b.triple && a.cpu == b.cpu && a.features == b.features;
+}
+
+void initializeBackend(const Backend &backend) {
+  backend.initializeTarget();
+  backend.initializeTargetMC();
+
+  for (const auto &[name, initialize] : asmPrinters) {
+    if (llvm::StringRef(name) == backend.name)
+      initialize();
+  }
+  for (const auto &[name, initialize] : asmParsers) {
+    if (llvm::StringRef(name) == backend.name)
+      initialize();
+  }
+}
+
+// target infos only register names and triple matchers, which is cheap, so all of them are registered to look up
+// triples. registering them one backend at a time tells which backend provides which target. every other part of a
+// backend is only registered once a target machine for it is created, most compilations need just one of them.
+const std::map<const llvm::Target *, const Backend *> &registerTargetInfos() {
+  static const std::map<const llvm::Target *, const Backend *> backendsByTarget = [] {
+    std::map<const llvm::Target *, const Backend *> byTarget;
+    for (const auto &backend : backends) {
+      backend.initializeTargetInfo();
+      for (const auto &registered : llvm::TargetRegistry::targets())
+        byTarget.emplace(&registered, &backend);
+    }
+    return byTarget;
+  }();
+  return backendsByTarget;
+}
+
+const llvm::Target *lookupTarget(const std::string &triple) {
+  const auto &backendsByTarget = registerTargetInfos();
+
+  std::string error;
+  auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+
+  if (!target) {
+    error::reportError(error::ErrorType::Internal, "Could not find target '" + triple + "': " + error);
+  }
+
+  static llvm::StringMap<bool> initialized;
+  auto backend = backendsByTarget.find(target);
+  if (backend != backendsByTarget.end() && !initialized[backend->second->name]) {
+    initializeBackend(*backend->second);
+    initialized[backend->second->name] = true;
+  }
+
+  return target;
+}
+
+} // namespace
+
+void keepTargetMachine(const TargetSelection &selection, OptLevel level) {
+  TargetSelection resolved = selection;
+  auto targetMachine = createTargetMachine(resolved, level);
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  keptTargetMachine = KeptTargetMachine{selection, resolved, level, std::move(targetMachine)};
+}
+
+std::unique_ptr<llvm::TargetMachine> createTargetMachine(TargetSelection &selection, OptLevel level) {
+  std::lock_guard<std::mutex> lock(registryMutex);
+
+  // only the first compilation takes the kept machine, codegen threads still need one each
+  if (keptTargetMachine && keptTargetMachine->level == level && keptTargetMachine->requested == selection) {
+    selection = keptTargetMachine->resolved;
+    auto targetMachine = std::move(keptTargetMachine->targetMachine);
+    keptTargetMachine.reset();
+    return targetMachine;
+  }
+
+  if (selection.triple.empty())
+    selection.triple = llvm::sys::getDefaultTargetTriple();
+
+  llvm::Triple triple(llvm::Triple::normalize(selection.triple));
+  selection.triple = triple.str();
+
+  if (selection.cpu == "native") {
+    selection.cpu = llvm::sys::getHostCPUName().str();
+
+    // explicit -mattr entries are appended so they override the host features
+    std::string hostFeatures = getHostFeatures();
+    selection.features = selection.features.empty() ? hostFeatures : hostFeatures + "," + selection.features;
+  }
+
+  auto target = lookupTarget(selection.triple);
+
+  llvm::TargetOptions opt;
+  auto RM = std::optional<llvm::Reloc::Model>(llvm::Reloc::PIC_);
+  auto targetMachine = std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+      triple, selection.cpu, selection.features, opt, RM, std::nullopt, toCodeGenOptLevel(level)));
+
+  if (!targetMachine) {
+    error::reportError(error::ErrorType::Internal, "Could not create target machine for '" + selection.triple + "'");
+  }
+
+  return targetMachine;
+}
+
+} // namespace axen::driver
@@ -1,180 +1,478 @@
-#include <cstdio>
-#include <cstdlib>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include "lexer.hpp"
 
 namespace axen::lexer {
 
-Lexer::Lexer(std::string src) : src_(std::move(src)) {}
+namespace {
+
+// character classes, a char may belong to several classes
+enum CharClass : uint8_t {
+  Space = 1 << 0,
+  Digit = 1 << 1,
+  HexDigit = 1 << 2,
+  IdentStart = 1 << 3,
+  IdentBody = 1 << 4,
+  Symbol = 1 << 5,
+};
+
+// locale independent replacement for the <cctype> functions
+constexpr std::array<uint8_t, 256> charClasses = [] {
+  std::array<uint8_t, 256> table{};
+
+  for (char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+    table[static_cast<unsigned char>(c)] |= Space;
+
+  for (int c = '0'; c <= '9'; c++)
+    table[c] |= Digit | HexDigit | IdentBody;
+
+  for (int c = 'a'; c <= 'z'; c++)
+    table[c] |= IdentStart | IdentBody;
+
+  for (int c = 'A'; c <= 'Z'; c++)
+    table[c] |= IdentStart | IdentBody;
+
+  for (int c = 'a'; c <= 'f'; c++)
+    table[c] |= HexDigit;
+
+  for (int c = 'A'; c <= 'F'; c++)
+    table[c] |= HexDigit;
+
+  table['_'] |= IdentStart | IdentBody;
+
+  for (const auto &[c, type] : symbolList)
+    table[static_cast<unsigned char>(c)] |= Symbol;
+
+  return table;
+}();
+
+constexpr std::array<TokenType, 256> symbolTypes = [] {
+  std::array<TokenType, 256> table{};
+  table.fill(TokenType::EndOfFile);
+
+  for (const auto &[c, type] : symbolList)
+    table[static_cast<unsigned char>(c)] = type;
+
+  return table;
+}();
+
+inline bool is(char c, uint8_t classes) { return charClasses[static_cast<unsigned char>(c)] & classes; }
+
+// keywords are found with a perfect hash over the first char, last char and length
+constexpr size_t keywordTableSize = 64;
+
+constexpr size_t keywordHash(std::string_view word) {
+  return (static_cast<unsigned char>(word.front()) * 3 + static_cast<unsigned char>(word.back()) * 3 + word.size()) %
+         keywordTableSize;
+}
+
+constexpr std::array<std::pair<std::string_view, TokenType>, keywordTableSize> keywordTable = [] {
+  std::array<std::pair<std::string_view, TokenType>, keywordTableSize> table{};
+
+  for (const auto &keyword : keywordList)
+    table[keywordHash(keyword.first)] = keyword;
+
+  return table;
+}();
+
+constexpr bool keywordHashIsPerfect() {
+  for (const auto &keyword : keywordList)
+    if (keywordTable[keywordHash(keyword.first)].first != keyword.first)
+      return false;
+  return true;
+}
+
+static_assert(keywordHashIsPerfect(), "keyword hash has a collision, change its multipliers or the table size");
+
+TokenType lookupIdentifier(std::string_view word) {
+  const auto &entry = keywordTable[keywordHash(word)];
+  return entry.first == word ? entry.second : TokenType::Identifier;
+}
+
+/*
+ * block scanners return a mask with bit i set when byte i of the block matches. the scalar paths in Lexer handle
+ * whatever is left once fewer than simdWidth bytes remain.
+ */
+#if defined(__AVX2__)
+constexpr size_t simdWidth = 32;
+
+using Block = __m256i;
+
+inline Block loadBlock(const char *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+
+inline uint64_t toMask(Block matches) { return static_cast<uint32_t>(_mm256_movemask_epi8(matches)); }
+
+inline Block equals(Block block, char c) { return _mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)); }
+
+// unsigned lo <= c <= hi
+inline Block inRange(Block block, char lo, char hi) {
+  Block offset = _mm256_sub_epi8(block, _mm256_set1_epi8(lo));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(hi - lo)), offset);
+}
+
+inline Block either(Block a, Block b) { return _mm256_or_si256(a, b); }
+
+inline Block lower(Block block) { return _mm256_or_si256(block, _mm256_set1_epi8(0x20)); }
+
+#elif defined(__SSE2__)
+constexpr size_t simdWidth = 16;
+
+using Block = __m128i;
+
+inline Block loadBlock(const char *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+
+inline uint64_t toMask(Block matches) { return static_cast<uint32_t>(_mm_movemask_epi8(matches)); }
+
+inline Block equals(Block block, char c) { return _mm_cmpeq_epi8(block, _mm_set1_epi8(c)); }
+
+inline Block inRange(Block block, char lo, char hi) {
+  Block offset = _mm_sub_epi8(block, _mm_set1_epi8(lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(hi - lo)), offset);
+}
+
+inline Block either(Block a, Block b) { return _mm_or_si128(a, b); }
+
+inline Block lower(Block block) { return _mm_or_si128(block, _mm_set1_epi8(0x20)); }
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+constexpr size_t simdWidth = 16;
+
+using Block = uint8x16_t;
+
+inline Block loadBlock(const char *p) { return vld1q_u8(reinterpret_cast<const uint8_t *>(p)); }
+
+// neon has no movemask, weight each lane by its bit and add the halves horizontally
+inline uint64_t toMask(Block matches) {
+  static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t bits = vandq_u8(matches, vld1q_u8(weights));
+  return vaddv_u8(vget_low_u8(bits)) | (static_cast<uint64_t>(vaddv_u8(vget_high_u8(bits))) << 8);
+}
 
-Token Lexer::peek(unsigned int offset) {
-  while (lookAhead_.size() <= offset) {
-    lookAhead_.push_back(nextToken());
+inline Block equals(Block block, char c) { return vceqq_u8(block, vdupq_n_u8(c)); }
+
+inline Block inRange(Block block, char lo, char hi) {
+  return vcleq_u8(vsubq_u8(block, vdupq_n_u8(lo)), vdupq_n_u8(hi - lo));
+}
+
+inline Block either(Block a, Block b) { return vorrq_u8(a, b); }
+
+inline Block lower(Block block) { return vorrq_u8(block, vdupq_n_u8(0x20)); }
+
+#else
+#define AXEN_LEXER_SCALAR_ONLY
+#endif
+
+#ifndef AXEN_LEXER_SCALAR_ONLY
+inline uint64_t whitespaceMask(Block block) { return toMask(either(equals(block, ' '), inRange(block, '\t', '\r'))); }
+
+inline uint64_t identBodyMask(Block block) {
+  Block letters = inRange(lower(block), 'a', 'z');
+  return toMask(either(either(letters, inRange(block, '0', '9')), equals(block, '_')));
+}
+
+inline uint64_t digitMask(Block block) { return toMask(inRange(block, '0', '9')); }
+
+inline uint64_t hexDigitMask(Block block) {
+  return toMask(either(inRange(block, '0', '9'), inRange(lower(block), 'a', 'f')));
+}
+
+constexpr uint64_t fullMask = simdWidth == 64 ? ~0ull : (1ull << simdWidth) - 1;
+#endif
+
+} // namespace
+
+std::string unescape(std::string_view raw) {
+  std::string content;
+  content.reserve(raw.size());
+
+  for (size_t i = 0; i < raw.size(); i++) {
+    if (raw[i] != '\\' || i + 1 >= raw.size()) {
+      content += raw[i];
+      continue;
+    }
+
+    char escaped = raw[++i];
+    switch (escaped) {
+    case 'n':
+      content += '\n';
+      break;
+    case 't':
+      content += '\t';
+      break;
+    case '"':
+      content += '"';
+      break;
+    case '\\':
+      content += '\\';
+      break;
+    default:
+      content += escaped;
+      break;
+    }
+  }
+  return content;
+}
+
+Lexer::Lexer(std::string_view src, SymbolTable &symbols) : src_(src), symbols_(&symbols) {}
+
+void Lexer::lexAll() {
+  while (tokens_.empty() || tokens_.back().type != TokenType::EndOfFile)
+    tokens_.push_back(nextToken());
+}
+
+void Lexer::rebindSymbols(SymbolTable &symbols) {
+  lexAll();
+
+  // identifiers repeat throughout a file, so each distinct one is only interned once
+  constexpr axen::Symbol unmapped = std::numeric_limits<axen::Symbol>::max();
+  std::vector<axen::Symbol> rebound(symbols_->size(), unmapped);
+
+  for (Token &token : tokens_) {
+    if (token.type != TokenType::Identifier)
+      continue;
+
+    axen::Symbol &symbol = rebound[token.symbol];
+    if (symbol == unmapped)
+      symbol = symbols.intern(symbols_->name(token.symbol));
+    token.symbol = symbol;
+  }
+
+  symbols_ = &symbols;
+}
+
+const Token &Lexer::peek(unsigned int offset) {
+  size_t index = tokensCursor_ + offset;
+  while (tokens_.size() <= index && (tokens_.empty() || tokens_.back().type != TokenType::EndOfFile)) {
+    tokens_.push_back(nextToken());
   }
-  return lookAhead_[offset];
+  // everything past the end of the file peeks as the end of file token
+  return tokens_[std::min(index, tokens_.size() - 1)];
 }
 
 bool Lexer::peekT(TokenType t, unsigned int offset) { return peek(offset).type == t; }
 
 Token Lexer::consume() {
-  if (lookAhead_.empty()) {
-    lookAhead_.push_back(nextToken());
-  }
-  Token tok = lookAhead_.front();
-  lookAhead_.pop_front();
+  Token tok = peek();
+  if (tok.type != TokenType::EndOfFile)
+    tokensCursor_++;
   return tok;
 }
 
 Token Lexer::nextToken() {
   while (srcCursor_ < src_.size()) {
-    if (peekChar() == '\n' || std::isspace(peekChar())) {
-      consumeChar();
+    char c = src_[srcCursor_];
+
+    if (is(c, Space)) {
+      skipWhitespace();
       continue;
     }
 
-    if (peekChar() == '/' && srcCursor_ + 1 < src_.size()) {
-      if (peekChar(1) == '/') {
-        consumeChar();
-        consumeChar();
-        while (srcCursor_ < src_.size() && peekChar() != '\n') {
-          consumeChar();
-        }
+    if (c == '/' && srcCursor_ + 1 < src_.size()) {
+      if (src_[srcCursor_ + 1] == '/') {
+        skipLineComment();
         continue;
-      } else if (peekChar(1) == '*') {
-        consumeChar();
-        consumeChar();
-        while (srcCursor_ + 1 < src_.size()) {
-          if (peekChar() == '*' && peekChar(1) == '/') {
-            consumeChar();
-            consumeChar();
-            break;
-          }
-          consumeChar();
-        }
+      } else if (src_[srcCursor_ + 1] == '*') {
+        skipBlockComment();
         continue;
       }
     }
 
-    Token newToken = {.type = TokenType::EndOfFile, .src = src_.substr(srcCursor_, 1), .row = row_, .col = col_};
+    int col = static_cast<int>(srcCursor_ - lineStart_) + 1;
+    Token newToken = {.type = TokenType::EndOfFile, .src = src_.substr(srcCursor_, 1), .row = row_, .col = col};
 
-    char c = peekChar();
-    auto it = symbolMap.find(c);
-    if (it != symbolMap.end())
-      newToken.type = it->second;
-
-    if (newToken.type != TokenType::EndOfFile) {
-      consumeChar(); // consume the single char token
+    if (is(c, Symbol)) {
+      newToken.type = symbolTypes[static_cast<unsigned char>(c)];
+      srcCursor_++; // consume the single char token
       return newToken;
     }
 
-    if (std::isdigit(peekChar())) {
-      std::string newIntLiteral;
+    if (is(c, Digit)) {
+      size_t start = srcCursor_;
+      newToken.type = TokenType::IntLit;
 
       // check for hex literal
-      if (peekChar() == '0' && srcCursor_ + 1 < src_.length() && (peekChar(1) == 'x' || peekChar(1) == 'X')) {
-        newIntLiteral += consumeChar();
-        newIntLiteral += consumeChar();
-
-        while (srcCursor_ < src_.length() && std::isxdigit(peekChar())) {
-          newIntLiteral += consumeChar();
-        }
+      if (c == '0' && srcCursor_ + 1 < src_.size() && (src_[srcCursor_ + 1] == 'x' || src_[srcCursor_ + 1] == 'X')) {
+        srcCursor_ += 2;
+        scanDigits(true);
 
-        newToken.type = TokenType::IntLit;
-        newToken.src = std::move(newIntLiteral);
+        newToken.src = src_.substr(start, srcCursor_ - start);
         return newToken;
       }
 
       // regular decimal literal
-      while (srcCursor_ < src_.length() && std::isdigit(peekChar())) {
-        newIntLiteral += consumeChar(); // int literal digits are consumed
-      }
+      scanDigits(false);
 
-      newToken.type = TokenType::IntLit;
-      if (peekChar() == '.') {
-        newIntLiteral += consumeChar();
-        while (srcCursor_ < src_.length() && std::isdigit(peekChar())) {
-          newIntLiteral += consumeChar(); // int literal digits are consumed
+      if (srcCursor_ < src_.size() && src_[srcCursor_] == '.') {
+        srcCursor_++;
+
+        size_t fractionStart = srcCursor_;
+        scanDigits(false);
+        if (srcCursor_ > fractionStart)
           newToken.type = TokenType::FloatLit;
-        }
       }
-      newToken.src = std::move(newIntLiteral);
+      newToken.src = src_.substr(start, srcCursor_ - start);
       return newToken;
     }
 
-    if (peekChar() == '"') {
-      consumeChar(); // consume opening quote
-      std::string stringContent;
-      while (srcCursor_ < src_.length() && peekChar() != '"') {
-        if (peekChar() == '\\' && srcCursor_ + 1 < src_.length()) {
-          consumeChar(); // consume backslash
-          char escaped = consumeChar();
-          switch (escaped) {
-          case 'n':
-            stringContent += '\n';
-            break;
-          case 't':
-            stringContent += '\t';
-            break;
-          case '"':
-            stringContent += '"';
-            break;
-          case '\\':
-            stringContent += '\\';
-            break;
-          default:
-            stringContent += escaped;
-            break;
-          }
-        } else {
-          stringContent += consumeChar();
+    if (c == '"') {
+      srcCursor_++; // consume opening quote
+      size_t start = srcCursor_;
+      while (srcCursor_ < src_.size() && src_[srcCursor_] != '"') {
+        if (src_[srcCursor_] == '\\' && srcCursor_ + 1 < src_.size()) {
+          srcCursor_++; // consume backslash
         }
+        advanceTo(srcCursor_ + 1);
       }
-      if (srcCursor_ >= src_.length()) {
-        fprintf(stderr, "Unterminated string literal.\n");
-        exit(EXIT_FAILURE);
-      }
-      consumeChar(); // consume closing quote
+      if (srcCursor_ >= src_.size())
+        return fail("Unterminated string literal", newToken.row, newToken.col);
       newToken.type = TokenType::StringLit;
-      newToken.src = std::move(stringContent);
+      newToken.src = src_.substr(start, srcCursor_ - start);
+      srcCursor_++; // consume closing quote
       return newToken;
     }
 
-    if (std::isalpha(peekChar()) || peekChar() == '_') {
+    if (is(c, IdentStart)) {
       // can be a keyword or type
-      std::string newKeyword;
-      while (srcCursor_ < src_.length() && (std::isalnum(peekChar()) || peekChar() == '_')) {
-        newKeyword += consumeChar(); // keyword chars are consumed
-      }
-
-      auto it2 = keywordMap.find(newKeyword);
-      if (it2 != keywordMap.end())
-        newToken.type = it2->second;
-      else
-        newToken.type = TokenType::Identifier;
-
-      newToken.src = std::move(newKeyword); // newKeyword is not needed anymore
+      size_t start = srcCursor_;
+      scanIdentifier();
+      newToken.src = src_.substr(start, srcCursor_ - start);
+      newToken.type = lookupIdentifier(newToken.src);
+      if (newToken.type == TokenType::Identifier)
+        newToken.symbol = symbols_->intern(newToken.src);
       return newToken;
     }
-    fprintf(stderr, "Invalid character found during lexing: '%c'.\n", peekChar());
-    exit(EXIT_FAILURE);
+
+    return fail("Invalid character found during lexing: '" + std::string(1, c) + "'", row_, col);
   }
   return {
       .type = TokenType::EndOfFile,
       .src = src_.substr(srcCursor_),
+      .row = row_,
+      .col = static_cast<int>(srcCursor_ - lineStart_) + 1,
   };
 }
 
-char Lexer::peekChar(unsigned int offset) const { return src_.at(srcCursor_ + offset); }
+Token Lexer::fail(std::string message, int row, int col) {
+  error_ = LexError{std::move(message), row, col};
+  advanceTo(src_.size());
+  return nextToken();
+}
+
+void Lexer::skipWhitespace() {
+#ifndef AXEN_LEXER_SCALAR_ONLY
+  while (srcCursor_ + simdWidth <= src_.size()) {
+    Block block = loadBlock(src_.data() + srcCursor_);
+    uint64_t spaces = whitespaceMask(block);
+
+    // number of leading whitespace bytes in this block
+    size_t run = spaces == fullMask ? simdWidth : std::countr_one(spaces);
+
+    uint64_t newlines = toMask(equals(block, '\n')) & ((run == 64 ? ~0ull : (1ull << run) - 1));
+    if (newlines) {
+      row_ += std::popcount(newlines);
+      lineStart_ = srcCursor_ + (63 - std::countl_zero(newlines)) + 1;
+    }
+
+    srcCursor_ += run;
+    if (run < simdWidth)
+      return;
+  }
+#endif
+
+  while (srcCursor_ < src_.size() && is(src_[srcCursor_], Space)) {
+    if (src_[srcCursor_] == '\n') {
+      row_++;
+      lineStart_ = srcCursor_ + 1;
+    }
+    srcCursor_++;
+  }
+}
+
+void Lexer::skipLineComment() {
+  // the newline itself is left for skipWhitespace
+  const void *newline = memchr(src_.data() + srcCursor_, '\n', src_.size() - srcCursor_);
+  srcCursor_ = newline ? static_cast<const char *>(newline) - src_.data() : src_.size();
+}
+
+void Lexer::skipBlockComment() {
+  size_t searchStart = srcCursor_ + 2;
+
+  while (searchStart < src_.size()) {
+    const void *star = memchr(src_.data() + searchStart, '*', src_.size() - searchStart);
+    if (!star)
+      break;
+
+    size_t starPos = static_cast<const char *>(star) - src_.data();
+    if (starPos + 1 < src_.size() && src_[starPos + 1] == '/') {
+      advanceTo(starPos + 2);
+      return;
+    }
+    searchStart = starPos + 1;
+  }
+
+  // unterminated comments run until the end of the file
+  advanceTo(src_.size());
+}
+
+void Lexer::scanIdentifier() {
+#ifndef AXEN_LEXER_SCALAR_ONLY
+  while (srcCursor_ + simdWidth <= src_.size()) {
+    uint64_t body = identBodyMask(loadBlock(src_.data() + srcCursor_));
+    if (body != fullMask) {
+      srcCursor_ += std::countr_one(body);
+      return;
+    }
+    srcCursor_ += simdWidth;
+  }
+#endif
+
+  while (srcCursor_ < src_.size() && is(src_[srcCursor_], IdentBody))
+    srcCursor_++;
+}
+
+void Lexer::scanDigits(bool hex) {
+#ifndef AXEN_LEXER_SCALAR_ONLY
+  while (srcCursor_ + simdWidth <= src_.size()) {
+    Block block = loadBlock(src_.data() + srcCursor_);
+    uint64_t digits = hex ? hexDigitMask(block) : digitMask(block);
+    if (digits != fullMask) {
+      srcCursor_ += std::countr_one(digits);
+      return;
+    }
+    srcCursor_ += simdWidth;
+  }
+#endif
+
+  uint8_t digitClass = hex ? HexDigit : Digit;
+  while (srcCursor_ < src_.size() && is(src_[srcCursor_], digitClass))
+    srcCursor_++;
+}
+
+void Lexer::advanceTo(size_t end) {
+  while (srcCursor_ < end) {
+    const void *newline = memchr(src_.data() + srcCursor_, '\n', end - srcCursor_);
+    if (!newline)
+      break;
 
-char Lexer::consumeChar() {
-  if (peekChar() == '\n') {
     row_++;
-    col_ = 1;
-  } else {
-    col_++;
+    srcCursor_ = static_cast<const char *>(newline) - src_.data() + 1;
+    lineStart_ = srcCursor_;
   }
-  return src_.at(srcCursor_++);
+  srcCursor_ = end;
 }
 } // namespace axen::lexer
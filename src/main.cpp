@@ -1,134 +1,663 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <filesystem>
-#include <fstream>
 #include <memory>
 #include <optional>
-#include <sstream>
+#include <set>
+#include <string>
+#include <vector>
 
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
-#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Verifier.h>
-#include <llvm/MC/TargetRegistry.h>
-#include <llvm/Support/FileSystem.h>
-#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/StringSaver.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
-#include <llvm/Target/TargetOptions.h>
-#include <llvm/TargetParser/Host.h>
+#include <llvm/TargetParser/Triple.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 
+#include "driver.hpp"
 #include "error.hpp"
 #include "nodes/context.hpp"
 #include "parser.hpp"
 
-int main(int argc, char **argv) {
+namespace {
 
-  std::string srcFile = "";
-  std::string outputFile = "";
+// everything the arguments select, every file of a batch is compiled with the same options
+struct Options {
+  axen::driver::OptLevel optLevel = axen::driver::OptLevel::O0;
+  axen::driver::TargetSelection targetSelection;
+  unsigned jobs = 1;
+  std::string cacheDir = "";
+  bool separateImports = false;
+  bool streaming = false;
 
-  for (int i = 1; i < argc; i++) {
-    if (strcmp(argv[i], "-f") == 0 && i < argc) {
-      srcFile = argv[i + 1];
-      i++;
-    } else if (strcmp(argv[i], "-o") == 0 && i < argc) {
-      outputFile = argv[i + 1];
-      i++;
+  // with streaming, the functions generated so far are written to a partition once they hold this many instructions
+  uint64_t flushInstructions = 0;
+  bool emitInterface = false;
+  bool printLayouts = false;
+  bool fastMath = false;
+  bool classArgsByReference = false;
+  axen::ast::Instrumentation instrumentation;
+  axen::driver::EmitKind emitKind = axen::driver::EmitKind::Object;
+  axen::driver::LTOMode ltoMode = axen::driver::LTOMode::None;
+  axen::driver::ProfileOptions profile;
+  bool run = false;
+  bool lazyJIT = false;
+  std::vector<std::string> runArgs;
+};
+
+// parses the comma separated kinds of '-finstrument=<xray|entry-exit|calls>'. returns false if one names no kind
+bool parseInstrumentKinds(llvm::StringRef value, axen::ast::Instrumentation &instrumentation) {
+  llvm::SmallVector<llvm::StringRef, 3> kinds;
+  value.split(kinds, ',');
+
+  for (llvm::StringRef kind : kinds) {
+    if (kind == "xray") {
+      instrumentation.xray = true;
+    } else if (kind == "entry-exit") {
+      instrumentation.entryExit = true;
+    } else if (kind == "calls") {
+      instrumentation.callCounts = true;
     } else {
-      axen::error::reportError(axen::error::ErrorType::Syntax, "Invalid argument: '" + std::string(argv[i]) + "'");
+      return false;
     }
   }
+  return true;
+}
 
-  if (srcFile.empty()) {
-    axen::error::reportError(axen::error::ErrorType::Syntax, "Missing required argument: -f <source file>");
+// the architectures the xray runtime has trampolines for, sleds anywhere else would never be patched
+bool supportsXRay(const llvm::Triple &triple) {
+  switch (triple.getArch()) {
+  case llvm::Triple::x86_64:
+  case llvm::Triple::aarch64:
+  case llvm::Triple::arm:
+  case llvm::Triple::thumb:
+  case llvm::Triple::mips:
+  case llvm::Triple::mipsel:
+  case llvm::Triple::mips64:
+  case llvm::Triple::mips64el:
+  case llvm::Triple::ppc64le:
+  case llvm::Triple::loongarch64:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// the file name a source of a batch is written to in the output directory
+std::string getBatchOutputName(const std::string &srcFile, axen::driver::EmitKind emitKind) {
+  const char *extension = "";
+  switch (emitKind) {
+  case axen::driver::EmitKind::Object:
+    extension = ".o";
+    break;
+  case axen::driver::EmitKind::Assembly:
+    extension = ".s";
+    break;
+  case axen::driver::EmitKind::Bitcode:
+    extension = ".bc";
+    break;
+  case axen::driver::EmitKind::IR:
+    extension = ".ll";
+    break;
+  }
+  return std::filesystem::path(srcFile).stem().string() + extension;
+}
+
+int compileFile(const Options &options, const std::string &srcFile, const std::string &outputFile,
+                llvm::TargetMachine &targetMachine, axen::driver::CompileStats &stats,
+                llvm::ThreadPoolInterface *pool, llvm::ThreadPoolInterface &importPool) {
+
+  // shared by the parser and codegen, the ast names everything by its symbols
+  axen::SymbolTable symbols;
+  axen::ast::CodegenContext ctx(srcFile, symbols);
+
+  ctx.module->setTargetTriple(targetMachine.getTargetTriple());
+  ctx.module->setDataLayout(targetMachine.createDataLayout());
+  ctx.targetCPU = options.targetSelection.cpu;
+  ctx.targetFeatures = options.targetSelection.features;
+
+  // every floating point instruction the builder creates carries these
+  if (options.fastMath) {
+    llvm::FastMathFlags flags;
+    flags.setFast();
+    ctx.builder.setFastMathFlags(flags);
   }
+  ctx.classArgsByReference = options.classArgsByReference;
+  ctx.instrumentation = options.instrumentation;
+
+  // the interface is restored from the cache along with the objects, so importers never see a stale one
+  std::string interfaceFile = options.emitInterface ? axen::parser::Parser::getInterfacePath(srcFile) : "";
+
+  // only outputs written to a file are cached, ir printed to stdout is always regenerated
+  std::string cacheKey = "";
+  std::vector<std::string> outputs;
+  if (!options.cacheDir.empty() && !outputFile.empty() && !options.printLayouts && !options.flushInstructions) {
+    cacheKey = axen::driver::computeCacheKey(srcFile, options.targetSelection, options.optLevel, options.jobs,
+                                             options.separateImports, options.streaming, options.fastMath,
+                                             options.classArgsByReference, options.instrumentation,
+                                             options.emitKind, options.ltoMode, options.profile);
 
-  axen::ast::CodegenContext ctx(srcFile);
+    for (unsigned i = 0; i < options.jobs; ++i)
+      outputs.push_back(options.jobs > 1 ? axen::driver::getPartitionPath(outputFile, i) : outputFile);
+
+    auto phase = stats.phase("cache-lookup");
+    bool hit = axen::driver::restoreFromCache(options.cacheDir, cacheKey, outputs, interfaceFile);
+    stats.count("cache-hit", hit);
+    if (hit)
+      return 0;
+  }
 
   std::filesystem::path srcPath = std::filesystem::path(srcFile);
 
-  std::ifstream in(srcFile);
-  if (!in) {
+  // large sources are memory mapped, tokens point straight into this buffer
+  auto sourceBuffer = llvm::MemoryBuffer::getFile(srcFile);
+  if (!sourceBuffer) {
     axen::error::reportError(axen::error::ErrorType::Syntax, "Could not open file: '" + srcPath.string() + "'");
   }
 
-  std::ostringstream ss;
-  ss << in.rdbuf();
-  std::string sourceCode = ss.str();
-
   std::string className = srcPath.stem().string();
 
   if (className.empty()) {
     axen::error::reportError(axen::error::ErrorType::Internal, "Invalid class name derived from file path");
   }
 
-  std::unique_ptr<axen::parser::Parser> parser = std::make_unique<axen::parser::Parser>(std::move(sourceCode), srcPath);
+  std::unique_ptr<axen::parser::Parser> parser =
+      std::make_unique<axen::parser::Parser>(std::move(*sourceBuffer), symbols, srcPath);
 
-  parser->parse();
+  parser->setSeparateImports(options.separateImports);
+  parser->setStreaming(options.streaming);
+  parser->setImportPool(&importPool);
 
-  for (const auto &structure : *parser->getStructs()) {
-    structure->codeGen(ctx);
+  {
+    // lexing happens on demand while parsing, so it is part of this phase
+    auto phase = stats.phase("parse");
+    parser->parse();
   }
 
-  for (const auto &func : *parser->getFunctions()) {
-    func->codeGen(ctx);
+  axen::parser::ParseStatistics parseStatistics = parser->getStatistics();
+  stats.count("files", parseStatistics.files);
+  stats.count("interfaces", parseStatistics.interfaces);
+  stats.count("tokens", parseStatistics.tokens);
+  stats.count("ast-nodes", parseStatistics.astNodes);
+  stats.count("ast-bytes", parseStatistics.astBytes);
+  stats.count("types", parseStatistics.types);
+  stats.addImportTimes(parseStatistics.importTimes);
+
+  if (options.emitInterface) {
+    auto phase = stats.phase("write-interface");
+    parser->writeInterface(interfaceFile);
   }
 
-  std::string errorStr;
-  llvm::raw_string_ostream errorStream(errorStr);
-  if (llvm::verifyModule(*ctx.module, &errorStream)) {
-    llvm::errs() << "Module verification failed:\n" << errorStr << "\n";
-    return 1;
+  {
+    auto phase = stats.phase("codegen-classes");
+    for (const auto &structure : *parser->getStructs()) {
+      structure->codeGen(ctx);
+    }
   }
 
-  if (outputFile.empty()) {
-    ctx.module->print(llvm::outs(), nullptr);
-  } else {
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
+  if (options.printLayouts) {
+    for (const auto &structure : *parser->getStructs())
+      structure->printLayout(ctx, llvm::errs());
+  }
+
+  {
+    auto phase = stats.phase("codegen-functions");
+
+    // every prototype exists before the first body is generated, so bodies can be generated in any order
+    for (const auto &func : *parser->getFunctions()) {
+      func->declare(ctx);
+    }
+
+    if (options.streaming) {
+      // profiles are matched against the cfg the module pipeline sees, which simplifying early would change
+      std::optional<axen::driver::FunctionOptimizer> optimizer;
+      if (options.optLevel != axen::driver::OptLevel::O0 && options.profile.generatePath.empty() &&
+          options.profile.usePath.empty())
+        optimizer.emplace(&targetMachine);
+
+      uint64_t unflushed = 0;
+      std::string partitionSuffix = options.flushInstructions ? axen::driver::getPartitionSuffix(srcFile) : "";
+      parser->streamBodies([&](axen::ast::FunctionNode *func) {
+        llvm::Function *function = func->codeGen(ctx);
+        if (optimizer)
+          optimizer->run(*function);
 
-    auto targetTriple = llvm::sys::getDefaultTargetTriple();
-    llvm::Triple triple(llvm::sys::getDefaultTargetTriple());
-    ctx.module->setTargetTriple(triple);
+        if (!options.flushInstructions)
+          return;
+        unflushed += function->getInstructionCount();
+        if (unflushed < options.flushInstructions)
+          return;
 
-    std::string error;
-    auto target = llvm::TargetRegistry::lookupTarget(targetTriple, error);
+        auto phase = stats.phase("flush");
+        axen::ast::FunctionNode::inferAttributes(ctx);
 
-    if (!target) {
-      llvm::errs() << error;
+        std::string errorStr;
+        llvm::raw_string_ostream errorStream(errorStr);
+        if (llvm::verifyModule(*ctx.module, &errorStream)) {
+          axen::error::reportError(axen::error::ErrorType::Internal, "Module verification failed:\n" + errorStr);
+        }
+
+        outputs.push_back(axen::driver::getPartitionPath(outputFile, outputs.size()));
+        axen::driver::flushPartition(*ctx.module, targetMachine, options.optLevel, partitionSuffix, outputs.back());
+        unflushed = 0;
+      });
+
+      // only the nodes of the declarations were counted so far
+      axen::parser::ParseStatistics streamStatistics = parser->getStatistics();
+      stats.count("ast-nodes", streamStatistics.streamedNodes);
+      stats.count("ast-peak-body-bytes", streamStatistics.peakBodyBytes);
+      stats.count("flushed-partitions", outputs.size());
+    } else {
+      for (const auto &func : *parser->getFunctions()) {
+        func->codeGen(ctx);
+      }
+    }
+
+    axen::ast::FunctionNode::inferAttributes(ctx);
+  }
+
+  stats.countModule(*ctx.module);
+
+  {
+    auto phase = stats.phase("verify");
+
+    std::string errorStr;
+    llvm::raw_string_ostream errorStream(errorStr);
+    if (llvm::verifyModule(*ctx.module, &errorStream)) {
+      llvm::errs() << "Module verification failed:\n" << errorStr << "\n";
       return 1;
     }
+  }
 
-    auto CPU = "generic";
-    auto features = "";
+  if (options.run) {
+    {
+      auto phase = stats.phase("optimize");
+      axen::driver::optimizeModule(*ctx.module, &targetMachine, options.optLevel, axen::driver::LTOMode::None,
+                                   options.profile);
+    }
+    stats.countModule(*ctx.module, "-optimized");
 
-    llvm::TargetOptions opt;
-    auto RM = std::optional<llvm::Reloc::Model>(llvm::Reloc::PIC_);
-    auto targetMachine = target->createTargetMachine(triple, CPU, features, opt, RM);
+    auto phase = stats.phase("run");
+    return axen::driver::runModule(*ctx.module, options.targetSelection, options.optLevel, options.lazyJIT,
+                                   options.runArgs);
+  }
 
-    ctx.module->setDataLayout(targetMachine->createDataLayout());
+  if (pool && !outputFile.empty()) {
+    auto phase = stats.phase("optimize-and-emit");
 
-    std::error_code EC;
-    llvm::raw_fd_ostream dest(outputFile, EC, llvm::sys::fs::OF_None);
+    // every partition is optimized on its own thread
+    outputs = axen::driver::emitParallel(*ctx.module, options.targetSelection, options.optLevel, options.profile,
+                                         options.jobs, outputFile, *pool);
 
-    if (EC) {
-      llvm::errs() << "Could not open file: " << EC.message();
-      return 1;
+    if (!cacheKey.empty())
+      axen::driver::storeInCache(options.cacheDir, cacheKey, outputs, interfaceFile);
+    return 0;
+  }
+
+  {
+    auto phase = stats.phase("optimize");
+    axen::driver::optimizeModule(*ctx.module, &targetMachine, options.optLevel, options.ltoMode, options.profile);
+  }
+  stats.countModule(*ctx.module, "-optimized");
+
+  auto phase = stats.phase("emit");
+
+  switch (options.emitKind) {
+  case axen::driver::EmitKind::IR:
+    if (outputFile.empty())
+      ctx.module->print(llvm::outs(), nullptr);
+    else
+      axen::driver::emitIRFile(*ctx.module, outputFile);
+    break;
+  case axen::driver::EmitKind::Bitcode:
+    axen::driver::emitBitcodeFile(*ctx.module, outputFile, options.ltoMode);
+    break;
+  case axen::driver::EmitKind::Assembly:
+    axen::driver::emitObjectFile(*ctx.module, targetMachine, outputFile, llvm::CodeGenFileType::AssemblyFile);
+    break;
+  case axen::driver::EmitKind::Object:
+    if (options.flushInstructions) {
+      // what is left after the last flush becomes the last partition
+      outputs.push_back(axen::driver::getPartitionPath(outputFile, outputs.size()));
+      axen::driver::emitObjectFile(*ctx.module, targetMachine, outputs.back());
+
+      // partitions left over from a build that flushed more often would otherwise be linked in as well
+      std::error_code EC;
+      size_t stale = outputs.size();
+      while (std::filesystem::remove(axen::driver::getPartitionPath(outputFile, stale), EC))
+        stale++;
+    } else {
+      axen::driver::emitObjectFile(*ctx.module, targetMachine, outputFile);
     }
+    break;
+  }
 
-    llvm::legacy::PassManager pass;
-    auto fileType = llvm::CodeGenFileType::ObjectFile;
+  if (!cacheKey.empty())
+    axen::driver::storeInCache(options.cacheDir, cacheKey, outputs, interfaceFile);
 
-    if (targetMachine->addPassesToEmitFile(pass, dest, nullptr, fileType)) {
-      llvm::errs() << "TargetMachine can't emit a file of this type";
-      return 1;
+  return 0;
+}
+
+int compile(int argc, char **argv) {
+
+  Options options;
+  std::vector<std::string> srcFiles;
+  std::string outputFile = "";
+  std::optional<axen::driver::EmitKind> emitKind;
+  bool timeReport = false;
+  std::string timeTraceFile = "";
+  bool timeTrace = false;
+  axen::driver::StatsFormat statsFormat = axen::driver::StatsFormat::None;
+  std::string statsFile = "";
+  std::string daemonSocket = "";
+  std::string serverSocket = "";
+
+  // what is sent on to a compile server, everything but the option naming the server
+  std::vector<std::string> forwardedArgs{argv[0]};
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+      serverSocket = argv[i + 1];
+      i++;
+      continue;
+    }
+    forwardedArgs.push_back(argv[i]);
+
+    if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      srcFiles.push_back(argv[i + 1]);
+      forwardedArgs.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "--run") == 0 && i + 1 < argc) {
+      // everything after the source file is passed on to the program
+      options.run = true;
+      srcFiles.push_back(argv[i + 1]);
+      options.runArgs.assign(argv + i + 2, argv + argc);
+      forwardedArgs.insert(forwardedArgs.end(), argv + i + 1, argv + argc);
+      break;
+    } else if (strcmp(argv[i], "--lazy") == 0) {
+      options.lazyJIT = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outputFile = argv[i + 1];
+      forwardedArgs.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "-target") == 0 && i + 1 < argc) {
+      options.targetSelection.triple = argv[i + 1];
+      forwardedArgs.push_back(argv[++i]);
+    } else if (strncmp(argv[i], "-mcpu=", 6) == 0) {
+      options.targetSelection.cpu = argv[i] + 6;
+    } else if (strncmp(argv[i], "-mattr=", 7) == 0) {
+      options.targetSelection.features = argv[i] + 7;
+    } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+      options.cacheDir = argv[i + 1];
+      forwardedArgs.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "--separate-imports") == 0) {
+      options.separateImports = true;
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      options.streaming = true;
+    } else if (strncmp(argv[i], "--stream-flush=", 15) == 0) {
+      if (llvm::StringRef(argv[i] + 15).getAsInteger(10, options.flushInstructions) || !options.flushInstructions) {
+        axen::error::reportError(axen::error::ErrorType::Syntax,
+                                 "Invalid flush size: '" + std::string(argv[i] + 15) + "', expected a positive count");
+      }
+      options.streaming = true;
+    } else if (strcmp(argv[i], "--emit-interface") == 0) {
+      options.emitInterface = true;
+    } else if (strcmp(argv[i], "--print-layouts") == 0) {
+      options.printLayouts = true;
+    } else if (strcmp(argv[i], "-ffast-math") == 0) {
+      options.fastMath = true;
+    } else if (strncmp(argv[i], "-finstrument=", 13) == 0) {
+      if (!parseInstrumentKinds(argv[i] + 13, options.instrumentation)) {
+        axen::error::reportError(axen::error::ErrorType::Syntax,
+                                 "Invalid instrumentation: '" + std::string(argv[i] + 13) +
+                                     "', expected a comma separated list of xray, entry-exit and calls");
+      }
+    } else if (strncmp(argv[i], "-fxray-instruction-threshold=", 29) == 0) {
+      unsigned threshold;
+      if (llvm::StringRef(argv[i] + 29).getAsInteger(10, threshold)) {
+        axen::error::reportError(axen::error::ErrorType::Syntax,
+                                 "Invalid xray instruction threshold: '" + std::string(argv[i] + 29) + "'");
+      }
+      options.instrumentation.xrayThreshold = threshold;
+    } else if (strcmp(argv[i], "-fclass-args-by-reference") == 0) {
+      options.classArgsByReference = true;
+    } else if (strncmp(argv[i], "--emit=", 7) == 0) {
+      axen::driver::EmitKind kind;
+      if (!axen::driver::parseEmitKind(argv[i] + 7, kind)) {
+        axen::error::reportError(axen::error::ErrorType::Syntax,
+                                 "Invalid output kind: '" + std::string(argv[i] + 7) + "', expected obj, asm, bc or ll");
+      }
+      emitKind = kind;
+    } else if (strcmp(argv[i], "-flto") == 0) {
+      options.ltoMode = axen::driver::LTOMode::Full;
+    } else if (strncmp(argv[i], "-flto=", 6) == 0) {
+      if (!axen::driver::parseLTOMode(argv[i] + 6, options.ltoMode)) {
+        axen::error::reportError(axen::error::ErrorType::Syntax,
+                                 "Invalid lto mode: '" + std::string(argv[i] + 6) + "', expected thin or full");
+      }
+    } else if (strcmp(argv[i], "-fprofile-generate") == 0) {
+      options.profile.generatePath = axen::driver::getProfileGeneratePath("");
+    } else if (strncmp(argv[i], "-fprofile-generate=", 19) == 0) {
+      options.profile.generatePath = axen::driver::getProfileGeneratePath(argv[i] + 19);
+    } else if (strncmp(argv[i], "-fprofile-use=", 14) == 0) {
+      options.profile.usePath = argv[i] + 14;
+    } else if (strcmp(argv[i], "-ftime-report") == 0) {
+      timeReport = true;
+    } else if (strcmp(argv[i], "-ftime-trace") == 0) {
+      timeTrace = true;
+    } else if (strncmp(argv[i], "-ftime-trace=", 13) == 0) {
+      timeTrace = true;
+      timeTraceFile = argv[i] + 13;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      statsFormat = axen::driver::StatsFormat::Text;
+    } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+      if (!axen::driver::parseStatsFormat(argv[i] + 8, statsFormat)) {
+        axen::error::reportError(axen::error::ErrorType::Syntax,
+                                 "Invalid stats format: '" + std::string(argv[i] + 8) + "', expected text or json");
+      }
+    } else if (strncmp(argv[i], "--stats-file=", 13) == 0) {
+      statsFile = argv[i] + 13;
+    } else if (strcmp(argv[i], "--daemon") == 0 && i + 1 < argc) {
+      daemonSocket = argv[i + 1];
+      forwardedArgs.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      options.jobs = std::max(1, atoi(argv[i + 1]));
+      forwardedArgs.push_back(argv[++i]);
+    } else if (strncmp(argv[i], "-O", 2) == 0) {
+      if (!axen::driver::parseOptLevel(argv[i], options.optLevel)) {
+        axen::error::reportError(axen::error::ErrorType::Syntax,
+                                 "Invalid optimization level: '" + std::string(argv[i]) + "'");
+      }
+    } else {
+      axen::error::reportError(axen::error::ErrorType::Syntax, "Invalid argument: '" + std::string(argv[i]) + "'");
+    }
+  }
+
+  if (!daemonSocket.empty()) {
+    if (!srcFiles.empty() || !serverSocket.empty()) {
+      axen::error::reportError(axen::error::ErrorType::Syntax,
+                               "--daemon takes no source files, compile them with --server instead");
+    }
+
+    // the target options of the server pick the target machine its compilations start with
+    axen::driver::keepTargetMachine(options.targetSelection, options.optLevel);
+    axen::driver::runServer(daemonSocket, compile);
+    return 0;
+  }
+
+  // without a server listening the compilation simply happens here
+  if (!serverSocket.empty()) {
+    if (auto exitCode = axen::driver::compileOnServer(serverSocket, forwardedArgs))
+      return *exitCode;
+  }
+
+  if (srcFiles.empty()) {
+    axen::error::reportError(axen::error::ErrorType::Syntax, "Missing required argument: -f <source file>");
+  }
+
+  bool batch = srcFiles.size() > 1;
+
+  if (options.run && (!outputFile.empty() || emitKind || options.ltoMode != axen::driver::LTOMode::None ||
+                      options.jobs > 1 || batch)) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "--run cannot be combined with -o, --emit, -flto, -j or other source files");
+  }
+
+  if (options.run && !options.targetSelection.triple.empty()) {
+    axen::error::reportError(axen::error::ErrorType::Syntax, "--run always compiles for the host, drop -target");
+  }
+
+  // the counters of an instrumented program need the profile runtime, which only a link can pull in
+  if (options.run && !options.profile.generatePath.empty()) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "--run cannot run an instrumented program, drop -fprofile-generate");
+  }
+
+  if (!options.profile.generatePath.empty() && !options.profile.usePath.empty()) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "-fprofile-generate cannot be combined with -fprofile-use");
+  }
+
+  if (!options.profile.usePath.empty() && !std::filesystem::is_regular_file(options.profile.usePath)) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "Could not open profile: '" + options.profile.usePath + "'");
+  }
+
+  // the hooks live in runtimes a link pulls in, the compiler process does not define them
+  if (options.run && (options.instrumentation.xray || options.instrumentation.entryExit)) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "--run cannot run a program instrumented with xray or entry-exit hooks");
+  }
+
+  if (options.lazyJIT && !options.run) {
+    axen::error::reportError(axen::error::ErrorType::Syntax, "--lazy only applies to --run");
+  }
+
+  if (batch && outputFile.empty()) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "Compiling several files needs an output directory, pass -o <directory>");
+  }
+
+  // without an output file the ir is printed, lto objects are bitcode the linker optimizes and generates code for
+  if (!emitKind) {
+    emitKind = outputFile.empty()                                 ? axen::driver::EmitKind::IR
+               : options.ltoMode != axen::driver::LTOMode::None ? axen::driver::EmitKind::Bitcode
+                                                                : axen::driver::EmitKind::Object;
+  }
+  options.emitKind = *emitKind;
+
+  if (options.ltoMode != axen::driver::LTOMode::None && options.emitKind != axen::driver::EmitKind::Bitcode &&
+      options.emitKind != axen::driver::EmitKind::IR) {
+    axen::error::reportError(axen::error::ErrorType::Syntax, "-flto produces bitcode, use --emit=bc or --emit=ll");
+  }
+
+  if (outputFile.empty() && options.emitKind != axen::driver::EmitKind::IR) {
+    axen::error::reportError(axen::error::ErrorType::Syntax, "Only ir can be printed, pass -o <file> for this output");
+  }
+
+  // the number of partitions is only known once the last one is written, which -j and the cache cannot work with
+  if (options.flushInstructions && (options.emitKind != axen::driver::EmitKind::Object || options.jobs > 1)) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "--stream-flush writes object partitions, it cannot be combined with --emit, -flto, -j "
+                             "or --run");
+  }
+
+  // flushing renames private functions after the source file, profiles would no longer match them by name
+  if (options.flushInstructions && (!options.profile.generatePath.empty() || !options.profile.usePath.empty())) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "--stream-flush cannot be combined with -fprofile-generate or -fprofile-use");
+  }
+
+  if (options.jobs > 1 && options.emitKind != axen::driver::EmitKind::Object) {
+    axen::error::reportError(axen::error::ErrorType::Syntax, "-j only applies to object output");
+  }
+
+  // a batch writes every source to the output directory under its own name
+  std::vector<std::string> outputFiles;
+  if (batch) {
+    std::error_code EC;
+    std::filesystem::create_directories(outputFile, EC);
+    if (EC) {
+      axen::error::reportError(axen::error::ErrorType::Internal,
+                               "Could not create output directory '" + outputFile + "': " + EC.message());
     }
 
-    pass.run(*ctx.module);
-    dest.flush();
+    std::set<std::string> names;
+    for (const auto &srcFile : srcFiles) {
+      std::string name = getBatchOutputName(srcFile, options.emitKind);
+      if (!names.insert(name).second) {
+        axen::error::reportError(axen::error::ErrorType::Syntax,
+                                 "Several sources would be written to '" + name + "' in the output directory");
+      }
+      outputFiles.push_back((std::filesystem::path(outputFile) / name).string());
+    }
+  } else {
+    outputFiles.push_back(outputFile);
+  }
+
+  // the trace lands next to the output like clang's, or next to the source when there is none. a batch traces all of
+  // its files into the output directory
+  if (timeTrace && timeTraceFile.empty()) {
+    timeTraceFile =
+        batch ? (std::filesystem::path(outputFile) / "time-trace.json").string()
+              : std::filesystem::path(outputFile.empty() ? srcFiles[0] : outputFile).replace_extension(".json").string();
+  }
+
+  if (!statsFile.empty() && statsFormat == axen::driver::StatsFormat::None) {
+    statsFormat = axen::driver::StatsFormat::Json;
+  }
+
+  // reports everything once compile returns, phases and counters of a batch add up over its files
+  axen::driver::CompileStats stats(timeReport, timeTraceFile, statsFormat, statsFile);
+
+  // one target machine and one pool of codegen threads for every file of a batch
+  auto targetMachine = axen::driver::createTargetMachine(options.targetSelection, options.optLevel);
+
+  if (options.instrumentation.xray && !supportsXRay(targetMachine->getTargetTriple())) {
+    axen::error::reportError(axen::error::ErrorType::Syntax,
+                             "-finstrument=xray is not supported on '" + options.targetSelection.triple + "'");
+  }
+
+  std::optional<llvm::DefaultThreadPool> pool;
+  if (options.jobs > 1)
+    pool.emplace(llvm::hardware_concurrency(options.jobs));
+
+  // the pool only starts threads once a file has imports to read ahead, and keeps them for the rest of the batch
+  llvm::DefaultThreadPool importPool(llvm::hardware_concurrency());
+
+  for (size_t i = 0; i < srcFiles.size(); i++) {
+    int exitCode =
+        compileFile(options, srcFiles[i], outputFiles[i], *targetMachine, stats, pool ? &*pool : nullptr, importPool);
+    if (exitCode != 0)
+      return exitCode;
   }
 
   return 0;
 }
+
+} // namespace
+
+int main(int argc, char **argv) {
+  // '@file' arguments are replaced by the arguments listed in the file, the way gcc and clang read response files
+  llvm::BumpPtrAllocator allocator;
+  llvm::StringSaver saver(allocator);
+  llvm::SmallVector<const char *, 64> args(argv, argv + argc);
+  if (!llvm::cl::ExpandResponseFiles(saver, llvm::cl::TokenizeGNUCommandLine, args)) {
+    axen::error::reportError(axen::error::ErrorType::Syntax, "Could not read a response file");
+  }
+
+  std::vector<char *> expanded;
+  for (const char *arg : args)
+    expanded.push_back(const_cast<char *>(arg));
+  expanded.push_back(nullptr);
+
+  return compile(static_cast<int>(expanded.size() - 1), expanded.data());
+}
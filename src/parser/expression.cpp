@@ -1,7 +1,12 @@
-#include <memory>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include <llvm/ADT/StringRef.h>
 #include <llvm/Support/Casting.h>
 
 #include "lexer.hpp"
@@ -14,6 +19,7 @@ static int getOperatorPrecedence(lexer::TokenType type) {
   switch (type) {
   case lexer::TokenType::Asterisk:
   case lexer::TokenType::Slash:
+  case lexer::TokenType::Percent:
     return 20;
   case lexer::TokenType::Plus:
   case lexer::TokenType::Minus:
@@ -38,6 +44,8 @@ ast::BinaryOperationType Parser::tokenToBinaryOp(lexer::TokenType type) {
     return ast::BinaryOperationType::Multiply;
   case lexer::TokenType::Slash:
     return ast::BinaryOperationType::Divide;
+  case lexer::TokenType::Percent:
+    return ast::BinaryOperationType::Remainder;
   case lexer::TokenType::Less:
     return ast::BinaryOperationType::Less;
   case lexer::TokenType::Greater:
@@ -50,28 +58,30 @@ ast::BinaryOperationType Parser::tokenToBinaryOp(lexer::TokenType type) {
   }
 }
 
-std::unique_ptr<ast::ExpressionNode> Parser::parsePrimaryExpression(lexer::TokenType terminator) {
+ast::ExpressionNode *Parser::parsePrimaryExpression(lexer::TokenType terminator) {
   switch (lexer_->peek().type) {
   case lexer::TokenType::IntLit: {
-    std::string intStr = expect(lexer::TokenType::IntLit).src;
-    int base = (intStr.size() > 2 && intStr[0] == '0' && (intStr[1] == 'x' || intStr[1] == 'X')) ? 16 : 10;
-    return std::make_unique<ast::IntLiteral>(std::stoi(intStr, nullptr, base));
+    // literals above the signed 64 bit range are unsigned, they only fit a ulong
+    uint64_t value = parseIntLiteral();
+    return nodes_->create<ast::IntLiteral>(static_cast<int64_t>(value), value <= INT64_MAX);
   }
 
   case lexer::TokenType::StringLit:
-    return std::make_unique<ast::StringLiteral>(expect(lexer::TokenType::StringLit).src);
+    return nodes_->create<ast::StringLiteral>(
+        nodes_->copyString(lexer::unescape(expect(lexer::TokenType::StringLit).src)));
 
   case lexer::TokenType::FloatLit:
-    return std::make_unique<ast::FloatLiteral>(std::stof(expect(lexer::TokenType::FloatLit).src));
+    return nodes_->create<ast::FloatLiteral>(std::stod(std::string(expect(lexer::TokenType::FloatLit).src)));
 
   case lexer::TokenType::Minus:
     lexer_->consume();
     if (lexer_->peekT(lexer::TokenType::FloatLit)) {
-      return std::make_unique<ast::FloatLiteral>(0 - std::stof(expect(lexer::TokenType::FloatLit).src));
+      return nodes_->create<ast::FloatLiteral>(0 - std::stod(std::string(expect(lexer::TokenType::FloatLit).src)));
     } else {
-      std::string intStr = expect(lexer::TokenType::IntLit).src;
-      int base = (intStr.size() > 2 && intStr[0] == '0' && (intStr[1] == 'x' || intStr[1] == 'X')) ? 16 : 10;
-      return std::make_unique<ast::IntLiteral>(0 - std::stoi(intStr, nullptr, base));
+      uint64_t value = parseIntLiteral();
+      if (value > static_cast<uint64_t>(INT64_MAX) + 1)
+        emitSemanticError("Integer literal is out of range");
+      return nodes_->create<ast::IntLiteral>(static_cast<int64_t>(0 - value));
     }
 
   case lexer::TokenType::Ampersand:
@@ -82,10 +92,10 @@ std::unique_ptr<ast::ExpressionNode> Parser::parsePrimaryExpression(lexer::Token
 
       auto nameToken = expect(lexer::TokenType::Identifier);
       validateIdentifier(nameToken.src);
-      std::string name = nameToken.src;
+      std::string name(nameToken.src);
       expect(lexer::TokenType::LParen);
 
-      auto functionArgs = std::vector<std::unique_ptr<ast::ExpressionNode>>();
+      auto functionArgs = std::vector<ast::ExpressionNode *>();
       while (lexer_->peek().type != lexer::TokenType::RParen) {
         functionArgs.emplace_back(parseExpression(lexer::TokenType::Comma));
         if (lexer_->peek().type == lexer::TokenType::Comma) {
@@ -94,10 +104,13 @@ std::unique_ptr<ast::ExpressionNode> Parser::parsePrimaryExpression(lexer::Token
       }
       lexer_->consume();
 
-      auto functionReturnType = Parser::lookupFunctionReturnType(name);
+      auto functionReturnType = Parser::lookupFunctionReturnType(nameToken.symbol);
 
-      if (!functionReturnType)
+      if (!functionReturnType) {
+        if (auto *builtin = createBuiltinCall(name, functionArgs))
+          return builtin;
         emitSemanticError("Call to undefined function '" + name + "'");
+      }
 
       // non-detatched member function calls must be made using a instance
       if (!currentClassName_.empty() && name.find("_") != std::string::npos) {
@@ -106,11 +119,14 @@ std::unique_ptr<ast::ExpressionNode> Parser::parsePrimaryExpression(lexer::Token
           emitSemanticError("Cannot call member function '" + name + "' without an instance of the class");
       }
 
-      return std::make_unique<ast::FunctionCall>(name, std::move(functionArgs), functionReturnType->isSigned());
+      return nodes_->create<ast::FunctionCall>(nameToken.symbol, nodes_->copyArray(functionArgs),
+                                              functionReturnType->isSigned());
     } else {
       if (lexer_->peekT(lexer::TokenType::Identifier))
-        if (intDefs_.contains(lexer_->peek().src))
-          return std::make_unique<ast::IntLiteral>(intDefs_.at(expect(lexer::TokenType::Identifier).src));
+        if (auto it = intDefs_.find(lexer_->peek().symbol); it != intDefs_.end()) {
+          lexer_->consume();
+          return nodes_->create<ast::IntLiteral>(it->second);
+        }
 
       return parseValue().first;
     }
@@ -129,8 +145,7 @@ std::unique_ptr<ast::ExpressionNode> Parser::parsePrimaryExpression(lexer::Token
   }
 }
 
-std::unique_ptr<ast::ExpressionNode> Parser::parseBinaryOpRHS(int exprPrec, std::unique_ptr<ast::ExpressionNode> lhs,
-                                                              lexer::TokenType terminator) {
+ast::ExpressionNode *Parser::parseBinaryOpRHS(int exprPrec, ast::ExpressionNode *lhs, lexer::TokenType terminator) {
   auto isTerminator = [&]() {
     auto type = lexer_->peek().type;
     if (type == terminator)
@@ -166,25 +181,163 @@ std::unique_ptr<ast::ExpressionNode> Parser::parseBinaryOpRHS(int exprPrec, std:
       } else {
         int nextPrec = getOperatorPrecedence(nextTokType);
         if (nextPrec > tokPrec) {
-          rhs = parseBinaryOpRHS(tokPrec + 1, std::move(rhs), terminator);
+          rhs = parseBinaryOpRHS(tokPrec + 1, rhs, terminator);
         }
       }
     }
 
-    if (lhs->isSigned() != rhs->isSigned()) {
+    // literals are typed from the other operand, so only two typed operands can disagree on signedness
+    bool isLhsLiteral = llvm::isa<ast::IntLiteral, ast::FloatLiteral>(lhs);
+    bool isRhsLiteral = llvm::isa<ast::IntLiteral, ast::FloatLiteral>(rhs);
+
+    if (!isLhsLiteral && !isRhsLiteral && lhs->isSigned() != rhs->isSigned()) {
       emitSemanticError("Cannot create binary operation with types of different signedness");
     }
 
-    lhs = std::make_unique<ast::BinaryOperation>(tokenToBinaryOp(tokType), std::move(lhs), std::move(rhs),
-                                                 lhs->isSigned());
+    auto opType = tokenToBinaryOp(tokType);
+    bool isSigned = isLhsLiteral ? rhs->isSigned() : lhs->isSigned();
+    bool isFoldable = llvm::isa<ast::IntLiteral>(lhs) && llvm::isa<ast::IntLiteral>(rhs);
+
+    lhs = nodes_->create<ast::BinaryOperation>(opType, lhs, rhs, isSigned);
+
+    // operands are folded as they are built, so literal operands are all it takes. comparisons stay, they produce
+    // an i1 which no literal node stands in for
+    if (isFoldable && opType != ast::BinaryOperationType::Less && opType != ast::BinaryOperationType::More &&
+        opType != ast::BinaryOperationType::Equal)
+      if (auto value = evaluateConstant(lhs))
+        lhs = nodes_->create<ast::IntLiteral>(*value);
   }
 
   return lhs;
 }
 
-std::unique_ptr<ast::ExpressionNode> Parser::parseExpression(lexer::TokenType terminator) {
+/// returns the builtin call for name, or nullptr if name is no builtin.
+ast::ExpressionNode *Parser::createBuiltinCall(const std::string &name, std::vector<ast::ExpressionNode *> &args) {
+  static const std::unordered_map<std::string_view, std::pair<ast::Builtin, size_t>> builtins = {
+      {"splat", {ast::Builtin::Splat, 2}},         {"shuffle", {ast::Builtin::Shuffle, 3}},
+      {"reduceadd", {ast::Builtin::ReduceAdd, 1}}, {"reducemul", {ast::Builtin::ReduceMul, 1}},
+      {"reducemin", {ast::Builtin::ReduceMin, 1}}, {"reducemax", {ast::Builtin::ReduceMax, 1}},
+      {"reduceand", {ast::Builtin::ReduceAnd, 1}}, {"reduceor", {ast::Builtin::ReduceOr, 1}},
+      {"reducexor", {ast::Builtin::ReduceXor, 1}}, {"load", {ast::Builtin::Load, 1}},
+      {"loadu", {ast::Builtin::LoadUnaligned, 1}}, {"store", {ast::Builtin::Store, 2}},
+      {"storeu", {ast::Builtin::StoreUnaligned, 2}},
+  };
+
+  auto it = builtins.find(name);
+  if (it == builtins.end())
+    return nullptr;
+
+  auto [builtin, arity] = it->second;
+
+  // shuffle takes any number of lanes after its two vectors
+  if (builtin == ast::Builtin::Shuffle ? args.size() < arity : args.size() != arity)
+    emitSemanticError("Wrong number of arguments for builtin '" + name + "'");
+
+  // lane counts and shuffle masks are folded here, the vector operands stay expressions
+  size_t operands = builtin == ast::Builtin::Splat ? 1 : builtin == ast::Builtin::Shuffle ? 2 : args.size();
+  std::vector<int> constants;
+  for (size_t i = operands; i < args.size(); i++) {
+    auto value = evaluateConstant(args[i]);
+    if (!value)
+      emitSemanticError("Lane operands of '" + name + "' must be constant expressions");
+    constants.push_back(*value);
+  }
+  args.resize(operands);
+
+  if (builtin == ast::Builtin::Splat && constants[0] <= 0)
+    emitSemanticError("Splat lane count must be positive");
+
+  // stores take their signedness from the stored vector, everything else from its first operand
+  bool isSigned = (builtin == ast::Builtin::Store || builtin == ast::Builtin::StoreUnaligned) ? args[1]->isSigned()
+                                                                                                : args[0]->isSigned();
+
+  return nodes_->create<ast::BuiltinCall>(builtin, nodes_->copyArray(args), nodes_->copyArray(constants), isSigned);
+}
+
+/// consumes an integer literal and returns its value, decimal or hexadecimal with a 0x prefix.
+uint64_t Parser::parseIntLiteral() {
+  llvm::StringRef src(expect(lexer::TokenType::IntLit).src);
+
+  unsigned radix = 10;
+  if (src.size() > 2 && src[0] == '0' && (src[1] == 'x' || src[1] == 'X')) {
+    src = src.drop_front(2);
+    radix = 16;
+  }
+
+  uint64_t value;
+  if (src.getAsInteger(radix, value))
+    emitSemanticError("Integer literal '" + src.str() + "' does not fit in 64 bits");
+  return value;
+}
+
+/// evaluates expr if it only depends on signed literals and intdefs. the result is the signed 64 bit value the
+/// expression has in a long, arithmetic wraps at 64 bits and divides and compares signed. narrower contexts truncate
+/// it, which matches wrapping arithmetic in their width for everything but a quotient of an intermediate that
+/// overflowed it, and signed overflow is undefined there anyway.
+std::optional<int64_t> Parser::evaluateConstant(ast::ExpressionNode *expr) {
+  if (auto *literal = llvm::dyn_cast<ast::IntLiteral>(expr)) {
+    if (!literal->isSigned())
+      return std::nullopt;
+    return literal->getValue();
+  }
+
+  auto *binary = llvm::dyn_cast<ast::BinaryOperation>(expr);
+  if (!binary)
+    return std::nullopt;
+
+  auto lhs = evaluateConstant(binary->getLHS());
+  if (!lhs)
+    return std::nullopt;
+
+  auto rhs = evaluateConstant(binary->getRHS());
+  if (!rhs)
+    return std::nullopt;
+
+  int64_t l = *lhs;
+  int64_t r = *rhs;
+
+  // wrapping is done on the unsigned representation, signed overflow in c++ is as undefined as it is in the ir
+  auto wrap = [](uint64_t value) { return static_cast<int64_t>(value); };
+
+  switch (binary->getOperation()) {
+  case ast::BinaryOperationType::Add:
+    return wrap(static_cast<uint64_t>(l) + static_cast<uint64_t>(r));
+  case ast::BinaryOperationType::Subtract:
+    return wrap(static_cast<uint64_t>(l) - static_cast<uint64_t>(r));
+  case ast::BinaryOperationType::Multiply:
+    return wrap(static_cast<uint64_t>(l) * static_cast<uint64_t>(r));
+  case ast::BinaryOperationType::Divide:
+  case ast::BinaryOperationType::Remainder:
+    if (r == 0)
+      emitSemanticError("Division by zero in constant expression");
+    if (l == INT64_MIN && r == -1)
+      emitSemanticError("Overflow in constant expression");
+    return binary->getOperation() == ast::BinaryOperationType::Divide ? l / r : l % r;
+  case ast::BinaryOperationType::Less:
+    return l < r;
+  case ast::BinaryOperationType::More:
+    return l > r;
+  case ast::BinaryOperationType::Equal:
+    return l == r;
+  default:
+    return std::nullopt;
+  }
+}
+
+/// parses an expression that has to be known at compile time, what names the construct in the error message. the
+/// value has to fit in an int.
+int Parser::parseConstantExpression(lexer::TokenType terminator, const std::string &what) {
+  auto value = evaluateConstant(parseExpression(terminator));
+  if (!value)
+    emitSemanticError(what + " must be a constant expression");
+  if (*value < INT32_MIN || *value > INT32_MAX)
+    emitSemanticError(what + " does not fit in an int, got " + std::to_string(*value));
+  return static_cast<int>(*value);
+}
+
+ast::ExpressionNode *Parser::parseExpression(lexer::TokenType terminator) {
   auto lhs = parsePrimaryExpression(terminator);
-  return parseBinaryOpRHS(0, std::move(lhs), terminator);
+  return parseBinaryOpRHS(0, lhs, terminator);
 }
 
 } // namespace axen::parser
@@ -1,6 +1,11 @@
-#include <memory>
+#include <algorithm>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
+
+#include <llvm/Support/Casting.h>
 
 #include "nodes/function.hpp"
 #include "nodes/statement.hpp"
@@ -11,50 +16,115 @@
 
 namespace axen::parser {
 
-std::unique_ptr<ast::FunctionNode> Parser::parseFunction() {
+ast::FunctionAttributes Parser::parseFunctionAttributes() {
+  ast::FunctionAttributes attributes;
+
+  // annotations are contextual, a type that happens to share the name of one still parses as that type
+  while (lexer_->peekT(lexer::TokenType::Identifier) && !peekTypeNode()) {
+    std::string_view annotation = lexer_->peek().src;
+
+    if (annotation == "export") {
+      attributes.isPrivate = false;
+    } else if (annotation == "private") {
+      attributes.isPrivate = true;
+    } else if (annotation == "inline") {
+      attributes.inlineHint = true;
+    } else if (annotation == "noinline") {
+      attributes.noInline = true;
+    } else if (annotation == "hot") {
+      attributes.hot = true;
+    } else if (annotation == "cold") {
+      attributes.cold = true;
+    } else if (annotation == "pure") {
+      attributes.pure = true;
+    } else if (annotation == "const") {
+      attributes.isConst = true;
+    } else if (annotation == "noreturn") {
+      attributes.noReturn = true;
+    } else if (annotation == "noinstrument") {
+      attributes.noInstrument = true;
+    } else {
+      // not an annotation, leave it to the type parser to report
+      break;
+    }
+
+    lexer_->consume();
+  }
+
+  if (attributes.inlineHint && attributes.noInline)
+    emitSemanticError("A function cannot be both inline and noinline");
+  if (attributes.hot && attributes.cold)
+    emitSemanticError("A function cannot be both hot and cold");
+  if (attributes.pure && attributes.isConst)
+    emitSemanticError("A function cannot be both pure and const, const already implies pure");
+
+  return attributes;
+}
+
+ast::FunctionNode *Parser::declareFunction(std::vector<PendingBody> &bodies) {
 
   bool isDetached = currentClassName_.empty();
 
+  ast::FunctionAttributes attributes = parseFunctionAttributes();
+  if (!isDetached && currentClassNoInstrument_)
+    attributes.noInstrument = true;
+
   // type (along with all type modifiers)
-  std::shared_ptr<ast::TypeNode> type = parseType();
+  ast::TypeNode *type = parseType();
 
   // name
   auto nameToken = expect(lexer::TokenType::Identifier);
   validateIdentifier(nameToken.src);
-  std::string baseName = nameToken.src;
+  std::string baseName(nameToken.src);
   std::string name;
   if (isDetached) {
     name = baseName;
   } else if (!currentClassName_.empty()) {
+    // methods are emitted as 'Class_method'. the name is stable, c code and interface files link against it and
+    // profiles match functions by it, so it must not change between compiler versions
     name = currentClassName_ + "_" + baseName;
   } else {
     // NOTE: if no class exists it will be treated at a detached function.
     name = baseName;
   }
 
+  // the entry point has to stay visible to the linker
+  if (attributes.isPrivate && name == "main")
+    emitSemanticError("Function 'main' cannot be private");
+
   // left paren for params
   expect(lexer::TokenType::LParen);
 
-  auto params = std::vector<std::pair<std::string, std::shared_ptr<ast::TypeNode>>>();
+  auto params = std::vector<ast::Parameter>();
 
   // add 'this' parameter for non-detached member functions
   if (!isDetached && !currentClassName_.empty()) {
-    auto thisType = getTypeNode(currentClassName_);
+    auto thisType = getTypeNode(symbols_.intern(currentClassName_));
     if (thisType) {
-      auto thisPtrType = std::make_shared<ast::PointerTypeNode>(thisType);
-      params.emplace_back("this", thisPtrType);
+      auto *thisPtrType = typeTable_.getPointer(thisType);
+      params.push_back({thisSymbol_, thisPtrType});
     }
   }
 
   while (lexer_->peek().type != lexer::TokenType::RParen) {
+    // restrict is contextual, a type that happens to be named restrict still parses as that type
+    bool isRestrict = false;
+    if (lexer_->peekT(lexer::TokenType::Identifier) && lexer_->peek().src == "restrict" && !peekTypeNode()) {
+      lexer_->consume();
+      isRestrict = true;
+    }
+
     // type (along with all type modifiers)
     auto paramType = parseType();
 
+    if (isRestrict && !llvm::isa<ast::PointerTypeNode>(paramType))
+      emitSemanticError("Only pointer parameters can be restrict");
+
     // name is consumed
     auto token = expect(lexer::TokenType::Identifier);
     validateIdentifier(token.src);
 
-    params.emplace_back(std::string(token.src), std::move(paramType));
+    params.push_back({token.symbol, paramType, isRestrict});
 
     if (lexer_->peekT(lexer::TokenType::Comma))
       lexer_->consume();
@@ -63,29 +133,61 @@ std::unique_ptr<ast::FunctionNode> Parser::parseFunction() {
   // closing paren for params
   expect(lexer::TokenType::RParen);
 
-  std::optional<std::vector<std::unique_ptr<ast::StatementNode>>> body;
+  // NOTE: function may be bodyless, only a function with a body is defined
+  bool hasBody = lexer_->peekT(lexer::TokenType::LBrace);
 
-  // NOTE: function may be bodyless, only parse body if it exists
-  if (lexer_->consume().type == lexer::TokenType::LBrace) {
-    body = std::vector<std::unique_ptr<ast::StatementNode>>();
+  // the body of a separately compiled import lives in that import's own object, so it is not parsed at all
+  bool keepBody = hasBody && !(separateImports_ && !isParsingRoot());
 
-    Parser::pushScope();
+  // a kept body starts out empty, it is filled in by parseFunctionBody
+  std::optional<llvm::ArrayRef<ast::StatementNode *>> body;
+  if (keepBody)
+    body = llvm::ArrayRef<ast::StatementNode *>();
 
-    // index function parameters into scope
-    for (const auto &param : params) {
-      Parser::indexVariableType(param.first, const_cast<std::shared_ptr<ast::TypeNode> &>(param.second));
-    }
+  auto *function = arena_.create<ast::FunctionNode>(symbols_.intern(name), type, attributes, arena_.copyArray(params),
+                                                    body, isDetached);
+  auto *declared = indexFunction(function);
 
-    while (!lexer_->peekT(lexer::TokenType::RBrace)) {
-      // NOTE: we don't need to keep track of braces because braces are only used for function scopes
-      body->emplace_back(parseStatement());
-    }
-    expect(lexer::TokenType::RBrace);
+  if (declared == function && isParsingRoot())
+    addRootFunction(function);
+
+  if (!hasBody) {
+    expect(lexer::TokenType::Semi);
+    return declared;
+  }
+
+  if (keepBody)
+    bodies.push_back({function, lexer_->saveState(), currentClassName_, lexer_, currentFileName_});
+
+  skipBody();
+
+  return declared;
+}
 
-    Parser::popScope();
+void Parser::parseFunctionBody(const PendingBody &pending) {
+  lexer_->restoreState(pending.start);
+  currentClassName_ = pending.className;
+
+  expect(lexer::TokenType::LBrace);
+
+  std::vector<ast::StatementNode *> body;
+
+  Parser::pushScope();
+
+  // index function parameters into scope
+  for (const auto &param : pending.function->getParams()) {
+    Parser::indexVariableType(param.name, param.type);
   }
 
-  return std::make_unique<ast::FunctionNode>(name, std::move(type), true, std::move(params), std::move(body),
-                                             isDetached);
+  while (!lexer_->peekT(lexer::TokenType::RBrace)) {
+    // NOTE: we don't need to keep track of braces because braces are only used for function scopes
+    body.emplace_back(parseStatement());
+  }
+  expect(lexer::TokenType::RBrace);
+
+  Parser::popScope();
+
+  currentClassName_.clear();
+  pending.function->setBody(nodes_->copyArray(body));
 }
 } // namespace axen::parser
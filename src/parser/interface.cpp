@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/SHA256.h>
+
+#include "nodes/function.hpp"
+#include "nodes/types.hpp"
+#include "parser.hpp"
+
+namespace axen::parser {
+
+/*
+ * Interface file layout, all integers are little endian u32 and strings are length prefixed:
+ * magic "AXI4"
+ * source hash
+ * imports [count] [canonical path ...]
+ * intdefs [count] [name value ...]
+ * typedefs [count] [alias target ...]
+ * classes [count] [name reorder packed align [member count] [member name, type ...] ...], members in declaration order
+ * functions [count] [name detached attributes return type [param count] [param name, type, restrict ...] ...],
+ *   private functions are left out
+ *
+ * types are encoded as a tag followed by its operands:
+ * 'p' [primitive kind] [signed], '*' [target], '[' [length] [target], 'v' [lanes] [target], 'c' [class name]
+ */
+
+static constexpr llvm::StringLiteral interfaceMagic = "AXI4";
+
+std::string Parser::hashSource(std::string_view sourceCode) {
+  llvm::SHA256 hasher;
+  hasher.update(sourceCode);
+  return llvm::toHex(hasher.final(), true);
+}
+
+// only the attributes a caller can make use of, inline hints mean nothing without the body
+enum FunctionAttributeBits : uint32_t {
+  PureBit = 1 << 0,
+  ConstBit = 1 << 1,
+  NoReturnBit = 1 << 2,
+  HotBit = 1 << 3,
+  ColdBit = 1 << 4,
+};
+
+static uint32_t encodeAttributes(const ast::FunctionAttributes &attributes) {
+  return (attributes.pure ? PureBit : 0) | (attributes.isConst ? ConstBit : 0) |
+         (attributes.noReturn ? NoReturnBit : 0) | (attributes.hot ? HotBit : 0) | (attributes.cold ? ColdBit : 0);
+}
+
+static ast::FunctionAttributes decodeAttributes(uint32_t bits) {
+  ast::FunctionAttributes attributes;
+  attributes.pure = bits & PureBit;
+  attributes.isConst = bits & ConstBit;
+  attributes.noReturn = bits & NoReturnBit;
+  attributes.hot = bits & HotBit;
+  attributes.cold = bits & ColdBit;
+  return attributes;
+}
+
+namespace {
+
+class InterfaceWriter {
+public:
+  void writeInt(uint32_t value) {
+    for (int i = 0; i < 4; i++)
+      data_ += static_cast<char>((value >> (i * 8)) & 0xff);
+  }
+
+  void writeString(const std::string &value) {
+    writeInt(value.size());
+    data_ += value;
+  }
+
+  void writeType(ast::TypeNode *type) {
+    if (auto *primitive = llvm::dyn_cast<ast::PrimitiveTypeNode>(type)) {
+      data_ += 'p';
+      writeInt(static_cast<uint32_t>(primitive->type()));
+      writeInt(primitive->isSigned());
+    } else if (auto *pointer = llvm::dyn_cast<ast::PointerTypeNode>(type)) {
+      data_ += '*';
+      writeType(pointer->target());
+    } else if (auto *array = llvm::dyn_cast<ast::ArrayTypeNode>(type)) {
+      data_ += '[';
+      writeInt(array->length());
+      writeType(array->target());
+    } else if (auto *vector = llvm::dyn_cast<ast::VectorTypeNode>(type)) {
+      data_ += 'v';
+      writeInt(vector->lanes());
+      writeType(vector->target());
+    } else if (auto *classRef = llvm::dyn_cast<ast::ClassReferenceNode>(type)) {
+      data_ += 'c';
+      writeString(classRef->name());
+    } else {
+      error::reportError(error::ErrorType::Internal, "Cannot write unknown type to interface");
+    }
+  }
+
+  const std::string &data() const { return data_; }
+
+private:
+  std::string data_;
+};
+
+/// reads an interface, every read fails softly so a corrupt interface is treated as stale.
+class InterfaceReader {
+public:
+  explicit InterfaceReader(llvm::StringRef data) : data_(data) {}
+
+  bool readInt(uint32_t &value) {
+    if (data_.size() < 4)
+      return false;
+
+    value = 0;
+    for (int i = 0; i < 4; i++)
+      value |= static_cast<uint32_t>(static_cast<unsigned char>(data_[i])) << (i * 8);
+
+    data_ = data_.drop_front(4);
+    return true;
+  }
+
+  bool readString(std::string &value) {
+    uint32_t size;
+    if (!readInt(size) || data_.size() < size)
+      return false;
+
+    value = data_.take_front(size).str();
+    data_ = data_.drop_front(size);
+    return true;
+  }
+
+  bool readTag(char &tag) {
+    if (data_.empty())
+      return false;
+
+    tag = data_.front();
+    data_ = data_.drop_front();
+    return true;
+  }
+
+private:
+  llvm::StringRef data_;
+};
+
+// reads the part of an interface ahead of its declarations. returns false if the interface is stale or corrupt
+bool readInterfaceHeader(InterfaceReader &reader, const std::string &sourceHash, std::vector<std::string> &imports) {
+  std::string magic, hash;
+  if (!reader.readString(magic) || magic != interfaceMagic || !reader.readString(hash) || hash != sourceHash)
+    return false;
+
+  uint32_t count;
+  if (!reader.readInt(count))
+    return false;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!reader.readString(imports.emplace_back()))
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+std::string Parser::getInterfacePath(const std::string &sourcePath) {
+  return std::filesystem::path(sourcePath).replace_extension(".axi").string();
+}
+
+void Parser::writeInterface(const std::string &path) const {
+  InterfaceWriter writer;
+
+  writer.writeString(interfaceMagic.str());
+  writer.writeString(hashSource(sourceCode_));
+
+  writer.writeInt(rootImports_.size());
+  for (const auto &import : rootImports_)
+    writer.writeString(import);
+
+  writer.writeInt(rootIntDefs_.size());
+  for (Symbol name : rootIntDefs_) {
+    writer.writeString(symbols_.name(name));
+    writer.writeInt(static_cast<uint32_t>(intDefs_.lookup(name)));
+  }
+
+  writer.writeInt(rootTypeDefs_.size());
+  for (const auto &[alias, target] : rootTypeDefs_) {
+    writer.writeString(symbols_.name(alias));
+    writer.writeString(symbols_.name(target));
+  }
+
+  writer.writeInt(rootClasses_.size());
+  for (const auto &classNode : rootClasses_) {
+    const ast::ClassAttributes &attributes = classNode->getAttributes();
+    writer.writeString(classNode->getName());
+    writer.writeInt(attributes.reorder);
+    writer.writeInt(attributes.packed);
+    writer.writeInt(attributes.align);
+    writer.writeInt(classNode->getMembers().size());
+    for (const auto &member : classNode->getMembers()) {
+      writer.writeString(symbols_.name(member.name));
+      writer.writeType(member.type);
+    }
+  }
+
+  // private functions have internal linkage, so importers could not link against them anyway
+  writer.writeInt(std::count_if(rootFunctions_.begin(), rootFunctions_.end(),
+                                [](const ast::FunctionNode *function) { return function->isPublic(); }));
+  for (const auto *function : rootFunctions_) {
+    if (!function->isPublic())
+      continue;
+
+    writer.writeString(symbols_.name(function->getName()));
+    writer.writeInt(function->isDetached());
+    writer.writeInt(encodeAttributes(function->getAttributes()));
+    writer.writeType(const_cast<ast::FunctionNode *>(function)->getReturnType());
+    writer.writeInt(function->getParams().size());
+    for (const auto &param : function->getParams()) {
+      writer.writeString(symbols_.name(param.name));
+      writer.writeType(param.type);
+      writer.writeInt(param.isRestrict);
+    }
+  }
+
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    error::reportError(error::ErrorType::Internal, "Could not write interface file: '" + path + "'");
+  }
+  out << writer.data();
+}
+
+namespace {
+
+struct CachedInterface {
+  uint64_t size;
+  llvm::sys::TimePoint<> modified;
+  std::shared_ptr<const std::string> data;
+};
+
+// imports may be parsed from several threads
+std::mutex interfaceCacheMutex;
+llvm::StringMap<CachedInterface> interfaceCache;
+std::vector<std::string> interfaceCacheMisses;
+
+} // namespace
+
+std::shared_ptr<const std::string> InterfaceCache::read(const std::string &path) {
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(path, status) || !llvm::sys::fs::is_regular_file(status))
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(interfaceCacheMutex);
+
+  auto it = interfaceCache.find(path);
+  if (it != interfaceCache.end() && it->second.size == status.getSize() &&
+      it->second.modified == status.getLastModificationTime())
+    return it->second.data;
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return nullptr;
+
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  auto data = std::make_shared<const std::string>(ss.str());
+
+  interfaceCache[path] = CachedInterface{status.getSize(), status.getLastModificationTime(), data};
+  interfaceCacheMisses.push_back(path);
+  return data;
+}
+
+std::vector<std::string> InterfaceCache::takeMisses() {
+  std::lock_guard<std::mutex> lock(interfaceCacheMutex);
+  return std::exchange(interfaceCacheMisses, {});
+}
+
+bool Parser::readInterfaceImports(const std::string &path, const std::string &sourceHash,
+                                  std::vector<std::string> &imports) {
+  std::shared_ptr<const std::string> data = InterfaceCache::read(path);
+  if (!data)
+    return false;
+
+  InterfaceReader reader(*data);
+  return readInterfaceHeader(reader, sourceHash, imports);
+}
+
+bool Parser::loadInterface(const std::string &path, const std::string &sourceHash) {
+  std::shared_ptr<const std::string> data = InterfaceCache::read(path);
+  if (!data)
+    return false;
+
+  // a stale interface falls back to the source, past this point the interface is trusted and must be well formed
+  InterfaceReader reader(*data);
+  std::vector<std::string> imports;
+  if (!readInterfaceHeader(reader, sourceHash, imports))
+    return false;
+
+  // imports of the interface must be visible before its own declarations, just like with sources
+  auto savedFileName = currentFileName_;
+  currentFileName_ = path;
+  for (const auto &import : imports) {
+    if (!std::filesystem::exists(import))
+      emitSemanticError("Cannot import nonexistent file: '" + import + "'");
+    loadImport(import);
+  }
+  currentFileName_ = savedFileName;
+
+  std::function<ast::TypeNode *()> readType = [&]() -> ast::TypeNode * {
+    char tag;
+    if (!reader.readTag(tag))
+      return nullptr;
+
+    switch (tag) {
+    case 'p': {
+      uint32_t kind, isSigned;
+      if (!reader.readInt(kind) || !reader.readInt(isSigned))
+        return nullptr;
+      if (kind > static_cast<uint32_t>(ast::PrimitiveType::Quad))
+        return nullptr;
+      return typeTable_.getPrimitive(static_cast<ast::PrimitiveType>(kind), isSigned);
+    }
+    case '*': {
+      auto target = readType();
+      if (!target)
+        return nullptr;
+      return typeTable_.getPointer(target);
+    }
+    case '[': {
+      uint32_t length;
+      if (!reader.readInt(length))
+        return nullptr;
+      auto target = readType();
+      if (!target)
+        return nullptr;
+      return typeTable_.getArray(target, length);
+    }
+    case 'v': {
+      uint32_t lanes;
+      if (!reader.readInt(lanes))
+        return nullptr;
+      auto target = readType();
+      if (!target)
+        return nullptr;
+      return typeTable_.getVector(target, lanes);
+    }
+    case 'c': {
+      std::string name;
+      if (!reader.readString(name))
+        return nullptr;
+      return getTypeNode(symbols_.intern(name));
+    }
+    default:
+      return nullptr;
+    }
+  };
+
+  auto invalidInterface = [&]() {
+    error::SourceLocation loc(path, "", 0, 0, "");
+    error::reportError(error::ErrorType::Semantic, "Invalid interface file", &loc);
+  };
+
+  uint32_t count;
+  if (!reader.readInt(count))
+    invalidInterface();
+  for (uint32_t i = 0; i < count; i++) {
+    std::string name;
+    uint32_t value;
+    if (!reader.readString(name) || !reader.readInt(value))
+      invalidInterface();
+    insertIntDef(symbols_.intern(name), static_cast<int>(value));
+  }
+
+  if (!reader.readInt(count))
+    invalidInterface();
+  for (uint32_t i = 0; i < count; i++) {
+    std::string alias, target;
+    if (!reader.readString(alias) || !reader.readString(target))
+      invalidInterface();
+    insertTypeDef(symbols_.intern(alias), symbols_.intern(target));
+  }
+
+  if (!reader.readInt(count))
+    invalidInterface();
+  for (uint32_t i = 0; i < count; i++) {
+    std::string name;
+    uint32_t reorder, packed, align, memberCount;
+    if (!reader.readString(name) || !reader.readInt(reorder) || !reader.readInt(packed) || !reader.readInt(align) ||
+        !reader.readInt(memberCount))
+      invalidInterface();
+
+    ast::ClassAttributes attributes;
+    attributes.reorder = reorder;
+    attributes.packed = packed;
+    attributes.align = align;
+
+    // classes are registered before their members are read so members may point to their own class
+    Symbol classSymbol = symbols_.intern(name);
+    ast::ClassNode *classNode;
+    if (auto *existing = llvm::dyn_cast_or_null<ast::ClassReferenceNode>(getTypeNode(classSymbol))) {
+      classNode = existing->getDecl();
+      classNode->addAttributes(attributes);
+    } else {
+      classNode = arena_.create<ast::ClassNode>(name, std::vector<ast::ClassMember>(), attributes);
+      classes_.push_back(classNode);
+      registerStructType(classSymbol, classNode);
+    }
+
+    std::vector<ast::ClassMember> members;
+    for (uint32_t j = 0; j < memberCount; j++) {
+      std::string memberName;
+      if (!reader.readString(memberName))
+        invalidInterface();
+      auto memberType = readType();
+      if (!memberType)
+        invalidInterface();
+      members.push_back({symbols_.intern(memberName), memberType});
+    }
+    classNode->addMembers(members);
+  }
+
+  if (!reader.readInt(count))
+    invalidInterface();
+  for (uint32_t i = 0; i < count; i++) {
+    std::string name;
+    uint32_t isDetached, attributes, paramCount;
+    if (!reader.readString(name) || !reader.readInt(isDetached) || !reader.readInt(attributes))
+      invalidInterface();
+
+    auto returnType = readType();
+    if (!returnType || !reader.readInt(paramCount))
+      invalidInterface();
+
+    std::vector<ast::Parameter> params;
+    for (uint32_t j = 0; j < paramCount; j++) {
+      std::string paramName;
+      uint32_t isRestrict;
+      if (!reader.readString(paramName))
+        invalidInterface();
+      auto paramType = readType();
+      if (!paramType || !reader.readInt(isRestrict))
+        invalidInterface();
+      params.push_back({symbols_.intern(paramName), paramType, isRestrict != 0});
+    }
+
+    // interface functions are always bodyless, the definition is in the import's object
+    indexFunction(arena_.create<ast::FunctionNode>(symbols_.intern(name), returnType, decodeAttributes(attributes),
+                                                   arena_.copyArray(params), std::nullopt, isDetached));
+  }
+
+  return true;
+}
+
+} // namespace axen::parser
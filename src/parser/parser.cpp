@@ -1,14 +1,22 @@
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
-#include <fstream>
+#include <functional>
 #include <memory>
-#include <sstream>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <string>
 #include <unistd.h>
+#include <vector>
 
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <utility>
 
 #include "lexer.hpp"
@@ -16,66 +24,222 @@
 
 namespace axen::parser {
 
+/// returns the canonical path an import of fileName refers to, or nothing if the imported file does not exist.
+static std::optional<std::string> resolveImport(const std::string &importFile, const std::string &fileName) {
+  std::filesystem::path importPath = std::filesystem::path(importFile);
+
+  if (!importPath.is_absolute() && !fileName.empty()) {
+    std::filesystem::path currentDir = std::filesystem::path(fileName).parent_path();
+    importPath = currentDir / importPath;
+  }
+
+  std::error_code EC;
+  if (!std::filesystem::exists(importPath, EC))
+    return std::nullopt;
+
+  return std::filesystem::canonical(importPath).string();
+}
+
+/// returns the files the imports at the start of a file refer to, without consuming any tokens. imports that are
+/// malformed or do not exist are left for processImports to report.
+static std::vector<std::string> scanImports(lexer::Lexer &lexer, const std::string &fileName) {
+  std::vector<std::string> imports;
+
+  for (unsigned offset = 0; lexer.peekT(lexer::TokenType::Import, offset) &&
+                            lexer.peekT(lexer::TokenType::StringLit, offset + 1) &&
+                            lexer.peekT(lexer::TokenType::Semi, offset + 2);
+       offset += 3) {
+    if (auto import = resolveImport(lexer::unescape(lexer.peek(offset + 1).src), fileName))
+      imports.push_back(std::move(*import));
+  }
+
+  return imports;
+}
+
 void Parser::parse() {
-  lexer_ = std::make_shared<lexer::Lexer>(sourceCode_);
+  lexer_ = std::make_shared<lexer::Lexer>(sourceCode_, symbols_);
   currentFileName_ = rootFilePath_;
 
   if (!rootFilePath_.empty()) {
     importedFiles_.insert(std::filesystem::canonical(rootFilePath_).string());
   }
 
+  prepareImports(scanImports(*lexer_, rootFilePath_));
+
   processImports();
   parseFile();
+
+  statistics_.files++;
+  statistics_.tokens += lexer_->tokenCount();
 }
 
 void Parser::processImports() {
-  auto savedLexer = lexer_;
   auto savedFileName = currentFileName_;
 
   while (!lexer_->peekT(lexer::TokenType::EndOfFile)) {
     if (lexer_->peekT(lexer::TokenType::Import)) {
       lexer_->consume();
 
-      std::string importFile = expect(lexer::TokenType::StringLit).src;
+      std::string importFile = lexer::unescape(expect(lexer::TokenType::StringLit).src);
       expect(lexer::TokenType::Semi);
 
-      std::filesystem::path importPath = std::filesystem::path(importFile);
+      std::optional<std::string> resolved = resolveImport(importFile, savedFileName);
+      if (!resolved)
+        emitSemanticError("Cannot import nonexistent file: '" + importFile + "'");
+
+      std::string canonicalPath = *resolved;
+
+      if (isParsingRoot())
+        rootImports_.push_back(canonicalPath);
+
+      loadImport(canonicalPath);
+    } else {
+      break;
+    }
+  }
+}
+
+void Parser::prepareImports(const std::vector<std::string> &rootImports) {
+  if (rootImports.empty() || !importPool_)
+    return;
+
+  llvm::TimeTraceScope traceScope("PrepareImports");
+
+  // every file reachable through imports is read and lexed on the pool while this thread lexes the root. files only
+  // depend on each other once they are parsed, which still happens in import order
+  llvm::ThreadPoolTaskGroup group(*importPool_);
+  std::mutex mutex;
+  std::set<std::string> scheduled = importedFiles_;
 
-      if (!importPath.is_absolute() && !savedFileName.empty()) {
-        std::filesystem::path currentDir = std::filesystem::path(savedFileName).parent_path();
-        importPath = currentDir / importPath;
+  std::function<void(const std::string &)> prepare = [&](const std::string &path) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!scheduled.insert(path).second)
+        return;
+    }
+
+    group.async([&, path] {
+      // files that cannot be read are reported once the import is parsed
+      auto buffer = llvm::MemoryBuffer::getFile(path);
+      if (!buffer)
+        return;
+
+      auto prepared = std::make_unique<PreparedFile>();
+      prepared->buffer = std::move(*buffer);
+      std::string_view sourceCode = prepared->buffer->getBuffer();
+
+      std::vector<std::string> imports;
+      bool hasInterface = false;
+      if (separateImports_) {
+        prepared->sourceHash = hashSource(sourceCode);
+        hasInterface = readInterfaceImports(getInterfacePath(path), prepared->sourceHash, imports);
       }
 
-      if (!std::filesystem::exists(importPath))
-        emitSemanticError("Cannot import nonexistent file: '" + importFile + "'");
+      if (!hasInterface) {
+        prepared->lexer = std::make_unique<lexer::Lexer>(sourceCode, prepared->symbols);
+        imports = scanImports(*prepared->lexer, path);
+        prepared->lexer->lexAll();
+      }
 
-      std::string canonicalPath = std::filesystem::canonical(importPath).string();
+      for (const auto &import : imports)
+        prepare(import);
 
-      if (importedFiles_.find(canonicalPath) != importedFiles_.end())
-        continue;
+      std::lock_guard<std::mutex> lock(mutex);
+      preparedFiles_[path] = std::move(prepared);
+    });
+  };
 
-      importedFiles_.insert(canonicalPath);
+  for (const auto &import : rootImports)
+    prepare(import);
 
-      std::ifstream in(importPath);
-      std::ostringstream ss;
-      ss << in.rdbuf();
-      std::string sourceCode = ss.str();
+  lexer_->lexAll();
+  group.wait();
+}
 
-      lexer_ = std::make_shared<lexer::Lexer>(sourceCode);
-      currentFileName_ = canonicalPath;
+void Parser::loadImport(const std::string &canonicalPath) {
+  if (importedFiles_.find(canonicalPath) != importedFiles_.end())
+    return;
 
-      processImports();
-      parseFile();
+  importedFiles_.insert(canonicalPath);
 
-      lexer_ = savedLexer;
-      currentFileName_ = savedFileName;
-    } else {
-      break;
+  llvm::TimeTraceScope traceScope("Import", canonicalPath);
+  auto start = std::chrono::steady_clock::now();
+  auto recordTime = [&] {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    statistics_.importTimes.emplace_back(canonicalPath, elapsed.count());
+  };
+
+  // files are only missing here when they could not be read ahead
+  std::unique_ptr<PreparedFile> prepared;
+  if (auto it = preparedFiles_.find(canonicalPath); it != preparedFiles_.end())
+    prepared = std::move(it->second);
+
+  if (!prepared) {
+    auto buffer = llvm::MemoryBuffer::getFile(canonicalPath);
+    if (!buffer)
+      emitSemanticError("Could not read imported file: '" + canonicalPath + "'");
+
+    prepared = std::make_unique<PreparedFile>();
+    prepared->buffer = std::move(*buffer);
+  }
+
+  std::string_view sourceCode = prepared->buffer->getBuffer();
+  sourceBuffers_.push_back(std::move(prepared->buffer));
+
+  // an up to date interface replaces parsing the whole file
+  if (separateImports_) {
+    if (prepared->sourceHash.empty())
+      prepared->sourceHash = hashSource(sourceCode);
+
+    if (loadInterface(getInterfacePath(canonicalPath), prepared->sourceHash)) {
+      statistics_.interfaces++;
+      recordTime();
+      return;
     }
   }
+
+  auto savedLexer = lexer_;
+  auto savedFileName = currentFileName_;
+
+  // symbols are moved over to the shared table in the order files are parsed, so they are numbered the same way in
+  // every run
+  if (prepared->lexer) {
+    prepared->lexer->rebindSymbols(symbols_);
+    lexer_ = std::move(prepared->lexer);
+  } else {
+    lexer_ = std::make_shared<lexer::Lexer>(sourceCode, symbols_);
+  }
+  currentFileName_ = canonicalPath;
+
+  processImports();
+  parseFile();
+
+  statistics_.files++;
+  statistics_.tokens += lexer_->tokenCount();
+
+  lexer_ = savedLexer;
+  currentFileName_ = savedFileName;
+
+  recordTime();
+}
+
+void Parser::reportLexError() {
+  lexer_->lexAll();
+
+  if (const auto &error = lexer_->error()) {
+    error::SourceLocation loc(currentFileName_, "", error->row, error->col, "");
+    error::reportError(error::ErrorType::Syntax, error->message, &loc);
+  }
 }
 
 void Parser::parseFile() {
+  // files are lexed ahead on other threads, their errors wait for the file to be parsed so they are reported in
+  // import order. the whole file is lexed before it is parsed, so a lexical error comes ahead of its syntax errors
+  reportLexError();
+
+  // signatures are declared on the way through the file and bodies are parsed afterwards, so a body may call any
+  // function of the file regardless of where that function is declared
+  std::vector<PendingBody> bodies;
 
   while (!lexer_->peekT(lexer::TokenType::EndOfFile)) {
 
@@ -87,21 +251,25 @@ void Parser::parseFile() {
       break;
     case lexer::TokenType::Typedef: {
       expect(lexer::TokenType::Typedef);
-      std::string alias = expect(lexer::TokenType::Identifier).src;
-      std::string targetType = expect(lexer::TokenType::Identifier).src;
+      Symbol alias = expect(lexer::TokenType::Identifier).symbol;
+      Symbol targetType = expect(lexer::TokenType::Identifier).symbol;
 
-      insertTypeDef(alias, std::move(targetType));
+      if (isParsingRoot())
+        rootTypeDefs_.emplace_back(alias, targetType);
+
+      insertTypeDef(alias, targetType);
 
       expect(lexer::TokenType::Semi);
       break;
     }
     case lexer::TokenType::Intdef: {
       expect(lexer::TokenType::Intdef);
-      std::string alias = expect(lexer::TokenType::Identifier).src;
-      std::string intStr = expect(lexer::TokenType::IntLit).src;
+      Symbol alias = expect(lexer::TokenType::Identifier).symbol;
+      // earlier intdefs are folded in by the expression parser
+      int targetInt = parseConstantExpression(lexer::TokenType::Semi, "Value of intdef");
 
-      int base = (intStr.size() > 2 && intStr[0] == '0' && (intStr[1] == 'x' || intStr[1] == 'X')) ? 16 : 10;
-      int targetInt = std::stoi(intStr, nullptr, base);
+      if (isParsingRoot())
+        rootIntDefs_.push_back(alias);
 
       insertIntDef(alias, targetInt);
 
@@ -115,113 +283,209 @@ void Parser::parseFile() {
       auto classNameToken = expect(lexer::TokenType::Identifier);
       validateIdentifier(classNameToken.src);
       currentClassName_ = classNameToken.src;
+      ast::ClassAttributes attributes = parseClassAttributes();
+      currentClassNoInstrument_ = attributes.noInstrument;
       expect(lexer::TokenType::LBrace);
-      parseClass();
+      parseClass(bodies, attributes);
       expect(lexer::TokenType::RBrace);
       currentClassName_.clear();
+      currentClassNoInstrument_ = false;
       break;
     }
     default:
-      // parse detached function (top-level function outside any class)
-      functions_.push_back(parseFunction());
+      // declare detached function (top-level function outside any class)
+      declareFunction(bodies);
+    }
+  }
+
+  if (streaming_) {
+    // the bodies of one file share a copy of what it defined, so they still mean what they would without streaming
+    auto definitions = bodies.empty() ? nullptr : std::make_shared<const Definitions>(Definitions{types_, intDefs_});
+    for (auto &pending : bodies) {
+      pending.definitions = definitions;
+      streamedBodies_.push_back(std::move(pending));
+    }
+    return;
+  }
+
+  // the tokens are already buffered, so jumping back to each body does not lex the file again
+  for (const auto &pending : bodies)
+    parseFunctionBody(pending);
+}
+
+void Parser::streamBodies(const std::function<void(ast::FunctionNode *)> &generate) {
+  auto savedLexer = lexer_;
+  auto savedFileName = currentFileName_;
+  Definitions savedDefinitions{std::move(types_), std::move(intDefs_)};
+
+  ast::Arena bodyArena;
+  nodes_ = &bodyArena;
+
+  // the bodies of a file are next to each other, so the definitions are only copied in once per file
+  std::shared_ptr<const Definitions> current;
+  for (auto &pending : streamedBodies_) {
+    lexer_ = pending.lexer;
+    currentFileName_ = pending.fileName;
+
+    if (pending.definitions != current) {
+      current = pending.definitions;
+      types_ = current->types;
+      intDefs_ = current->intDefs;
+    }
+
+    parseFunctionBody(pending);
+    generate(pending.function);
+
+    statistics_.streamedNodes += bodyArena.nodeCount();
+    statistics_.peakBodyBytes = std::max(statistics_.peakBodyBytes, bodyArena.bytesAllocated());
+    pending.function->releaseBody();
+    bodyArena.reset();
+
+    // the tokens of a file are freed along with its last body, its definitions once the next file starts
+    pending.lexer.reset();
+    pending.definitions.reset();
+  }
+
+  streamedBodies_.clear();
+  streamedBodies_.shrink_to_fit();
+  nodes_ = &arena_;
+  lexer_ = savedLexer;
+  currentFileName_ = savedFileName;
+  types_ = std::move(savedDefinitions.types);
+  intDefs_ = std::move(savedDefinitions.intDefs);
+}
+
+ast::ClassAttributes Parser::parseClassAttributes() {
+  ast::ClassAttributes attributes;
+
+  // attributes are plain identifiers, so they stay usable as names everywhere else
+  while (lexer_->peekT(lexer::TokenType::Identifier)) {
+    std::string attribute(lexer_->consume().src);
+
+    if (attribute == "reorder") {
+      attributes.reorder = true;
+    } else if (attribute == "packed") {
+      attributes.packed = true;
+    } else if (attribute == "noinstrument") {
+      attributes.noInstrument = true;
+    } else if (attribute == "align") {
+      expect(lexer::TokenType::LParen);
+      uint64_t align = parseIntLiteral();
+
+      if (align == 0 || align > (1u << 29) || (align & (align - 1)) != 0)
+        emitSemanticError("Class alignment must be a power of two, got " + std::to_string(align));
+
+      attributes.align = align;
+      expect(lexer::TokenType::RParen);
+    } else {
+      emitSyntaxError("Unknown class attribute '" + attribute + "'");
     }
   }
+
+  return attributes;
 }
 
-void Parser::parseClass() {
+void Parser::parseClass(std::vector<PendingBody> &bodies, const ast::ClassAttributes &attributes) {
 
-  auto savedState = lexer_->saveState();
+  // kept in declaration order, the layout only departs from it when the class asks for reorder
+  std::vector<ast::ClassMember> members;
+  llvm::DenseSet<Symbol> memberNames;
 
-  std::map<std::string, std::shared_ptr<ast::TypeNode>> members;
+  // methods need the finished member layout, so only their starting positions are recorded on the way through
+  std::vector<lexer::Lexer::LexerState> methods;
 
-  // first pass, parse member variables
   while (lexer_->peek().type != lexer::TokenType::EndOfFile && lexer_->peek().type != lexer::TokenType::RBrace) {
 
+    auto memberStart = lexer_->saveState();
+
+    // methods are parsed again from their start, the annotations are only skipped here to reach the member name.
+    // an identifier that does not name a type can only start annotations
+    bool isAnnotated = lexer_->peekT(lexer::TokenType::Identifier) && !peekTypeNode();
+    parseFunctionAttributes();
+
     auto type = parseType();
     auto token = expect(lexer::TokenType::Identifier);
     validateIdentifier(token.src);
 
     if (!lexer_->peekT(lexer::TokenType::LParen)) {
-      expect(lexer::TokenType::Semi);
+      if (isAnnotated)
+        emitSemanticError("Only methods can be annotated, '" + std::string(token.src) + "' is a data member");
 
-      members[token.src] = type;
-      continue;
-    }
+      if (!memberNames.insert(token.symbol).second)
+        emitSemanticError("Duplicate member '" + std::string(token.src) + "' in class '" + currentClassName_ + "'");
 
-    // skip functions
-    // type and identifier have already been consumed
+      expect(lexer::TokenType::Semi);
 
-    expect(lexer::TokenType::LParen);
-    while (lexer_->peek().type != lexer::TokenType::RParen) {
-      if (lexer_->peek().type != lexer::TokenType::RParen && lexer_->peek().type != lexer::TokenType::Comma) {
-        parseType();
-        auto token = expect(lexer::TokenType::Identifier);
-        validateIdentifier(token.src);
-      }
-      if (lexer_->peekT(lexer::TokenType::Comma))
-        lexer_->consume();
+      members.push_back({token.symbol, type});
+      continue;
     }
-    expect(lexer::TokenType::RParen);
 
-    if (lexer_->peekT(lexer::TokenType::LBrace)) {
-      lexer_->consume();
-      int braceDepth = 1;
-      while (braceDepth > 0 && lexer_->peek().type != lexer::TokenType::EndOfFile) {
-        if (lexer_->peek().type == lexer::TokenType::LBrace) {
-          braceDepth++;
-        } else if (lexer_->peek().type == lexer::TokenType::RBrace) {
-          braceDepth--;
-        }
-        lexer_->consume();
-      }
-    } else {
-      expect(lexer::TokenType::Semi);
-    }
+    methods.push_back(memberStart);
+    skipFunction();
   }
 
+  auto classEnd = lexer_->saveState();
+
   // create struct for data members
   if (!currentClassName_.empty() && !members.empty()) {
     // check if class already exists
-    auto existingType = getTypeNode(currentClassName_);
+    Symbol classSymbol = symbols_.intern(currentClassName_);
+    auto existingType = getTypeNode(classSymbol);
     if (existingType) {
       // class exists, add members to it
-      auto classRef = std::dynamic_pointer_cast<ast::ClassReferenceNode>(existingType);
+      auto *classRef = llvm::dyn_cast<ast::ClassReferenceNode>(existingType);
       if (classRef) {
         classRef->getDecl()->addMembers(members);
+        classRef->getDecl()->addAttributes(attributes);
+
+        auto decl = classRef->getDecl();
+        if (isParsingRoot() && std::find(rootClasses_.begin(), rootClasses_.end(), decl) == rootClasses_.end())
+          rootClasses_.push_back(decl);
       }
     } else {
       // class doesn't exist, create it
-      auto classNode = std::make_shared<ast::ClassNode>(currentClassName_, std::move(members));
+      auto *classNode = arena_.create<ast::ClassNode>(currentClassName_, std::move(members), attributes);
       classes_.push_back(classNode);
-      registerStructType(currentClassName_, classNode);
+      registerStructType(classSymbol, classNode);
+
+      if (isParsingRoot())
+        rootClasses_.push_back(classNode);
     }
   }
 
-  // second pass to parse functions.
-  lexer_->restoreState(savedState);
-  parseFunctions();
+  // the tokens are already buffered, so jumping back to each method does not lex the class again
+  for (const auto &method : methods) {
+    lexer_->restoreState(method);
+    declareFunction(bodies);
+  }
+  lexer_->restoreState(classEnd);
 }
 
-// NOTE: this function only parses class functions. it only parses within the class
-void Parser::parseFunctions() {
-
-  while (lexer_->peek().type != lexer::TokenType::EndOfFile && lexer_->peek().type != lexer::TokenType::RBrace) {
-    switch (lexer_->peek().type) {
+// NOTE: the type and name of the function have already been consumed, its signature is checked by declareFunction
+void Parser::skipFunction() {
+  expect(lexer::TokenType::LParen);
+  while (lexer_->peek().type != lexer::TokenType::RParen && lexer_->peek().type != lexer::TokenType::EndOfFile)
+    lexer_->consume();
+  expect(lexer::TokenType::RParen);
 
-    case lexer::TokenType::Typedef:
-      lexer_->consume();
+  if (!lexer_->peekT(lexer::TokenType::LBrace)) {
+    expect(lexer::TokenType::Semi);
+    return;
+  }
 
-    default:
-      if (lexer_->peekT(lexer::TokenType::LParen, getNextTypeLength() + 1)) {
-        functions_.push_back(parseFunction());
-        continue;
-      }
+  skipBody();
+}
 
-      // must be a class data member. skip it
-      parseType();
-      expect(lexer::TokenType::Identifier);
-      expect(lexer::TokenType::Semi);
+void Parser::skipBody() {
+  expect(lexer::TokenType::LBrace);
+  int braceDepth = 1;
+  while (braceDepth > 0 && lexer_->peek().type != lexer::TokenType::EndOfFile) {
+    if (lexer_->peek().type == lexer::TokenType::LBrace) {
+      braceDepth++;
+    } else if (lexer_->peek().type == lexer::TokenType::RBrace) {
+      braceDepth--;
     }
+    lexer_->consume();
   }
 }
 
@@ -1,7 +1,9 @@
-#include <memory>
 #include <optional>
+#include <string>
 #include <utility>
 
+#include <llvm/Support/Casting.h>
+
 #include "lexer.hpp"
 #include "nodes/expression.hpp"
 #include "nodes/statement.hpp"
@@ -10,7 +12,7 @@
 
 namespace axen::parser {
 /// Consumes a statement and returns the resulting StatementNode
-std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
+ast::StatementNode *Parser::parseStatement() {
 
   /*
    * Statement types:
@@ -18,7 +20,7 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
    * variable decl + assignment [type] [name] [equals] [EXPR] [semi]
    * variable assignment [name] [equals] [EXPR] [semi]
    * return [return] [EXPR] [semi]
-   * while [while] [lparen] [EXPR] [rparen] [STMT ... ] [else]
+   * while [while] [lparen] [EXPR] [rparen] *[HINT ...] [STMT ... ]
    * if [while] [lparen] [EXPR] [rparen] [STMT ... ] [else] *[STMT ... ]
    * expression [EXPR] [semi]
    */
@@ -30,14 +32,14 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
     if (lexer_->peekT(lexer::TokenType::Semi)) {
       lexer_->consume();
 
-      return std::make_unique<ast::Return>(nullptr);
+      return nodes_->create<ast::Return>(nullptr);
 
     } else {
 
-      std::unique_ptr<ast::ExpressionNode> returnValue = parseExpression(lexer::TokenType::Semi);
+      ast::ExpressionNode *returnValue = parseExpression(lexer::TokenType::Semi);
       expect(lexer::TokenType::Semi);
 
-      return std::make_unique<ast::Return>(std::move(returnValue));
+      return nodes_->create<ast::Return>(returnValue);
     }
   }
   case lexer::TokenType::If: {
@@ -45,13 +47,13 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
     lexer_->consume();
 
     expect(lexer::TokenType::LParen);
-    std::unique_ptr<ast::ExpressionNode> condition = parseExpression(lexer::TokenType::RParen);
+    ast::ExpressionNode *condition = parseExpression(lexer::TokenType::RParen);
     expect(lexer::TokenType::RParen);
 
     expect(lexer::TokenType::LBrace);
 
-    std::vector<std::unique_ptr<ast::StatementNode>> trueBody;
-    std::optional<std::vector<std::unique_ptr<ast::StatementNode>>> falseBody;
+    std::vector<ast::StatementNode *> trueBody;
+    std::optional<std::vector<ast::StatementNode *>> falseBody;
 
     // parse the scope
     // NOTE: we should not need to keep track of braces in becuase parseStatement should consume rbrace before the loop
@@ -64,9 +66,9 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
       // consume the else
       lexer_->consume();
 
-      falseBody = std::vector<std::unique_ptr<ast::StatementNode>>();
+      falseBody = std::vector<ast::StatementNode *>();
 
-      falseBody = std::vector<std::unique_ptr<ast::StatementNode>>();
+      falseBody = std::vector<ast::StatementNode *>();
       while (!lexer_->peekT(lexer::TokenType::RBrace)) {
         falseBody->emplace_back(parseStatement());
       }
@@ -74,19 +76,25 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
       expect(lexer::TokenType::RBrace);
     }
 
-    return std::make_unique<ast::If>(std::move(condition), std::move(trueBody), std::move(falseBody));
+    std::optional<llvm::ArrayRef<ast::StatementNode *>> falseStatements;
+    if (falseBody)
+      falseStatements = nodes_->copyArray(*falseBody);
+
+    return nodes_->create<ast::If>(condition, nodes_->copyArray(trueBody), falseStatements);
   }
   case lexer::TokenType::While: {
 
     lexer_->consume();
 
     expect(lexer::TokenType::LParen);
-    std::unique_ptr<ast::ExpressionNode> condition = parseExpression(lexer::TokenType::RParen);
+    ast::ExpressionNode *condition = parseExpression(lexer::TokenType::RParen);
     expect(lexer::TokenType::RParen);
 
+    ast::LoopHints hints = parseLoopHints();
+
     expect(lexer::TokenType::LBrace);
 
-    std::vector<std::unique_ptr<ast::StatementNode>> body;
+    std::vector<ast::StatementNode *> body;
 
     // parse the scope
     while (!lexer_->peekT(lexer::TokenType::RBrace)) {
@@ -95,22 +103,21 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
 
     expect(lexer::TokenType::RBrace);
 
-    return std::make_unique<ast::While>(std::move(condition), std::move(body));
+    return nodes_->create<ast::While>(condition, nodes_->copyArray(body), hints);
   }
   default:
     break;
   }
 
   // consumes the type (along with any type mods)
-  std::shared_ptr<ast::TypeNode> type = parseType();
+  ast::TypeNode *type = parseType();
 
   if (type) {
     // should be a variable decleration with optional assignment
     auto nameToken = expect(lexer::TokenType::Identifier);
     validateIdentifier(nameToken.src);
-    std::string name = nameToken.src;
 
-    std::unique_ptr<ast::ExpressionNode> initialValue = nullptr;
+    ast::ExpressionNode *initialValue = nullptr;
 
     if (lexer_->peekT(lexer::TokenType::Equals)) {
       // should be variable declearation WITH assignment
@@ -120,19 +127,19 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
 
     expect(lexer::TokenType::Semi);
 
-    Parser::indexVariableType(name, type);
+    Parser::indexVariableType(nameToken.symbol, type);
 
-    return std::make_unique<ast::VariableDeclaration>(type, std::move(name), std::move(initialValue));
+    return nodes_->create<ast::VariableDeclaration>(type, nameToken.symbol, initialValue);
   } else {
 
     // check if it's a detatched function call first
     if (lexer_->peekT(lexer::TokenType::Identifier) && lexer_->peekT(lexer::TokenType::LParen, 1)) {
       auto nameToken = expect(lexer::TokenType::Identifier);
       validateIdentifier(nameToken.src);
-      std::string name = nameToken.src;
+      std::string name(nameToken.src);
       expect(lexer::TokenType::LParen);
 
-      auto functionArgs = std::vector<std::unique_ptr<ast::ExpressionNode>>();
+      auto functionArgs = std::vector<ast::ExpressionNode *>();
       while (lexer_->peek().type != lexer::TokenType::RParen) {
         functionArgs.emplace_back(parseExpression(lexer::TokenType::Comma));
         if (lexer_->peek().type == lexer::TokenType::Comma) {
@@ -143,10 +150,13 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
 
       expect(lexer::TokenType::Semi);
 
-      auto functionReturnType = Parser::lookupFunctionReturnType(name);
+      auto functionReturnType = Parser::lookupFunctionReturnType(nameToken.symbol);
 
-      if (!functionReturnType)
+      if (!functionReturnType) {
+        if (auto *builtin = createBuiltinCall(name, functionArgs))
+          return nodes_->create<ast::ExpressionStatement>(builtin);
         emitSemanticError("Call to undefined function '" + name + "'");
+      }
 
       // check if this is a member function call without an instance
       if (!currentClassName_.empty() && name.find("_") != std::string::npos) {
@@ -155,26 +165,60 @@ std::unique_ptr<ast::StatementNode> Parser::parseStatement() {
           emitSemanticError("Cannot call member function '" + name + "' without an instance of the class");
       }
 
-      auto call = std::make_unique<ast::FunctionCall>(name, std::move(functionArgs), functionReturnType->isSigned());
-      return std::make_unique<ast::ExpressionStatement>(std::move(call));
+      auto *call = nodes_->create<ast::FunctionCall>(nameToken.symbol, nodes_->copyArray(functionArgs),
+                                                     functionReturnType->isSigned());
+      return nodes_->create<ast::ExpressionStatement>(call);
     }
 
     // parse lvalue
     auto [target, derivedType] = parseValue();
 
     // check if this is a method call statement
-    if (dynamic_cast<ast::FunctionCall *>(target.get())) {
+    if (llvm::isa<ast::FunctionCall>(target)) {
       expect(lexer::TokenType::Semi);
-      return std::make_unique<ast::ExpressionStatement>(std::move(target));
+      return nodes_->create<ast::ExpressionStatement>(target);
     }
 
     expect(lexer::TokenType::Equals);
 
-    std::unique_ptr<ast::ExpressionNode> newValue = parseExpression(lexer::TokenType::Semi);
+    ast::ExpressionNode *newValue = parseExpression(lexer::TokenType::Semi);
 
     expect(lexer::TokenType::Semi);
 
-    return std::make_unique<ast::AssignmentStatement>(std::move(target), std::move(newValue));
+    return nodes_->create<ast::AssignmentStatement>(target, newValue);
+  }
+}
+
+ast::LoopHints Parser::parseLoopHints() {
+  ast::LoopHints hints;
+
+  // like class attributes, hints are plain identifiers so they stay usable as names everywhere else
+  while (lexer_->peekT(lexer::TokenType::Identifier)) {
+    std::string hint(lexer_->consume().src);
+
+    if (hint == "unroll") {
+      expect(lexer::TokenType::LParen);
+      hints.unroll = parseConstantExpression(lexer::TokenType::RParen, "Unroll count");
+      if (hints.unroll <= 0)
+        emitSemanticError("Unroll count must be positive");
+      expect(lexer::TokenType::RParen);
+    } else if (hint == "nounroll") {
+      hints.noUnroll = true;
+    } else if (hint == "vectorize") {
+      expect(lexer::TokenType::LParen);
+      hints.vectorize = parseConstantExpression(lexer::TokenType::RParen, "Vectorize width");
+      if (hints.vectorize <= 0 || (hints.vectorize & (hints.vectorize - 1)) != 0)
+        emitSemanticError("Vectorize width must be a power of two");
+      expect(lexer::TokenType::RParen);
+    } else {
+      emitSyntaxError("Unknown loop hint '" + hint + "'");
+    }
   }
+
+  if (hints.unroll != 0 && hints.noUnroll)
+    emitSemanticError("A loop cannot be both unrolled and not unrolled");
+
+  return hints;
 }
+
 } // namespace axen::parser
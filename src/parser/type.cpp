@@ -1,4 +1,7 @@
-#include <memory>
+#include <string>
+#include <string_view>
+
+#include <llvm/Support/Casting.h>
 
 #include "lexer.hpp"
 #include "nodes/types.hpp"
@@ -7,7 +10,7 @@
 namespace axen::parser {
 
 /// Consumes a type (including type mods) and returns the resulting TypeNode. Returns nullptr if no type exists.
-std::shared_ptr<ast::TypeNode> Parser::parseType() {
+ast::TypeNode *Parser::parseType() {
   int ptrs = 0;
 
   while (lexer_->peekT(lexer::TokenType::Ptr)) {
@@ -15,31 +18,42 @@ std::shared_ptr<ast::TypeNode> Parser::parseType() {
     lexer_->consume();
   }
 
-  std::shared_ptr<ast::TypeNode> newType = getTypeNode(lexer_->peek().src);
+  ast::TypeNode *newType = peekTypeNode();
 
   if (newType) {
     lexer_->consume();
 
+    // a vector suffix is an identifier itself, it only counts as one when the declared name still follows it
+    if (int lanes = peekVectorLanes(0); lanes && (lexer_->peekT(lexer::TokenType::Identifier, 1) ||
+                                                   lexer_->peekT(lexer::TokenType::LBracket, 1))) {
+      lexer_->consume();
+
+      auto *element = llvm::dyn_cast<ast::PrimitiveTypeNode>(newType);
+      if (!element || element->type() == ast::PrimitiveType::Void || element->type() == ast::PrimitiveType::Bool)
+        emitSemanticError("Vector element type must be an integer or floating point type");
+
+      newType = typeTable_.getVector(newType, lanes);
+    }
+
     // because 0 arraylen means not an array
     int arrayLen = 0;
 
     // parse array mod
     if (lexer_->peekT(lexer::TokenType::LBracket)) {
       lexer_->consume();
-      std::string intStr = expect(lexer::TokenType::IntLit).src;
-
-      int base = (intStr.size() > 2 && intStr[0] == '0' && (intStr[1] == 'x' || intStr[1] == 'X')) ? 16 : 10;
-      arrayLen = std::stoi(intStr, nullptr, base);
+      arrayLen = parseConstantExpression(lexer::TokenType::RBracket, "Array length");
+      if (arrayLen <= 0)
+        emitSemanticError("Array length must be positive, got " + std::to_string(arrayLen));
 
       expect(lexer::TokenType::RBracket);
     }
 
     for (int i = 0; i < ptrs; i++) {
-      newType = std::make_shared<ast::PointerTypeNode>(newType);
+      newType = typeTable_.getPointer(newType);
     }
 
     if (arrayLen) {
-      newType = std::make_shared<ast::ArrayTypeNode>(newType, arrayLen);
+      newType = typeTable_.getArray(newType, arrayLen);
     }
 
     return newType;
@@ -48,6 +62,24 @@ std::shared_ptr<ast::TypeNode> Parser::parseType() {
   }
 }
 
+/// returns the lane count if the token at offset is a vector suffix like x8, otherwise 0.
+int Parser::peekVectorLanes(int offset) {
+  if (!lexer_->peekT(lexer::TokenType::Identifier, offset))
+    return 0;
+
+  std::string_view suffix = lexer_->peek(offset).src;
+  if (suffix.size() < 2 || suffix.size() > 5 || suffix[0] != 'x')
+    return 0;
+
+  int lanes = 0;
+  for (char c : suffix.substr(1)) {
+    if (c < '0' || c > '9')
+      return 0;
+    lanes = lanes * 10 + (c - '0');
+  }
+  return lanes;
+}
+
 /// peeks tokens to find the length of the next type, no tokens are consumed
 int Parser::getNextTypeLength() {
 
@@ -59,15 +91,21 @@ int Parser::getNextTypeLength() {
   if (lexer_->peekT(lexer::TokenType::Identifier, i))
     i++;
 
+  if (peekVectorLanes(i) &&
+      (lexer_->peekT(lexer::TokenType::Identifier, i + 1) || lexer_->peekT(lexer::TokenType::LBracket, i + 1)))
+    i++;
+
   // parse array mod
   if (lexer_->peekT(lexer::TokenType::LBracket, i)) {
     i++;
 
-    if (lexer_->peekT(lexer::TokenType::IntLit, i))
-      i++;
-
-    if (lexer_->peekT(lexer::TokenType::RBracket, i))
-      i++;
+    // the length may be any constant expression, so skip to the matching bracket
+    for (int depth = 1; depth > 0 && !lexer_->peekT(lexer::TokenType::EndOfFile, i); i++) {
+      if (lexer_->peekT(lexer::TokenType::LBracket, i))
+        depth++;
+      else if (lexer_->peekT(lexer::TokenType::RBracket, i))
+        depth--;
+    }
   }
   return i;
 }
@@ -1,4 +1,4 @@
-#include <memory>
+#include <llvm/Support/Casting.h>
 
 #include "nodes/expression.hpp"
 #include "nodes/types.hpp"
@@ -6,7 +6,7 @@
 
 namespace axen::parser {
 
-std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>> Parser::parseValue() {
+std::pair<ast::ExpressionNode *, ast::TypeNode *> Parser::parseValue() {
 
   // handle prefix dereferences
   int drefs = 0;
@@ -25,33 +25,32 @@ std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>>
   // get lvalue name
   auto nameToken = expect(lexer::TokenType::Identifier);
   validateIdentifier(nameToken.src);
-  auto name = nameToken.src;
+  std::string name(nameToken.src);
 
   // find variable type
-  std::shared_ptr<ast::TypeNode> derivedType = Parser::lookupVariableType(name);
-  std::unique_ptr<ast::ExpressionNode> target;
+  ast::TypeNode *derivedType = Parser::lookupVariableType(nameToken.symbol);
+  ast::ExpressionNode *target;
 
   if (derivedType) {
     // must be a local (non-member) variable
-    target = std::make_unique<ast::VariableReference>(name, derivedType->isSigned());
+    target = nodes_->create<ast::VariableReference>(nameToken.symbol, derivedType->isSigned());
   } else {
     // ensure a member function and this is a member variable
-    auto thisType = Parser::lookupVariableType("this");
+    auto thisType = Parser::lookupVariableType(thisSymbol_);
     if (thisType) {
-      auto thisPtrType = std::dynamic_pointer_cast<ast::PointerTypeNode>(thisType);
+      auto *thisPtrType = llvm::dyn_cast<ast::PointerTypeNode>(thisType);
       if (thisPtrType) {
-        auto classRefType = std::dynamic_pointer_cast<ast::ClassReferenceNode>(thisPtrType->target());
+        auto *classRefType = llvm::dyn_cast<ast::ClassReferenceNode>(thisPtrType->target());
         if (classRefType) {
-          std::shared_ptr<ast::ClassNode> structDecl = classRefType->getDecl();
-          auto fieldType = structDecl->lookupMemberType(name);
+          ast::ClassNode *structDecl = classRefType->getDecl();
+          auto fieldType = structDecl->lookupMemberType(nameToken.symbol);
           if (fieldType) {
             // member variable access via implicit 'this' pointer
-            auto thisRef = std::make_unique<ast::VariableReference>("this", thisType->isSigned());
+            auto *thisRef = nodes_->create<ast::VariableReference>(thisSymbol_, thisType->isSigned());
             auto targetType = thisPtrType->target();
-            auto derefThis =
-                std::make_unique<ast::Dref>(std::move(thisRef), targetType, thisPtrType->target()->isSigned());
-            target = std::make_unique<ast::StructAccess>(std::move(derefThis), name, structDecl->getName(),
-                                                         fieldType->isSigned(), classRefType);
+            auto *derefThis = nodes_->create<ast::Dref>(thisRef, targetType, thisPtrType->target()->isSigned());
+            target =
+                nodes_->create<ast::StructAccess>(derefThis, nameToken.symbol, fieldType->isSigned(), classRefType);
             derivedType = fieldType;
           }
         }
@@ -65,12 +64,12 @@ std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>>
 
   // apply prefix dereferences
   for (int i = 0; i < drefs; i++) {
-    auto ptrType = std::dynamic_pointer_cast<ast::PointerTypeNode>(derivedType);
+    auto *ptrType = llvm::dyn_cast<ast::PointerTypeNode>(derivedType);
     if (!ptrType) {
       emitSemanticError("Cannot dereference non-pointer type");
     }
     derivedType = ptrType->target();
-    target = std::make_unique<ast::Dref>(std::move(target), derivedType, derivedType->isSigned());
+    target = nodes_->create<ast::Dref>(target, derivedType, derivedType->isSigned());
   }
 
   // handle postfix operations in loop
@@ -78,16 +77,16 @@ std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>>
     if (lexer_->peekT(lexer::TokenType::Period)) {
       lexer_->consume();
 
-      auto structType = std::dynamic_pointer_cast<ast::ClassReferenceNode>(derivedType);
+      auto *structType = llvm::dyn_cast<ast::ClassReferenceNode>(derivedType);
 
       // auto dereference if derivedType is a pointer to a struct
       if (!structType) {
-        auto ptrType = std::dynamic_pointer_cast<ast::PointerTypeNode>(derivedType);
+        auto *ptrType = llvm::dyn_cast<ast::PointerTypeNode>(derivedType);
         if (ptrType) {
-          structType = std::dynamic_pointer_cast<ast::ClassReferenceNode>(ptrType->target());
+          structType = llvm::dyn_cast<ast::ClassReferenceNode>(ptrType->target());
           if (structType) {
             derivedType = ptrType->target();
-            target = std::make_unique<ast::Dref>(std::move(target), derivedType, derivedType->isSigned());
+            target = nodes_->create<ast::Dref>(target, derivedType, derivedType->isSigned());
           }
         }
       }
@@ -104,20 +103,21 @@ std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>>
 
       auto fieldToken = expect(lexer::TokenType::Identifier);
       validateIdentifier(fieldToken.src);
-      auto fieldName = fieldToken.src;
+      std::string fieldName(fieldToken.src);
 
       // check for member method call
       if (lexer_->peekT(lexer::TokenType::LParen)) {
-        std::shared_ptr<ast::ClassNode> structDecl = structType->getDecl();
+        ast::ClassNode *structDecl = structType->getDecl();
         std::string methodName = structDecl->getName() + "_" + fieldName;
+        Symbol methodSymbol = symbols_.intern(methodName);
 
         lexer_->consume(); // consume lParen
 
-        auto functionArgs = std::vector<std::unique_ptr<ast::ExpressionNode>>();
+        auto functionArgs = std::vector<ast::ExpressionNode *>();
 
         // First argument is 'this' - take address of the target
-        auto thisArg = std::make_unique<ast::AddressOf>(std::move(target), derivedType->isSigned());
-        functionArgs.push_back(std::move(thisArg));
+        auto *thisArg = nodes_->create<ast::AddressOf>(target, derivedType->isSigned());
+        functionArgs.push_back(thisArg);
 
         // Parse remaining arguments
         while (lexer_->peek().type != lexer::TokenType::RParen) {
@@ -128,38 +128,37 @@ std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>>
         }
         lexer_->consume(); // consume ')'
 
-        auto functionReturnType = Parser::lookupFunctionReturnType(methodName);
+        auto functionReturnType = Parser::lookupFunctionReturnType(methodSymbol);
 
         if (!functionReturnType) {
           emitSemanticError("Call to undefined member method '" + methodName + "'");
         }
 
-        auto call =
-            std::make_unique<ast::FunctionCall>(methodName, std::move(functionArgs), functionReturnType->isSigned());
-        return {std::move(call), functionReturnType};
+        auto *call = nodes_->create<ast::FunctionCall>(methodSymbol, nodes_->copyArray(functionArgs),
+                                                       functionReturnType->isSigned());
+        return {call, functionReturnType};
       }
 
       const std::string &structName = structType->name();
-      std::shared_ptr<ast::ClassNode> structDecl = structType->getDecl();
+      ast::ClassNode *structDecl = structType->getDecl();
 
-      auto fieldType = structDecl->lookupMemberType(fieldName);
+      auto fieldType = structDecl->lookupMemberType(fieldToken.symbol);
 
       if (!fieldType) {
         emitSemanticError("Struct '" + structName + "' has no member '" + fieldName + "'");
       }
 
-      target = std::make_unique<ast::StructAccess>(std::move(target), fieldName, structName, fieldType->isSigned(),
-                                                   structType);
+      target = nodes_->create<ast::StructAccess>(target, fieldToken.symbol, fieldType->isSigned(), structType);
       derivedType = fieldType;
 
       // apply member dereferences
       for (int i = 0; i < memDrefs; i++) {
-        auto ptrType = std::dynamic_pointer_cast<ast::PointerTypeNode>(derivedType);
+        auto *ptrType = llvm::dyn_cast<ast::PointerTypeNode>(derivedType);
         if (!ptrType)
           emitSemanticError("Cannot dereference non-pointer type");
 
         derivedType = ptrType->target();
-        target = std::make_unique<ast::Dref>(std::move(target), derivedType, derivedType->isSigned());
+        target = nodes_->create<ast::Dref>(target, derivedType, derivedType->isSigned());
       }
 
     } else if (lexer_->peekT(lexer::TokenType::LBracket)) {
@@ -172,33 +171,35 @@ std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>>
 
       lexer_->consume(); // consume lBracket
 
-      auto arrayType = std::dynamic_pointer_cast<ast::ArrayTypeNode>(derivedType);
-      auto ptrType = std::dynamic_pointer_cast<ast::PointerTypeNode>(derivedType);
+      auto *arrayType = llvm::dyn_cast<ast::ArrayTypeNode>(derivedType);
+      auto *ptrType = llvm::dyn_cast<ast::PointerTypeNode>(derivedType);
+      auto *vectorType = llvm::dyn_cast<ast::VectorTypeNode>(derivedType);
 
-      if (!arrayType && !ptrType)
-        emitSemanticError("Cannot apply subscript operator to non-array/non-pointer type");
+      if (!arrayType && !ptrType && !vectorType)
+        emitSemanticError("Cannot apply subscript operator to non-array/non-pointer/non-vector type");
 
-      std::unique_ptr<ast::ExpressionNode> indexExpression = parseExpression(lexer::TokenType::RBracket);
+      ast::ExpressionNode *indexExpression = parseExpression(lexer::TokenType::RBracket);
       expect(lexer::TokenType::RBracket);
 
       if (arrayType) {
-        target = std::make_unique<ast::ArrayAccess>(std::move(target), std::move(indexExpression),
-                                                    arrayType->isSigned(), arrayType);
+        target = nodes_->create<ast::ArrayAccess>(target, indexExpression, arrayType->isSigned(), arrayType);
         derivedType = arrayType->target();
+      } else if (vectorType) {
+        target = nodes_->create<ast::LaneAccess>(target, indexExpression, vectorType->isSigned(), vectorType);
+        derivedType = vectorType->target();
       } else {
-        target = std::make_unique<ast::PtrIndexAccess>(std::move(target), std::move(indexExpression),
-                                                       ptrType->isSigned(), ptrType);
+        target = nodes_->create<ast::PtrIndexAccess>(target, indexExpression, ptrType->isSigned(), ptrType);
         derivedType = ptrType->target();
       }
 
       // apply postfix dereferences
       for (int i = 0; i < memDrefs; i++) {
-        auto ptrType = std::dynamic_pointer_cast<ast::PointerTypeNode>(derivedType);
+        auto *ptrType = llvm::dyn_cast<ast::PointerTypeNode>(derivedType);
         if (!ptrType)
           emitSemanticError("Cannot dereference non-pointer type");
 
         derivedType = ptrType->target();
-        target = std::make_unique<ast::Dref>(std::move(target), derivedType, derivedType->isSigned());
+        target = nodes_->create<ast::Dref>(target, derivedType, derivedType->isSigned());
       }
     } else {
       break;
@@ -207,10 +208,10 @@ std::pair<std::unique_ptr<ast::ExpressionNode>, std::shared_ptr<ast::TypeNode>>
 
   // apply address-of operator
   if (addressOf) {
-    target = std::make_unique<ast::AddressOf>(std::move(target), derivedType->isSigned());
+    target = nodes_->create<ast::AddressOf>(target, derivedType->isSigned());
   }
 
-  return {std::move(target), derivedType};
+  return {target, derivedType};
 }
 
 } // namespace axen::parser
@@ -0,0 +1,63 @@
+#include <cstdint>
+#include <string_view>
+
+#include "symbol.hpp"
+
+namespace axen {
+
+namespace {
+
+constexpr size_t initialSlots = 1024;
+
+// fnv-1a, identifiers are short so anything heavier does not pay for itself
+uint32_t hashName(std::string_view name) {
+  uint32_t hash = 2166136261u;
+  for (char c : name) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+
+SymbolTable::SymbolTable() : slots_(initialSlots, 0) {}
+
+Symbol SymbolTable::intern(std::string_view name) {
+  uint32_t hash = hashName(name);
+  size_t mask = slots_.size() - 1;
+
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint32_t entry = slots_[slot];
+
+    if (entry == 0) {
+      Symbol symbol = static_cast<Symbol>(names_.size());
+      names_.emplace_back(name);
+      hashes_.push_back(hash);
+      slots_[slot] = symbol + 1;
+
+      // keep the load factor under one half so probe runs stay short
+      if (names_.size() * 2 > slots_.size())
+        grow();
+
+      return symbol;
+    }
+
+    if (hashes_[entry - 1] == hash && names_[entry - 1] == name)
+      return entry - 1;
+  }
+}
+
+void SymbolTable::grow() {
+  slots_.assign(slots_.size() * 2, 0);
+  size_t mask = slots_.size() - 1;
+
+  for (Symbol symbol = 0; symbol < names_.size(); symbol++) {
+    size_t slot = hashes_[symbol] & mask;
+    while (slots_[slot] != 0)
+      slot = (slot + 1) & mask;
+    slots_[slot] = symbol + 1;
+  }
+}
+
+} // namespace axen
@@ -0,0 +1,63 @@
+// the c side of abi.ax, the structs match its classes member for member
+#include <stdio.h>
+
+struct Pair { int a, b; };
+struct Big { long a, b, c; };
+struct Mixed { float x; int y; };
+struct Doubles { double x, y; };
+struct LongDouble { long a; double b; };
+struct Small { short a; char b; };
+struct Quad { __float128 q; };
+
+struct Pair makePair(int a, int b);
+long sumBig(struct Big b);
+struct Big makeBig(long a);
+int sumMixed(struct Mixed m);
+struct Doubles swap(struct Doubles d);
+struct LongDouble scale(struct LongDouble v, int by);
+struct Small makeSmall(short a, char b);
+struct Quad twice(struct Quad v);
+int callC(void);
+
+struct Pair cMakePair(int a, int b) { return (struct Pair){a, b}; }
+long cSumBig(struct Big b) { return b.a + b.b + b.c; }
+struct Big cMakeBig(long a) { return (struct Big){a, a * 2, a * 3}; }
+struct Doubles cSwap(struct Doubles d) { return (struct Doubles){d.y, d.x}; }
+struct LongDouble cScale(struct LongDouble v, int by) { return (struct LongDouble){v.a * by, v.b * by}; }
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "abi mismatch: %s\n", what);
+    failures++;
+  }
+}
+
+int main(void) {
+  struct Pair p = makePair(1, 2);
+  check(p.a == 1 && p.b == 2, "Pair makePair(int, int)");
+
+  check(sumBig((struct Big){1, 2, 3}) == 6, "long sumBig(Big)");
+
+  struct Big b = makeBig(4);
+  check(b.a == 4 && b.b == 8 && b.c == 12, "Big makeBig(long)");
+
+  check(sumMixed((struct Mixed){1.5f, 3}) == 4, "int sumMixed(Mixed)");
+
+  struct Doubles d = swap((struct Doubles){1.0, 2.0});
+  check(d.x == 2.0 && d.y == 1.0, "Doubles swap(Doubles)");
+
+  struct LongDouble v = scale((struct LongDouble){3, 0.5}, 4);
+  check(v.a == 12 && v.b == 2.0, "LongDouble scale(LongDouble, int)");
+
+  struct Small s = makeSmall(300, 7);
+  check(s.a == 300 && s.b == 7, "Small makeSmall(short, char)");
+
+  struct Quad q = twice((struct Quad){1.25Q});
+  check(q.q == 2.5Q, "Quad twice(Quad)");
+
+  check(callC() == 0, "calls from axen into c");
+
+  return failures;
+}